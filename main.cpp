@@ -8,6 +8,39 @@
 #include <assert.h>
 #include <algorithm>
 #include <typeinfo>
+#include <set>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <string_view>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <limits>
+#include <cmath>
+#include <charconv>
+#include <cfenv>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <cerrno>
+#include <cstdio>
+#include <stdexcept>
+#include <signal.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 using std::bitset;
 using std::cout;
@@ -20,1099 +53,9584 @@ using std::stringstream;
 using std::to_string;
 using std::vector;
 
-class Label
+/* Bump allocator: memory is handed out sequentially from large blocks and released all at once */
+class Arena
 {
 
 public:
-	/* Constructor */
-	Label(std::string name, int32_t address, string data_type = "instruction", string content = "")
+	Arena(size_t block_size = 1 << 16)
 	{
-		this->name = name;
-		this->address = address;
-		this->data_type = data_type;
-		this->content = content;
+		this->block_size = block_size;
 	}
 
-	/* Getters */
-	std::string getName()
+	Arena(const Arena &) = delete;
+	Arena &operator=(const Arena &) = delete;
+
+	~Arena()
+	{
+		for (auto &block : blocks)
+			free(block.first);
+	}
+
+	void *allocate(size_t size, size_t alignment)
+	{
+		while (true)
+		{
+			/* Use the current block if the aligned allocation fits, otherwise move on to the next one */
+			if (current < blocks.size())
+			{
+				uintptr_t base = (uintptr_t)blocks[current].first;
+				size_t start = (base + offset + alignment - 1) / alignment * alignment - base;
+
+				if (start + size <= blocks[current].second)
+				{
+					offset = start + size;
+					used_bytes += size;
+					return blocks[current].first + start;
+				}
+
+				current++;
+				offset = 0;
+				continue;
+			}
+
+			size_t length = std::max(block_size, size + alignment);
+			blocks.push_back({(uint8_t *)malloc(length), length});
+		}
+	}
+
+	template <typename T>
+	T *allocateArray(size_t count)
 	{
-		return name;
+		return (T *)allocate(std::max<size_t>(count, 1) * sizeof(T), alignof(T));
 	}
 
-	int32_t getAddress()
+	/* Releases everything at once, keeping the blocks for the next use */
+	void reset()
 	{
-		return address;
+		current = 0;
+		offset = 0;
+		used_bytes = 0;
 	}
 
-	string getData_type()
+	size_t used() const
 	{
-		return data_type;
+		return used_bytes;
 	}
 
-	string getContent()
+	size_t reserved() const
 	{
-		return content;
+		size_t total = 0;
+
+		for (auto &block : blocks)
+			total += block.second;
+
+		return total;
 	}
 
 private:
-	/* Instance variables */
-	std::string name;
-	int32_t address;
-	std::string data_type;
-	std::string content;
-
-	/* Overloading */
-	friend bool operator==(Label label, string string);
-	friend bool operator==(string string, Label label);
-	friend ostream &operator<<(ostream &os, Label label);
+	size_t block_size;
+	vector<std::pair<uint8_t *, size_t>> blocks;
+	size_t current = 0;
+	size_t offset = 0;
+	size_t used_bytes = 0;
 };
 
-/* Overloading functions */
-bool operator==(Label label, string string)
+/* Kinds of labels */
+enum class SymbolKind : uint8_t
 {
+	Instruction,
+	Ascii,
+	Asciiz,
+	Word,
+	Byte,
+	Half,
+	Float,
+	Double
+};
 
-	return label.getName() == string;
+/* Kind of a label from the data type of its declaration, "instruction" for the .text segment */
+SymbolKind symbolKind(const string &data_type)
+{
+	if (data_type == ".ascii")
+		return SymbolKind::Ascii;
+	if (data_type == ".asciiz")
+		return SymbolKind::Asciiz;
+	if (data_type == ".word")
+		return SymbolKind::Word;
+	if (data_type == ".byte")
+		return SymbolKind::Byte;
+	if (data_type == ".half")
+		return SymbolKind::Half;
+	if (data_type == ".float")
+		return SymbolKind::Float;
+	if (data_type == ".double")
+		return SymbolKind::Double;
+
+	return SymbolKind::Instruction;
 }
 
-bool operator==(string string, Label label)
+/* Symbols of a program as parallel arrays, their names interned in a pool of NUL-terminated strings and
+   found through an open-addressing hash index. The first definition of a name wins. Clearing the table
+   keeps its memory for the next program */
+class SymbolTable
 {
 
-	return label.getName() == string;
-}
+public:
+	void clear()
+	{
+		name_offsets.clear();
+		addresses.clear();
+		sizes.clear();
+		kinds.clear();
+		names.clear();
+		std::fill(buckets.begin(), buckets.end(), 0);
+	}
 
-ostream &operator<<(ostream &os, Label label)
-{
+	uint32_t size() const
+	{
+		return addresses.size();
+	}
 
-	return os << label.getName();
-}
+	/* Adds a symbol of bytes bytes, 0 for a label of the .text segment. Returns false, leaving the table
+	   unchanged, if the name is already defined */
+	bool add(std::string_view name, uint32_t address, SymbolKind kind, uint32_t bytes = 0)
+	{
+		if ((size() + 1) * 2 > buckets.size())
+			rehash(std::max<size_t>(64, buckets.size() * 2));
+
+		size_t bucket = locate(name);
+
+		if (buckets[bucket] != 0)
+			return false;
+
+		buckets[bucket] = size() + 1;
+		name_offsets.push_back(names.size());
+		names.append(name);
+		names += '\0';
+		addresses.push_back(address);
+		sizes.push_back(bytes);
+		kinds.push_back(kind);
+		return true;
+	}
 
-/* Vector to store all the labels in the .data and .text section */
-vector<Label> labels;
+	/* Index of the symbol with the given name, or -1 */
+	int32_t find(std::string_view name) const
+	{
+		if (buckets.empty())
+			return -1;
 
-/* Data types supported in the .data section */
-vector<string> data_types{
+		return (int32_t)buckets[locate(name)] - 1;
+	}
 
-	".ascii", ".asciiz", ".word", ".byte", ".half"
+	const char *name(uint32_t symbol) const
+	{
+		return names.data() + name_offsets[symbol];
+	}
 
-};
+	uint32_t address(uint32_t symbol) const
+	{
+		return addresses[symbol];
+	}
 
-/* Map that maps R - instructions in the format {instruction, function_code} */
-map<string, string> R_Instructions{
+	void setAddress(uint32_t symbol, uint32_t address)
+	{
+		addresses[symbol] = address;
+	}
+
+	SymbolKind kind(uint32_t symbol) const
+	{
+		return kinds[symbol];
+	}
+
+	/* Bytes of a declaration of the .data segment, 0 for a label of the .text segment */
+	uint32_t bytes(uint32_t symbol) const
+	{
+		return sizes[symbol];
+	}
 
-	{"add", "100000"}, {"addu", "100001"}, {"and", "100100"}, {"div", "011010"}, {"divu", "011011"}, {"jalr", "001001"}, {"jr", "001000"}, {"mfhi", "010000"}, {"mflo", "010010"}, {"mthi", "010001"}, {"mtlo", "010011"}, {"mult", "011000"}, {"multu", "011001"}, {"nor", "100111"}, {"or", "100101"}, {"sll", "000000"}, {"sllv", "000100"}, {"slt", "101010"}, {"sltu", "101011"}, {"sra", "000011"}, {"srav", "000111"}, {"srl", "000010"}, {"srlv", "000110"}, {"sub", "100010"}, {"subu", "100011"}, {"syscall", "001100"}, {"xor", "100110"}, {"clo", "100001"}, {"clz", "100000"}, {"mul", "000010"}, {"madd", "000000"}, {"maddu", "000001"}, {"msub", "000100"}, {"msubu", "000101"}, {"tlt", "110010"}, {"tltu", "110011"}, {"tge", "110000"}, {"tgeu", "110001"}, {"tne", "110110"}, {"teq", "110100"}
+	/* Memory the table holds, including what it keeps for reuse */
+	size_t footprint() const
+	{
+		return (name_offsets.capacity() + addresses.capacity() + sizes.capacity() + buckets.capacity()) * sizeof(uint32_t) +
+			   kinds.capacity() * sizeof(SymbolKind) + names.capacity();
+	}
+
+private:
+	vector<uint32_t> name_offsets; //Offsets into names
+	vector<uint32_t> addresses;
+	vector<uint32_t> sizes;
+	vector<SymbolKind> kinds;
+	string names;
+	vector<uint32_t> buckets; //Index + 1 of the symbol in each bucket, 0 if it is empty. At most half full
+
+	/* Bucket holding the symbol of a name, or the empty one where it would go */
+	size_t locate(std::string_view name) const
+	{
+		size_t mask = buckets.size() - 1;
+		size_t bucket = std::hash<std::string_view>()(name) & mask;
+
+		while (buckets[bucket] != 0 && name != this->name(buckets[bucket] - 1))
+			bucket = (bucket + 1) & mask;
+
+		return bucket;
+	}
 
+	void rehash(size_t count)
+	{
+		buckets.assign(count, 0);
+
+		for (uint32_t symbol = 0; symbol < size(); symbol++)
+			buckets[locate(name(symbol))] = symbol + 1;
+	}
 };
 
-/* Map that maps I - instructions in the format {instruction, op_code} */
-map<string, string> I_Instructions{
+/* Compact form of an assembled program. The assembler writes it directly: its symbols and the bytes of
+   its .data segment grow while the source is parsed and are kept in vectors that the next program
+   reuses, its instructions are parallel arrays allocated from an arena once their number is known */
+struct ProgramIR
+{
+	Arena arena;
+	SymbolTable symbols;
+
+	/* Instructions, with the fields of their encoding */
+	uint32_t instruction_count = 0;
+	uint32_t instruction_capacity = 0;
+	uint32_t *words = nullptr;
+	uint8_t *opcodes = nullptr;
+	uint8_t *rs = nullptr;
+	uint8_t *rt = nullptr;
+	uint8_t *rd = nullptr;
+	uint8_t *shamt = nullptr;
+	uint8_t *funct = nullptr;
+	int32_t *immediates = nullptr; //Sign-extended immediate, or the target of a jump
+
+	/* .data segment, from 0x10000000 */
+	vector<uint8_t> data;
+
+	/* Empties the program, keeping its memory */
+	void clear()
+	{
+		arena.reset();
+		symbols.clear();
+		data.clear();
+		instruction_count = 0;
+		instruction_capacity = 0;
+	}
+
+	/* Makes room for count instructions in all, keeping the ones already added */
+	void reserveInstructions(uint32_t count)
+	{
+		if (count <= instruction_capacity)
+			return;
+
+		grow(words, count);
+		grow(opcodes, count);
+		grow(rs, count);
+		grow(rt, count);
+		grow(rd, count);
+		grow(shamt, count);
+		grow(funct, count);
+		grow(immediates, count);
+		instruction_capacity = count;
+	}
+
+	/* Appends an instruction, splitting its word into the fields */
+	void addInstruction(uint32_t word)
+	{
+		if (instruction_count == instruction_capacity)
+			reserveInstructions(std::max<uint32_t>(16, instruction_capacity * 2));
+
+		uint32_t i = instruction_count++;
+
+		words[i] = word;
+		opcodes[i] = word >> 26;
+		rs[i] = (word >> 21) & 0x1f;
+		rt[i] = (word >> 16) & 0x1f;
+		rd[i] = (word >> 11) & 0x1f;
+		shamt[i] = (word >> 6) & 0x1f;
+		funct[i] = word & 0x3f;
+
+		if (opcodes[i] == 2 || opcodes[i] == 3)
+			immediates[i] = word & 0x3ffffff;
+		else if (opcodes[i] != 0)
+			immediates[i] = (int16_t)(word & 0xffff);
+		else
+			immediates[i] = 0;
+	}
+
+	/* Prints the memory the program takes, as allocated: the capacity of its vectors and the arena blocks */
+	void reportFootprint(ostream &os) const
+	{
+		size_t symbol_bytes = symbols.footprint();
+		size_t instruction_bytes = instruction_capacity * (sizeof(uint32_t) + 6 + sizeof(int32_t));
+
+		os << "symbols: " << symbols.size() << ", " << symbol_bytes << " bytes ("
+		   << (symbols.size() ? (double)symbol_bytes / symbols.size() : 0) << " per symbol)" << endl;
+		os << "instructions: " << instruction_count << ", " << instruction_bytes << " bytes ("
+		   << (instruction_count ? (double)instruction_bytes / instruction_count : 0) << " per instruction)" << endl;
+		os << "data: " << data.size() << " bytes, " << data.capacity() << " allocated" << endl;
+		os << "arena: " << arena.used() << " bytes used, " << arena.reserved() << " bytes reserved" << endl;
+	}
+
+private:
+	/* Moves an array of the instructions to a larger one of the arena */
+	template <typename T>
+	void grow(T *&array, uint32_t count)
+	{
+		T *grown = arena.allocateArray<T>(count);
+
+		if (instruction_count != 0)
+			memcpy(grown, array, instruction_count * sizeof(T));
 
-	{"addi", "001000"}, {"addiu", "001001"}, {"andi", "001100"}, {"beq", "000100"}, {"bgez", "000001"}, {"bgezal", "000001"}, {"bgtz", "000111"}, {"blez", "000110"}, {"bltz", "000001"}, {"bne", "000101"}, {"lb", "100000"}, {"lbu", "100100"}, {"lh", "100001"}, {"lhu", "100101"}, {"lui", "001111"}, {"lw", "100011"}, {"ori", "001101"}, {"sb", "101000"}, {"slti", "001010"}, {"sc", "111000"}, {"sltiu", "001011"}, {"sh", "101001"}, {"sw", "101011"}, {"xori", "001110"}, {"tlti", "000001"}, {"bltzal", "000001"}, {"swr", "101110"}, {"swl", "101010"}, {"ll", "110000"}, {"tltiu", "000001"}, {"lwr", "100110"}, {"lwl", "100010"}, {"tgei", "000001"}, {"tgeiu", "000001"}, {"tnei", "000001"}, {"teqi", "000001"}
+		array = grown;
+	}
+};
 
+/* Relocation types of the MIPS ELF ABI used by the assembler */
+enum RelocationType : uint8_t
+{
+	R_MIPS_26 = 4,
+	R_MIPS_HI16 = 5,
+	R_MIPS_LO16 = 6
 };
 
-map<string, string> J_Instructions{
+/* A fixup that the linker has to apply to an instruction of the .text segment */
+struct Relocation
+{
+	uint32_t offset; //Offset of the instruction in the .text segment
+	RelocationType type;
+	string symbol; //Label the instruction refers to
+};
 
-	{"j", "000010"}, {"jal", "000011"}
+/* Result of assembling a program */
+struct Image
+{
+	ProgramIR program;			  //Symbols, machine words and data
+	vector<Relocation> relocations; //Fixups for j/jal and la
+	vector<string> diagnostics;	  //Lines that could not be assembled
+	vector<uint32_t> unassembled;	  //Indices of the instructions that could not be assembled, in order
 
+	void clear()
+	{
+		program.clear();
+		relocations.clear();
+		diagnostics.clear();
+		unassembled.clear();
+	}
 };
 
-map<string, int> registers = {
+/* Data types supported in the .data section */
+vector<string> data_types{
 
-	{"$zero", 0}, {"$at", 1}, {"$v0", 2}, {"$v1", 3}, {"$a0", 4}, {"$a1", 5}, {"$a2", 6}, {"$a3", 7}, {"$t0", 8}, {"$t1", 9}, {"$t2", 10}, {"$t3", 11}, {"$t4", 12}, {"$t5", 13}, {"$t6", 14}, {"$t7", 15}, {"$s0", 16}, {"$s1", 17}, {"$s2", 18}, {"$s3", 19}, {"$s4", 20}, {"$s5", 21}, {"$s6", 22}, {"$s7", 23}, {"$t8", 24}, {"$t9", 25}, {"$k0", 26}, {"$k1", 27}, {"$gp", 28}, {"$sp", 29}, {"$fp", 30}, {"$ra", 31}
+	".ascii", ".asciiz", ".word", ".byte", ".half", ".float", ".double"
 
 };
 
-/* Looks for the address of the label from the label list */
-int label_address(string label)
+/* Compile-time assembler for small snippets, such as the test vectors embedded in C++ tests:
+   MIPS_SNIPPET("loop: addiu $t0, $t0, -1; bne $t0, $zero, loop") is a std::array<uint32_t, 2> computed
+   by the compiler. Statements end at newlines or semicolons and may carry a label; the operands are
+   registers by name or number, decimal or hexadecimal numbers and the labels of the snippet. It covers
+   the integer instructions without pseudo-instructions, and errors stop the compilation */
+enum class SnippetForm : uint8_t
 {
+	None,
+	RdRsRt,
+	RdRtRs,
+	RdRtShamt,
+	RsRt,
+	RdRs,
+	Rs,
+	Rd,
+	RtRsImmediate,
+	RtImmediate,
+	RtMemory,
+	RsRtBranch,
+	RsBranch,
+	RsImmediate,
+	Jump
+};
 
-	for (auto &elem : labels)
-	{
+/* An instruction of the compile-time assembler. For branches on one register, funct is the rt field */
+struct SnippetInstruction
+{
+	std::string_view name;
+	uint8_t op;
+	uint8_t funct;
+	SnippetForm form;
+};
 
-		if (label == elem)
-		{
+/* The integer instructions, from which the maps of the assembler below are built */
+constexpr SnippetInstruction instruction_table[] = {
 
-			return elem.getAddress();
-		}
+	{"nop", 0x00, 0x00, SnippetForm::None}, {"sll", 0x00, 0x00, SnippetForm::RdRtShamt}, {"srl", 0x00, 0x02, SnippetForm::RdRtShamt}, {"sra", 0x00, 0x03, SnippetForm::RdRtShamt}, {"sllv", 0x00, 0x04, SnippetForm::RdRtRs}, {"srlv", 0x00, 0x06, SnippetForm::RdRtRs}, {"srav", 0x00, 0x07, SnippetForm::RdRtRs}, {"jr", 0x00, 0x08, SnippetForm::Rs}, {"jalr", 0x00, 0x09, SnippetForm::RdRs}, {"syscall", 0x00, 0x0c, SnippetForm::None}, {"break", 0x00, 0x0d, SnippetForm::None}, {"mfhi", 0x00, 0x10, SnippetForm::Rd}, {"mthi", 0x00, 0x11, SnippetForm::Rs}, {"mflo", 0x00, 0x12, SnippetForm::Rd}, {"mtlo", 0x00, 0x13, SnippetForm::Rs}, {"mult", 0x00, 0x18, SnippetForm::RsRt}, {"multu", 0x00, 0x19, SnippetForm::RsRt}, {"div", 0x00, 0x1a, SnippetForm::RsRt}, {"divu", 0x00, 0x1b, SnippetForm::RsRt}, {"add", 0x00, 0x20, SnippetForm::RdRsRt}, {"addu", 0x00, 0x21, SnippetForm::RdRsRt}, {"sub", 0x00, 0x22, SnippetForm::RdRsRt}, {"subu", 0x00, 0x23, SnippetForm::RdRsRt}, {"and", 0x00, 0x24, SnippetForm::RdRsRt}, {"or", 0x00, 0x25, SnippetForm::RdRsRt}, {"xor", 0x00, 0x26, SnippetForm::RdRsRt}, {"nor", 0x00, 0x27, SnippetForm::RdRsRt}, {"slt", 0x00, 0x2a, SnippetForm::RdRsRt}, {"sltu", 0x00, 0x2b, SnippetForm::RdRsRt}, {"tge", 0x00, 0x30, SnippetForm::RsRt}, {"tgeu", 0x00, 0x31, SnippetForm::RsRt}, {"tlt", 0x00, 0x32, SnippetForm::RsRt}, {"tltu", 0x00, 0x33, SnippetForm::RsRt}, {"teq", 0x00, 0x34, SnippetForm::RsRt}, {"tne", 0x00, 0x36, SnippetForm::RsRt},
+	{"madd", 0x1c, 0x00, SnippetForm::RsRt}, {"maddu", 0x1c, 0x01, SnippetForm::RsRt}, {"mul", 0x1c, 0x02, SnippetForm::RdRsRt}, {"msub", 0x1c, 0x04, SnippetForm::RsRt}, {"msubu", 0x1c, 0x05, SnippetForm::RsRt}, {"clz", 0x1c, 0x20, SnippetForm::RdRs}, {"clo", 0x1c, 0x21, SnippetForm::RdRs},
+	{"bltz", 0x01, 0x00, SnippetForm::RsBranch}, {"bgez", 0x01, 0x01, SnippetForm::RsBranch}, {"bltzal", 0x01, 0x10, SnippetForm::RsBranch}, {"bgezal", 0x01, 0x11, SnippetForm::RsBranch}, {"tgei", 0x01, 0x08, SnippetForm::RsImmediate}, {"tgeiu", 0x01, 0x09, SnippetForm::RsImmediate}, {"tlti", 0x01, 0x0a, SnippetForm::RsImmediate}, {"tltiu", 0x01, 0x0b, SnippetForm::RsImmediate}, {"teqi", 0x01, 0x0c, SnippetForm::RsImmediate}, {"tnei", 0x01, 0x0e, SnippetForm::RsImmediate}, {"j", 0x02, 0x00, SnippetForm::Jump}, {"jal", 0x03, 0x00, SnippetForm::Jump}, {"beq", 0x04, 0x00, SnippetForm::RsRtBranch}, {"bne", 0x05, 0x00, SnippetForm::RsRtBranch}, {"blez", 0x06, 0x00, SnippetForm::RsBranch}, {"bgtz", 0x07, 0x00, SnippetForm::RsBranch},
+	{"addi", 0x08, 0x00, SnippetForm::RtRsImmediate}, {"addiu", 0x09, 0x00, SnippetForm::RtRsImmediate}, {"slti", 0x0a, 0x00, SnippetForm::RtRsImmediate}, {"sltiu", 0x0b, 0x00, SnippetForm::RtRsImmediate}, {"andi", 0x0c, 0x00, SnippetForm::RtRsImmediate}, {"ori", 0x0d, 0x00, SnippetForm::RtRsImmediate}, {"xori", 0x0e, 0x00, SnippetForm::RtRsImmediate}, {"lui", 0x0f, 0x00, SnippetForm::RtImmediate},
+	{"lb", 0x20, 0x00, SnippetForm::RtMemory}, {"lh", 0x21, 0x00, SnippetForm::RtMemory}, {"lwl", 0x22, 0x00, SnippetForm::RtMemory}, {"lw", 0x23, 0x00, SnippetForm::RtMemory}, {"lbu", 0x24, 0x00, SnippetForm::RtMemory}, {"lhu", 0x25, 0x00, SnippetForm::RtMemory}, {"lwr", 0x26, 0x00, SnippetForm::RtMemory}, {"sb", 0x28, 0x00, SnippetForm::RtMemory}, {"sh", 0x29, 0x00, SnippetForm::RtMemory}, {"swl", 0x2a, 0x00, SnippetForm::RtMemory}, {"sw", 0x2b, 0x00, SnippetForm::RtMemory}, {"swr", 0x2e, 0x00, SnippetForm::RtMemory}, {"ll", 0x30, 0x00, SnippetForm::RtMemory}, {"sc", 0x38, 0x00, SnippetForm::RtMemory}
+
+};
+
+/* Builds a map of the assembler from instruction_table in the format {instruction, field}, with the field in
+   binary: the funct field when funct is true, or else the op_code. nop is a pseudo-instruction and break is
+   left to the compile-time assembler */
+map<string, string> instructionMap(bool (*select)(const SnippetInstruction &), bool funct)
+{
+	map<string, string> result;
+
+	for (auto &instruction : instruction_table)
+	{
+		if (select(instruction) && instruction.name != "nop" && instruction.name != "break")
+			result.emplace(instruction.name, funct ? bitset<6>(instruction.funct).to_string() : bitset<6>(instruction.op).to_string());
 	}
 
-	return -1;
+	return result;
 }
 
-/* Changes the register to its corresponding 5-bit address */
-string reg_address(string reg)
+/* Map that maps R - instructions in the format {instruction, function_code} */
+map<string, string> R_Instructions = instructionMap([](const SnippetInstruction &instruction)
+													{ return instruction.op == 0x00 || instruction.op == 0x1c; }, true);
+
+/* Map that maps I - instructions in the format {instruction, op_code}, with the coprocessor 1 loads and stores */
+map<string, string> I_Instructions = []()
 {
+	map<string, string> result = instructionMap([](const SnippetInstruction &instruction)
+												{ return instruction.op != 0x00 && instruction.op != 0x1c && instruction.form != SnippetForm::Jump; }, false);
 
-	string result;
+	result.insert({{"lwc1", "110001"}, {"swc1", "111001"}, {"ldc1", "110101"}, {"sdc1", "111101"}});
 
-	for (char const &c : reg)
-	{
+	return result;
+}();
 
-		if (isdigit(c) != 0)
-		{
+map<string, string> J_Instructions = instructionMap([](const SnippetInstruction &instruction)
+													{ return instruction.form == SnippetForm::Jump; }, false);
 
-			return reg;
-		}
-		else
-			break;
+/* Map that maps the I - instructions with op_code 000001 to their rt field in the format {instruction, rt} */
+map<string, string> REGIMM_Instructions = []()
+{
+	map<string, string> result;
+
+	for (auto &instruction : instruction_table)
+	{
+		if (instruction.op == 0x01)
+			result.emplace(instruction.name, bitset<5>(instruction.funct).to_string());
 	}
 
-	auto it = registers.find(reg);
+	return result;
+}();
 
-	if (it != registers.end())
-	{
+/* Map that maps the coprocessor 0 instructions (op_code 010000) to their rs field in the format {instruction, rs} */
+map<string, string> COP0_Instructions{
 
-		result = bitset<5>(it->second).to_string();
+	{"mfc0", "00000"}, {"mtc0", "00100"}, {"eret", "10000"}
 
-		return result;
-	}
-	else
-		return "";
-}
+};
 
-/* Function that assembles an R - type instruction in machine code */
-string makeR_type(string instruction, string rd, string rs, string rt, string shamt, string funct)
-{
+/* Map that maps the coprocessor 1 moves and branches (op_code 010001) to their rs field in the format {instruction, rs} */
+map<string, string> COP1_Instructions{
 
-	string op = "000000";
-	string dest_reg = reg_address(rd);
-	string first_reg = reg_address(rs);
-	string second_reg = reg_address(rt);
+	{"mfc1", "00000"}, {"cfc1", "00010"}, {"mtc1", "00100"}, {"ctc1", "00110"}, {"bc1f", "01000"}, {"bc1t", "01000"}
 
-	int temp = stoi(shamt);
-	string shift_amt = bitset<5>(temp).to_string();
+};
 
-	if (first_reg.empty())
-		first_reg = "00000";
+/* Map that maps the floating-point operations to their function code in the format {instruction, function_code}.
+   The format comes as a suffix (add.s, cvt.d.w, c.lt.d), which goes to the rs field through COP1_Formats */
+map<string, string> FP_Instructions{
 
-	if (second_reg.empty())
-		second_reg = "00000";
+	{"add", "000000"}, {"sub", "000001"}, {"mul", "000010"}, {"div", "000011"}, {"sqrt", "000100"}, {"abs", "000101"}, {"mov", "000110"}, {"neg", "000111"}, {"round.w", "001100"}, {"trunc.w", "001101"}, {"ceil.w", "001110"}, {"floor.w", "001111"}, {"cvt.s", "100000"}, {"cvt.d", "100001"}, {"cvt.w", "100100"}, {"c.f", "110000"}, {"c.un", "110001"}, {"c.eq", "110010"}, {"c.ueq", "110011"}, {"c.olt", "110100"}, {"c.ult", "110101"}, {"c.ole", "110110"}, {"c.ule", "110111"}, {"c.sf", "111000"}, {"c.ngle", "111001"}, {"c.seq", "111010"}, {"c.ngl", "111011"}, {"c.lt", "111100"}, {"c.nge", "111101"}, {"c.le", "111110"}, {"c.ngt", "111111"}
 
-	if (dest_reg.empty())
-		dest_reg = "00000";
+};
 
-	if (instruction == "clo" || instruction == "clz" || instruction == "mul" ||
-		instruction == "madd" || instruction == "maddu" || instruction == "msub" ||
-		instruction == "msubu")
-		op = "011100";
+/* Map that maps the suffixes of the floating-point operations to their fmt field in the format {suffix, fmt} */
+map<string, string> COP1_Formats{
 
-	return op + first_reg + second_reg + dest_reg + shift_amt + funct;
-}
+	{"s", "10000"}, {"d", "10001"}, {"w", "10100"}
 
-/* Function that assembles an J - type instruction in machine code */
-string makeJ_type(string op, string address)
-{
+};
 
-	int temp = stoi(address);
-	string address_val = bitset<26>(temp).to_string();
+/* Names of the registers, by number */
+constexpr std::string_view register_table[32] = {
 
-	return op + address_val;
-}
-/* Function that assembles an I - type instruction in machine code */
-string makeI_type(string instruction, string op, string rs, string rt, string immediate)
+	"$zero", "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3", "$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7",
+	"$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7", "$t8", "$t9", "$k0", "$k1", "$gp", "$sp", "$fp", "$ra"
+
+};
+
+map<string, int> registers = []()
 {
+	map<string, int> result;
 
-	string first_reg = reg_address(rs);
-	string dest_reg = reg_address(rt);
-	int temp = stoi(immediate);
-	string imm_val = bitset<16>(temp).to_string();
+	for (int i = 0; i < 32; i++)
+		result.emplace(register_table[i], i);
+
+	return result;
+}();
 
-	if (first_reg.empty())
-		first_reg = "00000";
+/* Coprocessor 1 (floating-point) registers */
+map<string, int> fp_registers = {
 
-	if (dest_reg.empty())
-		dest_reg = "00000";
+	{"$f0", 0}, {"$f1", 1}, {"$f2", 2}, {"$f3", 3}, {"$f4", 4}, {"$f5", 5}, {"$f6", 6}, {"$f7", 7}, {"$f8", 8}, {"$f9", 9}, {"$f10", 10}, {"$f11", 11}, {"$f12", 12}, {"$f13", 13}, {"$f14", 14}, {"$f15", 15}, {"$f16", 16}, {"$f17", 17}, {"$f18", 18}, {"$f19", 19}, {"$f20", 20}, {"$f21", 21}, {"$f22", 22}, {"$f23", 23}, {"$f24", 24}, {"$f25", 25}, {"$f26", 26}, {"$f27", 27}, {"$f28", 28}, {"$f29", 29}, {"$f30", 30}, {"$f31", 31}
 
-	return op + first_reg + dest_reg + imm_val;
-}
+};
 
-/* Get rid of any spaces or tabs at the start or at the end of a line */
-string trim(string line)
+/* Classes of instructions for the counters */
+enum InstructionClass : uint8_t
 {
-	string formatted_line;
+	CLASS_ALU,
+	CLASS_MULTIPLY_DIVIDE,
+	CLASS_BRANCH,
+	CLASS_JUMP,
+	CLASS_LOAD,
+	CLASS_STORE,
+	CLASS_ATOMIC,
+	CLASS_TRAP,
+	CLASS_SYSTEM,
+	CLASS_FLOATING_POINT,
+	CLASS_INVALID,
+	CLASS_COUNT
+};
 
-	if (line.empty())
-		return "";
+const char *class_names[CLASS_COUNT] = {"alu", "multiply_divide", "branch", "jump", "load", "store", "atomic", "trap",
+										"system", "floating_point", "invalid"};
 
-	if (line.at(0) == '\t' || line.at(0) == ' ')
-	{
+/* Events and durations for the counters. The time of each assembly phase is followed by its number of runs */
+enum Counter : uint8_t
+{
+	COUNT_SYSCALLS,
+	COUNT_EXCEPTIONS,
+	COUNT_TRAPS,
+	COUNT_TLB_MISSES, //Accesses that missed the memory window of the hart, its one-entry TLB
+	COUNT_ICACHE_ACCESSES,
+	COUNT_ICACHE_MISSES,
+	COUNT_DCACHE_ACCESSES,
+	COUNT_DCACHE_MISSES,
+	COUNT_REMOVE_COMMENTS_NANOSECONDS,
+	COUNT_REMOVE_COMMENTS_RUNS,
+	COUNT_FIRST_PARSE_NANOSECONDS,
+	COUNT_FIRST_PARSE_RUNS,
+	COUNT_SECOND_PARSE_NANOSECONDS,
+	COUNT_SECOND_PARSE_RUNS,
+	COUNTER_COUNT
+};
 
-		formatted_line = line.substr(1);
-	}
-	else
-		formatted_line = line;
+/* Counters of one thread, on cache lines of their own. Only the owning thread writes them, with plain
+   loads and stores, so that counting takes no locked instruction; the atomics let other threads read
+   them at any time. The slot that threads share when all the others are taken adds atomically instead */
+struct alignas(64) CounterSlot
+{
+	std::atomic<uint64_t> instructions[CLASS_COUNT] = {};
+	std::atomic<uint64_t> values[COUNTER_COUNT] = {};
+	bool shared = false;
 
-	if (formatted_line.back() == '\t' || formatted_line.back() == ' ')
+	void count(InstructionClass instruction_class)
 	{
+		if (shared)
+			instructions[instruction_class].fetch_add(1, std::memory_order_relaxed);
+		else
+			instructions[instruction_class].store(instructions[instruction_class].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
 
-		formatted_line = formatted_line.substr(0, line.size() - 1);
+	void add(Counter counter, uint64_t amount = 1)
+	{
+		if (shared)
+			values[counter].fetch_add(amount, std::memory_order_relaxed);
+		else
+			values[counter].store(values[counter].load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
 	}
-	return formatted_line;
-}
+};
 
-/* Remove the comments in the file */
-stringstream removeComments(ifstream &is)
+/* Runtime counters of the assembler and the simulator. Threads claim a free slot the first time they count
+   and give it back when they exit, its counts staying there for the next owner to add to, and the slots
+   are added up without locking. Threads that find every slot taken share one more */
+class Metrics
 {
 
-	char ch;		  //The ch variable which will be used as the temporary memory
-	stringstream out; //Stringstream variable that will be output
+public:
+	static const size_t capacity = 256;
+
+	std::atomic<bool> enabled{false}; //Counting of the instructions by class, which costs the interpreter some speed
 
-	/* The main algorithm that will delete comments */
-	while (is >> std::noskipws >> ch)
-	{ //Reads the input stream including whitespace
+	Metrics() { shared.shared = true; }
+
+	/* Slot of the calling thread */
+	CounterSlot *slot()
+	{
+		thread_local SlotOwner owner;
 
-		/* Conditional check to see if there is a hastag (#) */
-		if (ch == '#')
+		if (owner.slot == nullptr)
 		{
-			do
+			owner.slot = &shared;
+
+			for (size_t i = 0; i < capacity; i++)
 			{
-				is >> ch;
-				if (is.peek() == '\n')
+				bool free = false;
+
+				if (claimed[i].compare_exchange_strong(free, true, std::memory_order_acquire))
 				{
+					owner.metrics = this;
+					owner.index = i;
+					owner.slot = &slots[i];
 					break;
 				}
-			} while (is.peek() != EOF);
-			is >> ch;
+			}
 		}
-		if (is.peek() != EOF)
-			out << ch; //Concatenates the character to the output string
+
+		return owner.slot;
 	}
-	/*
-    string x = out.str();
-    cout << x;
-    */
-	return out;
-}
 
-/* The first parsing function that will store the labels */
-void firstParse(string iss)
-{
-	int data_count = 0;
-	int instruction_count = 0;
+	uint64_t total(Counter counter)
+	{
+		uint64_t sum = shared.values[counter].load(std::memory_order_relaxed);
 
-	string line;		   //String variable that reads each line
-	string formatted_line; //String variable that stores the trimmed line
-	stringstream is(iss);
+		for (auto &slot : slots)
+			sum += slot.values[counter].load(std::memory_order_relaxed);
 
-	/* While loop that will look for the .data segment */
-	while (getline(is, line))
+		return sum;
+	}
+
+	uint64_t total(InstructionClass instruction_class)
 	{
+		uint64_t sum = shared.instructions[instruction_class].load(std::memory_order_relaxed);
 
-		formatted_line = trim(line);
+		for (auto &slot : slots)
+			sum += slot.instructions[instruction_class].load(std::memory_order_relaxed);
 
-		if (formatted_line == ".data")
-			break;
+		return sum;
 	}
 
-	/* Once the .data segment is found, store the labels */
-	while (getline(is, line))
+	/* The counters as a JSON object, or in the text format of Prometheus */
+	string format(bool prometheus)
 	{
+		uint64_t instructions[CLASS_COUNT];
+		uint64_t values[COUNTER_COUNT];
+		uint64_t retired = 0;
 
-		formatted_line = trim(line);
+		for (int i = 0; i < CLASS_COUNT; i++)
+			retired += instructions[i] = total((InstructionClass)i);
 
-		if (!formatted_line.empty())
-		{
+		for (int i = 0; i < COUNTER_COUNT; i++)
+			values[i] = total((Counter)i);
 
-			/* Checking if any of the data types is contained within the line */
-			for (const auto &data_type : data_types)
-			{
+		/* Without instruction counting there are no accesses to tell window hits from */
+		uint64_t accesses = instructions[CLASS_LOAD] + instructions[CLASS_STORE] + instructions[CLASS_ATOMIC];
+		uint64_t tlb_hits = accesses > values[COUNT_TLB_MISSES] ? accesses - values[COUNT_TLB_MISSES] : 0;
+		const char *phases[3] = {"removeComments", "firstParse", "secondParse"};
+		stringstream out;
 
-				if (formatted_line.find(data_type) != string::npos)
-				{
+		if (prometheus)
+		{
+			out << "# HELP mips_instructions_total Instructions retired by class.\n# TYPE mips_instructions_total counter\n";
+
+			for (int i = 0; i < CLASS_COUNT; i++)
+				out << "mips_instructions_total{class=\"" << class_names[i] << "\"} " << instructions[i] << "\n";
+
+			out << "# HELP mips_loads_total Loads retired.\n# TYPE mips_loads_total counter\nmips_loads_total "
+				<< instructions[CLASS_LOAD] << "\n";
+			out << "# HELP mips_stores_total Stores retired.\n# TYPE mips_stores_total counter\nmips_stores_total "
+				<< instructions[CLASS_STORE] << "\n";
+			out << "# HELP mips_syscalls_total System calls.\n# TYPE mips_syscalls_total counter\nmips_syscalls_total "
+				<< values[COUNT_SYSCALLS] << "\n";
+			out << "# HELP mips_exceptions_total Exceptions raised.\n# TYPE mips_exceptions_total counter\nmips_exceptions_total "
+				<< values[COUNT_EXCEPTIONS] << "\n";
+			out << "# HELP mips_traps_total Trap exceptions raised.\n# TYPE mips_traps_total counter\nmips_traps_total "
+				<< values[COUNT_TRAPS] << "\n";
+			out << "# HELP mips_tlb_lookups_total Guest memory accesses by outcome in the memory window of the harts.\n"
+				<< "# TYPE mips_tlb_lookups_total counter\nmips_tlb_lookups_total{result=\"hit\"} " << tlb_hits
+				<< "\nmips_tlb_lookups_total{result=\"miss\"} " << values[COUNT_TLB_MISSES] << "\n";
+			out << "# HELP mips_cache_lookups_total Lookups of the caches of the timing model by outcome.\n"
+				<< "# TYPE mips_cache_lookups_total counter\n";
+			out << "mips_cache_lookups_total{cache=\"instruction\",result=\"hit\"} "
+				<< values[COUNT_ICACHE_ACCESSES] - values[COUNT_ICACHE_MISSES] << "\n";
+			out << "mips_cache_lookups_total{cache=\"instruction\",result=\"miss\"} " << values[COUNT_ICACHE_MISSES] << "\n";
+			out << "mips_cache_lookups_total{cache=\"data\",result=\"hit\"} "
+				<< values[COUNT_DCACHE_ACCESSES] - values[COUNT_DCACHE_MISSES] << "\n";
+			out << "mips_cache_lookups_total{cache=\"data\",result=\"miss\"} " << values[COUNT_DCACHE_MISSES] << "\n";
+			out << "# HELP mips_assembly_phase_seconds_total Time spent in each assembly phase.\n"
+				<< "# TYPE mips_assembly_phase_seconds_total counter\n";
+
+			for (int i = 0; i < 3; i++)
+				out << "mips_assembly_phase_seconds_total{phase=\"" << phases[i] << "\"} "
+					<< values[COUNT_REMOVE_COMMENTS_NANOSECONDS + 2 * i] / 1e9 << "\n";
+
+			out << "# HELP mips_assembly_phase_runs_total Runs of each assembly phase.\n# TYPE mips_assembly_phase_runs_total counter\n";
+
+			for (int i = 0; i < 3; i++)
+				out << "mips_assembly_phase_runs_total{phase=\"" << phases[i] << "\"} "
+					<< values[COUNT_REMOVE_COMMENTS_RUNS + 2 * i] << "\n";
+
+			return out.str();
+		}
 
-					size_t delimiter = formatted_line.find(':');
-					string temp = formatted_line.substr(delimiter + 1);
-					size_t delimiter2 = temp.find(' ');
+		out << "{\n  \"instructions\": {";
 
-					string temp2 = temp.substr(delimiter2 + 1);
+		for (int i = 0; i < CLASS_COUNT; i++)
+			out << (i ? ", " : "") << "\"" << class_names[i] << "\": " << instructions[i];
 
-					if (temp2.find('"') != string::npos)
-					{
+		out << "},\n  \"instructions_total\": " << retired << ",\n  \"loads\": " << instructions[CLASS_LOAD]
+			<< ",\n  \"stores\": " << instructions[CLASS_STORE] << ",\n  \"syscalls\": " << values[COUNT_SYSCALLS]
+			<< ",\n  \"exceptions\": " << values[COUNT_EXCEPTIONS] << ",\n  \"traps\": " << values[COUNT_TRAPS]
+			<< ",\n  \"tlb\": {\"hits\": " << tlb_hits << ", \"misses\": " << values[COUNT_TLB_MISSES] << "}"
+			<< ",\n  \"icache\": {\"hits\": " << values[COUNT_ICACHE_ACCESSES] - values[COUNT_ICACHE_MISSES]
+			<< ", \"misses\": " << values[COUNT_ICACHE_MISSES] << "}"
+			<< ",\n  \"dcache\": {\"hits\": " << values[COUNT_DCACHE_ACCESSES] - values[COUNT_DCACHE_MISSES]
+			<< ", \"misses\": " << values[COUNT_DCACHE_MISSES] << "},\n  \"assembly_phases\": {";
 
-						temp2.erase(remove(temp2.begin(), temp2.end(), '"'), temp2.end());
-					}
+		for (int i = 0; i < 3; i++)
+			out << (i ? ", " : "") << "\"" << phases[i] << "\": {\"seconds\": " << values[COUNT_REMOVE_COMMENTS_NANOSECONDS + 2 * i] / 1e9
+				<< ", \"runs\": " << values[COUNT_REMOVE_COMMENTS_RUNS + 2 * i] << "}";
 
-					Label newLabel(formatted_line.substr(0, delimiter), 0x10000000 + (data_count)*4, data_type, temp2);
+		out << "}\n}\n";
+		return out.str();
+	}
 
-					data_count++;
+	/* Replaces a file with the counters. The file is written aside and renamed, so that readers such as the
+	   textfile collector of the Prometheus node exporter never see it half written */
+	bool write(string path, bool prometheus)
+	{
+		string temporary = path + ".tmp";
+		std::ofstream outfile(temporary);
 
-					labels.push_back(newLabel);
-				}
-			}
-		}
-		if (formatted_line == ".text")
-			break;
+		outfile << format(prometheus);
+		outfile.close();
+
+		return outfile.good() && rename(temporary.c_str(), path.c_str()) == 0;
 	}
 
-	/* Parsing the .text segment */
-	while (getline(is, line))
+private:
+	/* Gives the slot of a thread back when the thread exits */
+	struct SlotOwner
 	{
+		Metrics *metrics = nullptr;
+		size_t index = 0;
+		CounterSlot *slot = nullptr;
 
-		formatted_line = trim(line);
-
-		if (!formatted_line.empty())
+		~SlotOwner()
 		{
+			if (metrics != nullptr)
+				metrics->claimed[index].store(false, std::memory_order_release);
+		}
+	};
 
-			/* If a label is found */
-			if (formatted_line.find(':') != string::npos)
-			{
-				bool format = true;
+	CounterSlot slots[capacity];
+	std::atomic<bool> claimed[capacity] = {};
+	CounterSlot shared;
+};
 
-				if (formatted_line.find(' ') == string::npos)
-					format = false;
+Metrics metrics;
 
-				size_t delimiter = formatted_line.find(':');
+/* Adds the time from its construction to its destruction to the counter of an assembly phase, and one
+   to the number of runs that follows it */
+struct PhaseTimer
+{
+	Counter counter;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-				Label newLabel(formatted_line.substr(0, delimiter), 0x400000 + (instruction_count * 4));
+	PhaseTimer(Counter counter) : counter(counter) {}
 
-				if (format == true)
-					instruction_count++;
+	~PhaseTimer()
+	{
+		CounterSlot *slot = metrics.slot();
 
-				labels.push_back(newLabel);
-			}
-			else
-				instruction_count++;
-		}
+		slot->add(counter, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+		slot->add((Counter)(counter + 1));
 	}
-}
+};
 
-stringstream secondParse(stringstream &is)
+/* Writes the counters to a file periodically from a thread of its own, and once more when destroyed */
+class MetricsExporter
 {
-	int PC = 0;
-	string line;
-	string formatted_line;
-	stringstream result;
 
-	/* Looking for the .text segment */
-	while (getline(is, line))
+public:
+	MetricsExporter(string path, bool prometheus, int period_ms)
 	{
+		this->path = path;
+		this->prometheus = prometheus;
 
-		formatted_line = trim(line);
+		thread = std::thread([this, period_ms]()
+							 {
+			std::unique_lock<std::mutex> lock(mutex);
 
-		if (formatted_line == ".text")
-			break;
+			while (!stopping)
+			{
+				if (!metrics.write(this->path, this->prometheus))
+					std::cerr << this->path << ": cannot write the metrics" << endl;
+
+				wake.wait_for(lock, std::chrono::milliseconds(period_ms), [this]()
+							  { return stopping; });
+			} });
 	}
 
-	/* Assembling the .text segment */
-	while (getline(is, line))
+	MetricsExporter(const MetricsExporter &) = delete;
+	MetricsExporter &operator=(const MetricsExporter &) = delete;
+
+	~MetricsExporter()
 	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
 
-		formatted_line = trim(line);
+		wake.notify_one();
+		thread.join();
+		metrics.write(path, prometheus);
+	}
 
-		if (!formatted_line.empty())
-		{
+private:
+	string path;
+	bool prometheus;
+	bool stopping = false;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::thread thread;
+};
+
+/* Looks for the address of the label in the symbol table */
+int label_address(string label, const SymbolTable &symbols)
+{
+
+	int32_t symbol = symbols.find(label);
+
+	if (symbol >= 0)
+	{
+
+		return symbols.address(symbol);
+	}
+
+	return -1;
+}
+
+/* Field packing behind makeR_type, makeI_type and makeJ_type, usable in constant expressions */
+constexpr uint32_t packR(uint32_t op, uint32_t rs, uint32_t rt, uint32_t rd, uint32_t shamt, uint32_t funct)
+{
+	return op << 26 | (rs & 0x1f) << 21 | (rt & 0x1f) << 16 | (rd & 0x1f) << 11 | (shamt & 0x1f) << 6 | (funct & 0x3f);
+}
+
+constexpr uint32_t packI(uint32_t op, uint32_t rs, uint32_t rt, int32_t immediate)
+{
+	return op << 26 | (rs & 0x1f) << 21 | (rt & 0x1f) << 16 | ((uint32_t)immediate & 0xffff);
+}
+
+constexpr uint32_t packJ(uint32_t op, uint32_t target)
+{
+	return op << 26 | (target & 0x3ffffff);
+}
+
+/* Number of a register given by name ($t0) or number ($8), or -1 if there is no such register */
+constexpr int registerNumber(std::string_view name)
+{
+	for (int i = 0; i < 32; i++)
+	{
+		if (register_table[i] == name)
+			return i;
+	}
+
+	if (name.size() < 2 || name.size() > 3 || name[0] != '$')
+		return -1;
+
+	int number = 0;
+
+	for (size_t i = 1; i < name.size(); i++)
+	{
+		if (name[i] < '0' || name[i] > '9')
+			return -1;
+
+		number = number * 10 + (name[i] - '0');
+	}
+
+	return (number < 32) ? number : -1;
+}
+
+/* Changes the register to its corresponding 5-bit address. Fields already given in binary are kept,
+   floating-point registers are looked up after the general-purpose ones, unknown registers read as 0 */
+uint32_t reg_address(string reg)
+{
+
+	for (char const &c : reg)
+	{
+
+		if (isdigit(c) != 0)
+		{
+
+			return stoul(reg, nullptr, 2) & 0x1f;
+		}
+		else
+			break;
+	}
+
+	auto it = registers.find(reg);
+
+	if (it != registers.end())
+	{
+
+		return it->second;
+	}
+
+	it = fp_registers.find(reg);
+
+	if (it != fp_registers.end())
+	{
+
+		return it->second;
+	}
+	else
+		return 0;
+}
+
+/* Function that assembles an R - type instruction in machine code */
+uint32_t makeR_type(string instruction, string rd, string rs, string rt, string shamt, string funct)
+{
+
+	uint32_t op = 0;
+	uint32_t dest_reg = reg_address(rd);
+	uint32_t first_reg = reg_address(rs);
+	uint32_t second_reg = reg_address(rt);
+
+	int temp = stoi(shamt);
+	uint32_t shift_amt = temp & 0x1f;
+
+	if (instruction == "clo" || instruction == "clz" || instruction == "mul" ||
+		instruction == "madd" || instruction == "maddu" || instruction == "msub" ||
+		instruction == "msubu")
+		op = 0x1c;
+
+	return packR(op, first_reg, second_reg, dest_reg, shift_amt, stoul(funct, nullptr, 2));
+}
+
+/* Function that assembles an J - type instruction in machine code */
+uint32_t makeJ_type(string op, string address)
+{
+
+	int temp = stoi(address);
+	uint32_t address_val = temp & 0x3ffffff;
+
+	return packJ(stoul(op, nullptr, 2), address_val);
+}
+/* Function that assembles an I - type instruction in machine code */
+uint32_t makeI_type(string instruction, string op, string rs, string rt, string immediate)
+{
+
+	uint32_t first_reg = reg_address(rs);
+	uint32_t dest_reg = reg_address(rt);
+	int temp = stoi(immediate);
+	uint32_t imm_val = temp & 0xffff;
+
+	return packI(stoul(op, nullptr, 2), first_reg, dest_reg, imm_val);
+}
+
+/* Function that assembles a floating-point operation of coprocessor 1 in machine code */
+uint32_t makeFR_type(string fmt, string ft, string fs, string fd, string funct)
+{
+
+	uint32_t first_reg = reg_address(fs);
+	uint32_t second_reg = reg_address(ft);
+	uint32_t dest_reg = reg_address(fd);
+
+	return 0x11 << 26 | stoul(fmt, nullptr, 2) << 21 | second_reg << 16 | first_reg << 11 | dest_reg << 6 | stoul(funct, nullptr, 2);
+}
+
+/* The parser of the compile-time assembler, whose instructions are in instruction_table */
+/* A statement of a snippet, split into its label, mnemonic and operands */
+struct SnippetStatement
+{
+	std::string_view label;
+	std::string_view mnemonic;
+	std::string_view operands[3];
+	int operand_count = 0;
+};
+
+/* Labels of a snippet and their addresses */
+struct SnippetSymbols
+{
+	std::string_view names[64];
+	uint32_t addresses[64] = {};
+	int count = 0;
+};
+
+constexpr bool isSnippetSeparator(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == ',';
+}
+
+constexpr std::string_view trimSnippet(std::string_view text)
+{
+	while (!text.empty() && isSnippetSeparator(text.front()))
+		text.remove_prefix(1);
+
+	while (!text.empty() && isSnippetSeparator(text.back()))
+		text.remove_suffix(1);
+
+	return text;
+}
+
+constexpr SnippetStatement parseSnippetStatement(std::string_view text)
+{
+	SnippetStatement statement;
+	size_t colon = text.find(':');
+
+	if (colon != std::string_view::npos)
+	{
+		statement.label = trimSnippet(text.substr(0, colon));
+		text = text.substr(colon + 1);
+	}
+
+	text = trimSnippet(text);
+
+	size_t end = 0;
+
+	while (end < text.size() && !isSnippetSeparator(text[end]))
+		end++;
+
+	statement.mnemonic = text.substr(0, end);
+	text = trimSnippet(text.substr(end));
+
+	while (!text.empty())
+	{
+		if (statement.operand_count == 3)
+			throw std::invalid_argument("too many operands");
+
+		end = 0;
+
+		while (end < text.size() && !isSnippetSeparator(text[end]))
+			end++;
+
+		statement.operands[statement.operand_count++] = text.substr(0, end);
+		text = trimSnippet(text.substr(end));
+	}
+
+	return statement;
+}
+
+/* Calls visit on each statement of a snippet that holds a label or an instruction. Comments start at # */
+template <typename Visitor>
+constexpr void forEachSnippetStatement(std::string_view source, Visitor visit)
+{
+	while (!source.empty())
+	{
+		size_t end = 0;
+
+		while (end < source.size() && source[end] != '\n' && source[end] != ';')
+			end++;
+
+		std::string_view text = source.substr(0, end);
+		size_t comment = text.find('#');
+
+		if (comment != std::string_view::npos)
+			text = text.substr(0, comment);
+
+		text = trimSnippet(text);
+
+		if (!text.empty())
+			visit(parseSnippetStatement(text));
+
+		source = source.substr(std::min(end + 1, source.size()));
+	}
+}
+
+/* Number of instructions of a snippet */
+constexpr size_t snippetLength(std::string_view source)
+{
+	size_t count = 0;
+
+	forEachSnippetStatement(source, [&count](const SnippetStatement &statement)
+							{ count += !statement.mnemonic.empty(); });
+
+	return count;
+}
+
+constexpr int64_t parseSnippetNumber(std::string_view text)
+{
+	bool negative = !text.empty() && text[0] == '-';
+	int64_t value = 0;
+	int base = 10;
+
+	if (negative)
+		text.remove_prefix(1);
+
+	if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X'))
+	{
+		base = 16;
+		text.remove_prefix(2);
+	}
+
+	if (text.empty())
+		throw std::invalid_argument("missing number");
+
+	for (char c : text)
+	{
+		int digit = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : 99;
+
+		if (digit >= base)
+			throw std::invalid_argument("bad number");
+
+		value = value * base + digit;
+	}
+
+	return negative ? -value : value;
+}
+
+constexpr uint32_t snippetRegister(std::string_view name)
+{
+	int number = registerNumber(name);
+
+	if (number < 0)
+		throw std::invalid_argument("unknown register");
+
+	return number;
+}
+
+/* Address of a label of the snippet, or the value of a number */
+constexpr int64_t snippetTarget(std::string_view operand, const SnippetSymbols &symbols, bool &is_label)
+{
+	for (int i = 0; i < symbols.count; i++)
+	{
+		if (symbols.names[i] == operand)
+		{
+			is_label = true;
+			return symbols.addresses[i];
+		}
+	}
+
+	is_label = false;
+	return parseSnippetNumber(operand);
+}
+
+constexpr uint32_t encodeSnippetStatement(const SnippetStatement &statement, uint32_t address, const SnippetSymbols &symbols)
+{
+	const SnippetInstruction *instruction = nullptr;
+
+	for (auto &candidate : instruction_table)
+	{
+		if (candidate.name == statement.mnemonic)
+			instruction = &candidate;
+	}
+
+	if (instruction == nullptr)
+		throw std::invalid_argument("unsupported instruction");
+
+	const std::string_view *operands = statement.operands;
+	uint32_t op = instruction->op;
+	uint32_t funct = instruction->funct;
+	bool is_label = false;
+
+	switch (instruction->form)
+	{
+	case SnippetForm::None:
+		return packR(op, 0, 0, 0, 0, funct);
+	case SnippetForm::RdRsRt:
+		return packR(op, snippetRegister(operands[1]), snippetRegister(operands[2]), snippetRegister(operands[0]), 0, funct);
+	case SnippetForm::RdRtRs:
+		return packR(op, snippetRegister(operands[2]), snippetRegister(operands[1]), snippetRegister(operands[0]), 0, funct);
+	case SnippetForm::RdRtShamt:
+		return packR(op, 0, snippetRegister(operands[1]), snippetRegister(operands[0]), parseSnippetNumber(operands[2]), funct);
+	case SnippetForm::RsRt:
+		return packR(op, snippetRegister(operands[0]), snippetRegister(operands[1]), 0, 0, funct);
+	case SnippetForm::RdRs: //jalr rs links in $ra
+		if (statement.operand_count == 1)
+			return packR(op, snippetRegister(operands[0]), 0, 31, 0, funct);
+
+		return packR(op, snippetRegister(operands[1]), 0, snippetRegister(operands[0]), 0, funct);
+	case SnippetForm::Rs:
+		return packR(op, snippetRegister(operands[0]), 0, 0, 0, funct);
+	case SnippetForm::Rd:
+		return packR(op, 0, 0, snippetRegister(operands[0]), 0, funct);
+	case SnippetForm::RtRsImmediate:
+		return packI(op, snippetRegister(operands[1]), snippetRegister(operands[0]), parseSnippetNumber(operands[2]));
+	case SnippetForm::RtImmediate:
+		return packI(op, 0, snippetRegister(operands[0]), parseSnippetNumber(operands[1]));
+	case SnippetForm::RtMemory:
+	{
+		/* offset(base), where a missing offset is 0 */
+		std::string_view memory = operands[1];
+		size_t open_bracket = memory.find('(');
+		size_t close_bracket = memory.find(')');
+
+		if (open_bracket == std::string_view::npos || close_bracket < open_bracket)
+			throw std::invalid_argument("bad memory operand");
+
+		int64_t offset = (open_bracket == 0) ? 0 : parseSnippetNumber(memory.substr(0, open_bracket));
+
+		return packI(op, snippetRegister(memory.substr(open_bracket + 1, close_bracket - open_bracket - 1)),
+					 snippetRegister(operands[0]), offset);
+	}
+	case SnippetForm::RsRtBranch:
+	{
+		int64_t target = snippetTarget(operands[2], symbols, is_label);
+
+		return packI(op, snippetRegister(operands[0]), snippetRegister(operands[1]), is_label ? (target - (address + 4)) / 4 : target);
+	}
+	case SnippetForm::RsBranch:
+	{
+		int64_t target = snippetTarget(operands[1], symbols, is_label);
+
+		return packI(op, snippetRegister(operands[0]), funct, is_label ? (target - (address + 4)) / 4 : target);
+	}
+	case SnippetForm::RsImmediate:
+		return packI(op, snippetRegister(operands[0]), funct, parseSnippetNumber(operands[1]));
+	case SnippetForm::Jump:
+	{
+		int64_t target = snippetTarget(operands[0], symbols, is_label);
+
+		return packJ(op, is_label ? target >> 2 : target);
+	}
+	}
+
+	return 0;
+}
+
+/* Assembles a snippet of N instructions loaded at base. N comes from snippetLength(), see MIPS_SNIPPET */
+template <size_t N>
+constexpr std::array<uint32_t, N> assembleSnippet(std::string_view source, uint32_t base = 0x400000)
+{
+	std::array<uint32_t, N> words{};
+	SnippetSymbols symbols;
+	uint32_t address = base;
+
+	forEachSnippetStatement(source, [&](const SnippetStatement &statement)
+							{
+		if (!statement.label.empty())
+		{
+			if (symbols.count == 64)
+				throw std::invalid_argument("too many labels");
+
+			symbols.names[symbols.count] = statement.label;
+			symbols.addresses[symbols.count++] = address;
+		}
+
+		address += statement.mnemonic.empty() ? 0 : 4; });
+
+	size_t index = 0;
+
+	forEachSnippetStatement(source, [&](const SnippetStatement &statement)
+							{
+		if (statement.mnemonic.empty())
+			return;
+
+		words[index] = encodeSnippetStatement(statement, base + index * 4, symbols);
+		index++; });
+
+	return words;
+}
+
+/* The lambda makes the words a constant, so the compiler has to assemble them even outside of constant
+   expressions and reports the errors */
+#define MIPS_SNIPPET(source) ([]() { constexpr auto words = assembleSnippet<snippetLength(source)>(source); return words; }())
+
+#if __cplusplus >= 202002L
+/* With C++20 a literal does the same: "addu $v0, $a0, $a1; jr $ra"_mips */
+template <size_t N>
+struct SnippetLiteral
+{
+	char text[N] = {};
+
+	consteval SnippetLiteral(const char (&source)[N])
+	{
+		for (size_t i = 0; i < N; i++)
+			text[i] = source[i];
+	}
+};
+
+template <SnippetLiteral literal>
+consteval auto operator""_mips()
+{
+	constexpr std::string_view source(literal.text, sizeof(literal.text) - 1);
+
+	return assembleSnippet<snippetLength(source)>(source);
+}
+#endif
+
+/* The compile-time assembler checked against the encodings of MARS */
+static_assert(registerNumber("$zero") == 0 && registerNumber("$t0") == 8 && registerNumber("$ra") == 31, "register names");
+static_assert(registerNumber("$29") == 29 && registerNumber("$32") == -1 && registerNumber("$f0") == -1, "register numbers");
+static_assert(snippetLength("start:\n  addu $v0, $a0, $a1 # sum\n\n  jr $ra; nop") == 3, "statements");
+static_assert(MIPS_SNIPPET("add $t0, $t1, $t2")[0] == 0x012a4020, "add");
+static_assert(MIPS_SNIPPET("sll $t0, $t1, 4")[0] == 0x00094100, "sll");
+static_assert(MIPS_SNIPPET("srav $v0, $a0, $a1")[0] == 0x00a41007, "srav");
+static_assert(MIPS_SNIPPET("mult $t0, $t1; mflo $t2")[1] == 0x00005012, "mflo");
+static_assert(MIPS_SNIPPET("jalr $t9")[0] == 0x0320f809, "jalr");
+static_assert(MIPS_SNIPPET("mul $s0, $s1, $s2")[0] == 0x72328002, "mul");
+static_assert(MIPS_SNIPPET("addiu $sp, $sp, -32")[0] == 0x27bdffe0, "addiu");
+static_assert(MIPS_SNIPPET("lui $at, 0x1001")[0] == 0x3c011001, "lui");
+static_assert(MIPS_SNIPPET("lw $ra, 28($sp)")[0] == 0x8fbf001c, "lw");
+static_assert(MIPS_SNIPPET("sb $t0, -1($a0)")[0] == 0xa088ffff, "sb");
+static_assert(MIPS_SNIPPET("loop: addiu $t0, $t0, -1\nbne $t0, $zero, loop")[1] == 0x1500fffe, "backward branch");
+static_assert(MIPS_SNIPPET("bgez $a0, done; nop; done: syscall")[0] == 0x04810001, "forward branch");
+static_assert(MIPS_SNIPPET("j end; nop; end: jr $ra")[0] == 0x08100002, "jump");
+static_assert(MIPS_SNIPPET("nop; syscall")[1] == 0x0000000c, "syscall");
+static_assert(MIPS_SNIPPET("teqi $t0, 5")[0] == 0x050c0005 && MIPS_SNIPPET("tltiu $a0, -1")[0] == 0x048bffff, "trap immediates");
+static_assert(assembleSnippet<1>("jal 0x100", 0)[0] == 0x0c000100, "jump field");
+
+/* Get rid of any spaces or tabs at the start or at the end of a line */
+string trim(string line)
+{
+	string formatted_line;
+
+	if (line.empty())
+		return "";
+
+	if (line.at(0) == '\t' || line.at(0) == ' ')
+	{
+
+		formatted_line = line.substr(1);
+	}
+	else
+		formatted_line = line;
+
+	if (formatted_line.back() == '\t' || formatted_line.back() == ' ')
+	{
+
+		formatted_line = formatted_line.substr(0, line.size() - 1);
+	}
+	return formatted_line;
+}
+
+/* Remove the comments in the source, writing the result to out */
+void removeComments(std::string_view source, string &out)
+{
+	PhaseTimer timer(COUNT_REMOVE_COMMENTS_NANOSECONDS);
+	size_t position = 0;
+
+	out.clear();
+
+	while (position < source.size())
+	{
+
+		size_t comment = source.find('#', position);
+
+		if (comment == string::npos)
+		{
+			out.append(source.substr(position));
+			break;
+		}
+
+		out.append(source.substr(position, comment - position));
+
+		/* The comment ends at the end of the line, the newline is kept */
+		position = source.find('\n', comment);
+
+		if (position == string::npos)
+			break;
+	}
+}
+
+/* Reads the line of source that starts at position into line, the way getline does, and moves position
+   to the next one. Returns false once the source is exhausted */
+bool readLine(std::string_view source, size_t &position, string &line)
+{
+	if (position >= source.size())
+		return false;
+
+	size_t end = source.find('\n', position);
+
+	if (end == string::npos)
+		end = source.size();
+
+	line.assign(source.substr(position, end - position));
+	position = end + 1;
+
+	return true;
+}
+
+/* Remove the comments in the file */
+stringstream removeComments(std::istream &is)
+{
+	stringstream in;
+	string out;
+
+	in << is.rdbuf();
+	removeComments(in.str(), out);
+
+	return stringstream(out);
+}
+
+/* Splits an instruction into its tokens, removing the commas between the operands */
+vector<string> tokenize(string line)
+{
+	vector<string> tokens;	//Vector to store the tokens
+	stringstream ss(line);	//Change line into a stringstream
+	string intermediate;	//Intermediate string variable to hold the tokens
+
+	while (getline(ss, intermediate, ' '))
+	{
+
+		if (!intermediate.empty())
+		{
+			/* Remove the commas at the end and store them in the tokens vector */
+			if (intermediate.back() == ',')
+			{
+
+				tokens.push_back(intermediate.substr(0, intermediate.size() - 1));
+			}
+			else
+				tokens.push_back(intermediate);
+		}
+	}
+
+	return tokens;
+}
+
+/* Reads a decimal or hexadecimal number. Returns false if the string is not a number */
+bool parseNumber(string value, int64_t &number)
+{
+	char *end = nullptr;
+
+	if (value.empty())
+		return false;
+
+	number = strtoll(value.c_str(), &end, 0);
+
+	return *end == '\0';
+}
+
+/* Expands a pseudo-instruction into the instructions that implement it, using the shortest
+   encoding for its immediate, or for the address of a label of the .data segment of symbols, whose
+   addresses are known before the .text segment is sized. Other instructions are returned unchanged */
+vector<vector<string>> expandPseudoInstruction(vector<string> tokens, const SymbolTable *symbols = nullptr)
+{
+	int64_t value;
+
+	if (tokens.empty())
+		return {tokens};
+
+	string &op = tokens[0];
+
+	if (op == "nop")
+	{
+		return {{"sll", "$zero", "$zero", "0"}};
+	}
+	else if (op == "move" && tokens.size() == 3)
+	{
+		return {{"addu", tokens[1], "$zero", tokens[2]}};
+	}
+	else if ((op == "li" || op == "la") && tokens.size() == 3 && parseNumber(tokens[2], value))
+	{
+
+		if (value >= -32768 && value <= 32767)
+			return {{"addiu", tokens[1], "$zero", to_string(value)}};
+
+		if (value >= 0 && value <= 65535)
+			return {{"ori", tokens[1], "$zero", to_string(value)}};
+
+		uint32_t word = value;
+		vector<vector<string>> result{{"lui", tokens[1], to_string(word >> 16)}};
+
+		if ((word & 0xffff) != 0)
+			result.push_back({"ori", tokens[1], tokens[1], to_string(word & 0xffff)});
+
+		return result;
+	}
+	else if (op == "la" && tokens.size() == 3)
+	{
+		int32_t symbol = (symbols != nullptr) ? symbols->find(tokens[2]) : -1;
+		bool data = symbol >= 0 && symbols->kind(symbol) != SymbolKind::Instruction;
+		int32_t address = data ? symbols->address(symbol) : 0;
+
+		/* A label of the .data segment takes one instruction when its address allows. The address of the others
+		   depends on the size of the code, so they take two */
+		if (data && address >= -32768 && address <= 32767)
+			return {{"addiu", tokens[1], "$zero", to_string(address)}};
+
+		if (data && (address & 0xffff) == 0)
+			return {{"lui", tokens[1], to_string((uint32_t)address >> 16)}};
+
+		return {{"lui", tokens[1], "%hi(" + tokens[2] + ")"},
+				{"addiu", tokens[1], tokens[1], "%lo(" + tokens[2] + ")"}};
+	}
+	else if (op == "b" && tokens.size() == 2)
+	{
+		return {{"beq", "$zero", "$zero", tokens[1]}};
+	}
+	else if ((op == "beqz" || op == "bnez") && tokens.size() == 3)
+	{
+		return {{op == "beqz" ? "beq" : "bne", tokens[1], "$zero", tokens[2]}};
+	}
+	else if (op == "blt" && tokens.size() == 4)
+	{
+		return {{"slt", "$at", tokens[1], tokens[2]}, {"bne", "$at", "$zero", tokens[3]}};
+	}
+	else if (op == "bgt" && tokens.size() == 4)
+	{
+		return {{"slt", "$at", tokens[2], tokens[1]}, {"bne", "$at", "$zero", tokens[3]}};
+	}
+	else if (op == "ble" && tokens.size() == 4)
+	{
+		return {{"slt", "$at", tokens[2], tokens[1]}, {"beq", "$at", "$zero", tokens[3]}};
+	}
+	else if (op == "bge" && tokens.size() == 4)
+	{
+		return {{"slt", "$at", tokens[1], tokens[2]}, {"beq", "$at", "$zero", tokens[3]}};
+	}
+
+	return {tokens};
+}
+
+/* Returns the label of a %hi(label) or %lo(label) operand, or an empty string */
+string addressHalf(string operand, string half)
+{
+
+	if (operand.size() > half.size() + 2 && operand.compare(0, half.size() + 1, half + "(") == 0 && operand.back() == ')')
+		return operand.substr(half.size() + 1, operand.size() - half.size() - 2);
+
+	return "";
+}
+
+/* Resolves a %hi(label) or %lo(label) immediate to the halves used by a lui/addiu pair */
+string immediate(string operand, const SymbolTable &symbols)
+{
+	string label = addressHalf(operand, "%hi");
+	bool high = !label.empty();
+
+	if (!high)
+		label = addressHalf(operand, "%lo");
+
+	int32_t symbol = label.empty() ? -1 : symbols.find(label);
+
+	if (symbol < 0)
+		return operand;
+
+	/* addiu sign-extends the low half, so the high half absorbs its carry */
+	if (high)
+		return to_string((symbols.address(symbol) + 0x8000) >> 16);
+
+	return to_string((int16_t)(symbols.address(symbol) & 0xffff));
+}
+
+/* Splits the values of a .word, .half or .byte declaration */
+vector<string> dataValues(string content)
+{
+	vector<string> values;
+	stringstream ss(content);
+	string value;
+
+	while (getline(ss, value, ','))
+	{
+
+		value.erase(remove(value.begin(), value.end(), ' '), value.end());
+
+		if (!value.empty())
+			values.push_back(value);
+	}
+
+	return values;
+}
+
+/* Replaces the escape sequences of an .ascii or .asciiz string with the characters they stand for */
+string unescape(string content)
+{
+	string result;
+
+	for (size_t i = 0; i < content.size(); i++)
+	{
+
+		if (content[i] != '\\' || i + 1 == content.size())
+		{
+			result += content[i];
+			continue;
+		}
+
+		switch (content[++i])
+		{
+		case 'n':
+			result += '\n';
+			break;
+		case 't':
+			result += '\t';
+			break;
+		case '0':
+			result += '\0';
+			break;
+		default:
+			result += content[i];
+		}
+	}
+
+	return result;
+}
+
+/* Alignment in bytes of a data type of the .data segment */
+int32_t dataAlignment(string data_type)
+{
+
+	if (data_type == ".word")
+		return 4;
+
+	if (data_type == ".half")
+		return 2;
+
+	if (data_type == ".float")
+		return 4;
+
+	if (data_type == ".double")
+		return 8;
+
+	return 1;
+}
+
+/* Number of bytes a declaration of the .data segment takes */
+int32_t dataSize(string data_type, string content)
+{
+
+	if (data_type == ".ascii")
+		return unescape(content).size();
+
+	if (data_type == ".asciiz")
+		return unescape(content).size() + 1;
+
+	return dataValues(content).size() * dataAlignment(data_type);
+}
+
+/* Writes the values of a declaration of the .data segment to out, which has room for its dataSize().
+   Returns false if a value is not a number */
+bool storeData(uint8_t *out, string data_type, string content, bool big_endian)
+{
+
+	if (data_type == ".ascii" || data_type == ".asciiz")
+	{
+
+		string text = unescape(content);
+		copy(text.begin(), text.end(), out);
+		return true;
+	}
+
+	int32_t size = dataAlignment(data_type);
+
+	for (auto &value : dataValues(content))
+	{
+
+		uint64_t number;
+
+		try
+		{
+			/* Floating-point values are stored as their IEEE 754 bits */
+			if (data_type == ".float")
+			{
+				float single = stof(value);
+				uint32_t bits;
+				memcpy(&bits, &single, 4);
+				number = bits;
+			}
+			else if (data_type == ".double")
+			{
+				double value_double = stod(value);
+				memcpy(&number, &value_double, 8);
+			}
+			else
+				number = (uint32_t)stol(value, nullptr, 0);
+		}
+		catch (const std::exception &)
+		{
+			return false;
+		}
+
+		for (int32_t i = 0; i < size; i++)
+		{
+
+			int32_t shift = big_endian ? (size - 1 - i) * 8 : i * 8;
+			out[i] = (number >> shift) & 0xff;
+		}
+
+		out += size;
+	}
+
+	return true;
+}
+
+/* The first parsing function, which lays the program out in image: it adds the labels to the symbols,
+   writes the .data segment and makes room for the instructions of the .text segment. The addresses of
+   the data are not used to shorten la in a relocatable object, whose labels the linker may still move */
+void firstParse(std::string_view source, Image &image, bool big_endian = true, bool relocatable = false)
+{
+	PhaseTimer timer(COUNT_FIRST_PARSE_NANOSECONDS);
+	ProgramIR &program = image.program;
+	int32_t data_offset = 0;
+	int instruction_count = 0;
+
+	string line;		   //String variable that reads each line
+	string formatted_line; //String variable that stores the trimmed line
+	size_t position = 0;   //Start of the next line of the source
+
+	image.clear();
+
+	/* While loop that will look for the .data segment, a program may also start with its .text segment */
+	while (readLine(source, position, line))
+	{
+
+		formatted_line = trim(line);
+
+		if (formatted_line == ".data" || formatted_line == ".text")
+			break;
+	}
+
+	/* Once the .data segment is found, store the labels */
+	while (formatted_line != ".text" && readLine(source, position, line))
+	{
+
+		formatted_line = trim(line);
+
+		if (!formatted_line.empty())
+		{
+
+			/* Checking if the line declares one of the data types */
+			size_t delimiter = formatted_line.find(':');
+			stringstream declaration(formatted_line.substr(delimiter + 1));
+			string data_type;
+
+			declaration >> data_type;
+
+			if (find(data_types.begin(), data_types.end(), data_type) != data_types.end())
+			{
+
+				string content;
+				getline(declaration, content);
+				content = trim(content);
+
+				if (content.find('"') != string::npos)
+				{
+
+					content.erase(remove(content.begin(), content.end(), '"'), content.end());
+				}
+
+				/* Each declaration starts at the next address aligned to its data type */
+				int32_t alignment = dataAlignment(data_type);
+				data_offset = (data_offset + alignment - 1) / alignment * alignment;
+
+				int32_t size = dataSize(data_type, content);
+
+				program.symbols.add(formatted_line.substr(0, delimiter), 0x10000000 + data_offset, symbolKind(data_type), size);
+				program.data.resize(data_offset + size);
+
+				if (!storeData(program.data.data() + data_offset, data_type, content, big_endian))
+				{
+					stringstream diagnostic;
+					diagnostic << "0x" << std::hex << 0x10000000 + data_offset << ": cannot assemble '" << formatted_line << "'";
+					image.diagnostics.push_back(diagnostic.str());
+				}
+
+				data_offset += size;
+			}
+		}
+		if (formatted_line == ".text")
+			break;
+	}
+
+	/* Parsing the .text segment */
+	const SymbolTable *addresses = relocatable ? nullptr : &program.symbols;
+
+	while (readLine(source, position, line))
+	{
+
+		formatted_line = trim(line);
+
+		if (!formatted_line.empty())
+		{
+
+			/* If a label is found */
+			if (formatted_line.find(':') != string::npos)
+			{
+				bool format = true;
+
+				if (formatted_line.find(' ') == string::npos)
+					format = false;
+
+				size_t delimiter = formatted_line.find(':');
+
+				program.symbols.add(formatted_line.substr(0, delimiter), 0x400000 + (instruction_count * 4), SymbolKind::Instruction);
+
+				if (format == true)
+					instruction_count += expandPseudoInstruction(tokenize(formatted_line.substr(formatted_line.find(' ') + 1)), addresses).size();
+			}
+			else
+				instruction_count += expandPseudoInstruction(tokenize(formatted_line), addresses).size();
+		}
+	}
+
+	program.reserveInstructions(instruction_count);
+}
+
+/* Assembles a single tokenized instruction located at instruction index PC of the .text segment
+   into code. Returns false if the instruction is not supported */
+bool encodeWord(vector<string> &tokens, int PC, const SymbolTable &symbols, uint32_t &code)
+{
+
+	if (tokens.empty())
+		return false;
+
+	/* Missing operands read as empty strings, which the encoders reject or treat as $zero */
+	if (tokens.size() < 4)
+	{
+		vector<string> padded = tokens;
+		padded.resize(4);
+		return encodeWord(padded, PC, symbols, code);
+	}
+
+	map<string, string>::iterator it;
+
+	if (tokens[0] == "add")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], tokens[2], tokens[3], "0", it->second);
+	}
+	else if (tokens[0] == "addu")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], tokens[2], tokens[3], "0", it->second);
+	}
+	else if (tokens[0] == "addi")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		code = makeI_type(tokens[0], it->second, tokens[2], tokens[1], immediate(tokens[3], symbols));
+	}
+	else if (tokens[0] == "addiu")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		code = makeI_type(tokens[0], it->second, tokens[2], tokens[1], immediate(tokens[3], symbols));
+	}
+	else if (tokens[0] == "and")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], tokens[2], tokens[3], "0", it->second);
+	}
+	else if (tokens[0] == "andi")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		code = makeI_type(tokens[0], it->second, tokens[2], tokens[1], tokens[3]);
+	}
+	else if (tokens[0] == "clo")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], tokens[2], "", "0", it->second);
+	}
+	else if (tokens[0] == "clz")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], tokens[2], "", "0", it->second);
+	}
+	else if (tokens[0] == "div")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second);
+	}
+	else if (tokens[0] == "divu")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second);
+	}
+	else if (tokens[0] == "mult")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second);
+	}
+	else if (tokens[0] == "multu")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second);
+	}
+	else if (tokens[0] == "mul")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], tokens[2], tokens[3], "0", it->second);
+	}
+	else if (tokens[0] == "madd")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second);
+	}
+	else if (tokens[0] == "msub")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second);
+	}
+	else if (tokens[0] == "maddu")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second);
+	}
+	else if (tokens[0] == "msubu")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second);
+	}
+	else if (tokens[0] == "nor")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], tokens[2], tokens[3], "0", it->second);
+	}
+	else if (tokens[0] == "or")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], tokens[2], tokens[3], "0", it->second);
+	}
+	else if (tokens[0] == "ori")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		code = makeI_type(tokens[0], it->second, tokens[2], tokens[1], immediate(tokens[3], symbols));
+	}
+	else if (tokens[0] == "sll")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], "", tokens[2], tokens[3], it->second);
+	}
+	else if (tokens[0] == "sllv")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], tokens[3], tokens[2], "0", it->second);
+	}
+	else if (tokens[0] == "sra")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], "", tokens[2], tokens[3], it->second);
+	}
+	else if (tokens[0] == "srav")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], tokens[3], tokens[2], "0", it->second);
+	}
+	else if (tokens[0] == "srl")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], "", tokens[2], tokens[3], it->second);
+	}
+	else if (tokens[0] == "srlv")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], tokens[3], tokens[2], "0", it->second);
+	}
+	else if (tokens[0] == "sub")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], tokens[2], tokens[3], "0", it->second);
+	}
+	else if (tokens[0] == "subu")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], tokens[3], tokens[2], "0", it->second);
+	}
+	else if (tokens[0] == "xor")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], tokens[2], tokens[3], "0", it->second);
+	}
+	else if (tokens[0] == "xori")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		code = makeI_type(tokens[0], it->second, tokens[2], tokens[1], tokens[3]);
+	}
+	else if (tokens[0] == "lui")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		code = makeI_type(tokens[0], it->second, "00000", tokens[1], immediate(tokens[2], symbols));
+	}
+	else if (tokens[0] == "slt")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], tokens[2], tokens[3], "0", it->second);
+	}
+	else if (tokens[0] == "sltu")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], tokens[2], tokens[3], "0", it->second);
+	}
+	else if (tokens[0] == "slti")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		code = makeI_type(tokens[0], it->second, tokens[2], tokens[1], tokens[3]);
+	}
+	else if (tokens[0] == "sltiu")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		code = makeI_type(tokens[0], it->second, tokens[2], tokens[1], tokens[3]);
+	}
+	else if (tokens[0] == "beq")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		int temp = label_address(tokens[3], symbols);
+
+		if (temp == -1)
+		{
+
+			code = makeI_type(tokens[0], it->second, tokens[1], tokens[2], tokens[3]);
+		}
+		else
+		{
+
+			int relative_addr = temp - (0x400000 + ((PC * 4) + 4));
+			code = makeI_type(tokens[0], it->second, tokens[1], tokens[2], to_string(relative_addr / 4));
+		}
+	}
+	else if (tokens[0] == "bgez")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		int temp = label_address(tokens[2], symbols);
+
+		if (temp == -1)
+		{
+
+			code = makeI_type(tokens[0], it->second, tokens[1], "00001", tokens[2]);
+		}
+		else
+		{
+
+			int relative_addr = temp - (0x400000 + ((PC * 4) + 4));
+			code = makeI_type(tokens[0], it->second, tokens[1], "00001", to_string(relative_addr / 4));
+		}
+	}
+	else if (tokens[0] == "bgezal")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		int32_t temp = label_address(tokens[2], symbols);
+
+		if (temp == -1)
+		{
+
+			code = makeI_type(tokens[0], it->second, tokens[1], "10001", tokens[2]);
+		}
+		else
+		{
+
+			int relative_addr = temp - (0x400000 + ((PC * 4) + 4));
+			code = makeI_type(tokens[0], it->second, tokens[1], "10001", to_string(relative_addr / 4));
+		}
+	}
+	else if (tokens[0] == "bgtz")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		int temp = label_address(tokens[2], symbols);
+
+		if (temp == -1)
+		{
+
+			code = makeI_type(tokens[0], it->second, tokens[1], "00000", tokens[2]);
+		}
+		else
+		{
+
+			int relative_addr = temp - (0x400000 + ((PC * 4) + 4));
+			code = makeI_type(tokens[0], it->second, tokens[1], "00000", to_string(relative_addr / 4));
+		}
+	}
+	else if (tokens[0] == "blez")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		int temp = label_address(tokens[2], symbols);
+
+		if (temp == -1)
+		{
+
+			code = makeI_type(tokens[0], it->second, tokens[1], "00000", tokens[2]);
+		}
+		else
+		{
+
+			int relative_addr = temp - (0x400000 + ((PC * 4) + 4));
+			code = makeI_type(tokens[0], it->second, tokens[1], "00000", to_string(relative_addr / 4));
+		}
+	}
+	else if (tokens[0] == "bltzal")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		int temp = label_address(tokens[2], symbols);
+
+		if (temp == -1)
+		{
+
+			code = makeI_type(tokens[0], it->second, tokens[1], "10000", tokens[2]);
+		}
+		else
+		{
+
+			int relative_addr = temp - (0x400000 + ((PC * 4) + 4));
+			code = makeI_type(tokens[0], it->second, tokens[1], "10000", to_string(relative_addr / 4));
+		}
+	}
+	else if (tokens[0] == "bltz")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		int temp = label_address(tokens[2], symbols);
+
+		if (temp == -1)
+		{
+
+			code = makeI_type(tokens[0], it->second, tokens[1], "00000", tokens[2]);
+		}
+		else
+		{
+
+			int relative_addr = temp - (0x400000 + ((PC * 4) + 4));
+			code = makeI_type(tokens[0], it->second, tokens[1], "00000", to_string(relative_addr / 4));
+		}
+	}
+	else if (tokens[0] == "bne")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		int temp = label_address(tokens[3], symbols);
+
+		if (temp == -1)
+		{
+
+			code = makeI_type(tokens[0], it->second, tokens[1], tokens[2], tokens[3]);
+		}
+		else
+		{
+
+			int relative_addr = temp - (0x400000 + ((PC * 4) + 4));
+			code = makeI_type(tokens[0], it->second, tokens[1], tokens[2], to_string(relative_addr / 4));
+		}
+	}
+	else if (tokens[0] == "j")
+	{
+
+		it = J_Instructions.find(tokens[0]);
+		int temp = label_address(tokens[1], symbols);
+
+		if (temp == -1)
+		{
+
+			code = makeJ_type(it->second, tokens[1]);
+		}
+		else
+		{
+
+			code = makeJ_type(it->second, to_string(temp / 4));
+		}
+	}
+	else if (tokens[0] == "jal")
+	{
+
+		it = J_Instructions.find(tokens[0]);
+		int temp = label_address(tokens[1], symbols);
+
+		if (temp == -1)
+		{
+
+			code = makeJ_type(it->second, tokens[1]);
+		}
+		else
+		{
+
+			code = makeJ_type(it->second, to_string(temp >> 2));
+		}
+	}
+	else if (tokens[0] == "jalr")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], tokens[2], "", "0", it->second);
+	}
+	else if (tokens[0] == "jr")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], "", tokens[1], "", "0", it->second);
+	}
+	else if (tokens[0] == "teq")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second);
+	}
+	else if (tokens[0] == "teqi")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		code = makeI_type(tokens[0], it->second, tokens[1], "01100", tokens[2]);
+	}
+	else if (tokens[0] == "tne")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second);
+	}
+	else if (tokens[0] == "tnei")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		code = makeI_type(tokens[0], it->second, tokens[1], "01110", tokens[2]);
+	}
+	else if (tokens[0] == "tge")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second);
+	}
+	else if (tokens[0] == "tgeu")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second);
+	}
+	else if (tokens[0] == "tgei")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		code = makeI_type(tokens[0], it->second, tokens[1], "01000", tokens[2]);
+	}
+	else if (tokens[0] == "tgeiu")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		code = makeI_type(tokens[0], it->second, tokens[1], "01001", tokens[2]);
+	}
+	else if (tokens[0] == "tlt")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second);
+	}
+	else if (tokens[0] == "tltu")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second);
+	}
+	else if (tokens[0] == "tlti")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		code = makeI_type(tokens[0], it->second, tokens[1], "01010", tokens[2]);
+	}
+	else if (tokens[0] == "tltiu")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		code = makeI_type(tokens[0], it->second, tokens[1], "01011", tokens[2]);
+	}
+	else if (tokens[0] == "lb")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		size_t open_bracket = tokens[2].find('(');
+		size_t close_bracket = tokens[2].find(')');
+		string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+
+		code = makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]);
+	}
+	else if (tokens[0] == "lbu")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		size_t open_bracket = tokens[2].find('(');
+		size_t close_bracket = tokens[2].find(')');
+		string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+
+		code = makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]);
+	}
+	else if (tokens[0] == "lh")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		size_t open_bracket = tokens[2].find('(');
+		size_t close_bracket = tokens[2].find(')');
+		string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+
+		code = makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]);
+	}
+	else if (tokens[0] == "lhu")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		size_t open_bracket = tokens[2].find('(');
+		size_t close_bracket = tokens[2].find(')');
+		string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+
+		code = makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]);
+	}
+	else if (tokens[0] == "lw")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		size_t open_bracket = tokens[2].find('(');
+		size_t close_bracket = tokens[2].find(')');
+		string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+
+		code = makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]);
+	}
+	else if (tokens[0] == "lwl")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		size_t open_bracket = tokens[2].find('(');
+		size_t close_bracket = tokens[2].find(')');
+		string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+
+		code = makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]);
+	}
+	else if (tokens[0] == "lwr")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		size_t open_bracket = tokens[2].find('(');
+		size_t close_bracket = tokens[2].find(')');
+		string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+
+		code = makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]);
+	}
+	else if (tokens[0] == "ll")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		size_t open_bracket = tokens[2].find('(');
+		size_t close_bracket = tokens[2].find(')');
+		string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+
+		code = makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]);
+	}
+	else if (tokens[0] == "sb")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		size_t open_bracket = tokens[2].find('(');
+		size_t close_bracket = tokens[2].find(')');
+		string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+
+		code = makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]);
+	}
+	else if (tokens[0] == "sh")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		size_t open_bracket = tokens[2].find('(');
+		size_t close_bracket = tokens[2].find(')');
+		string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+
+		code = makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]);
+	}
+	else if (tokens[0] == "sw")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		size_t open_bracket = tokens[2].find('(');
+		size_t close_bracket = tokens[2].find(')');
+		string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+
+		code = makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]);
+	}
+	else if (tokens[0] == "swl")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		size_t open_bracket = tokens[2].find('(');
+		size_t close_bracket = tokens[2].find(')');
+		string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+
+		code = makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]);
+	}
+	else if (tokens[0] == "swr")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		size_t open_bracket = tokens[2].find('(');
+		size_t close_bracket = tokens[2].find(')');
+		string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+
+		code = makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]);
+	}
+	else if (tokens[0] == "sc")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		size_t open_bracket = tokens[2].find('(');
+		size_t close_bracket = tokens[2].find(')');
+		string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+
+		code = makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]);
+	}
+	else if (tokens[0] == "mfhi")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], "", "", "0", it->second);
+	}
+	else if (tokens[0] == "mflo")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], tokens[1], "", "", "0", it->second);
+	}
+	else if (tokens[0] == "mthi")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], "", tokens[1], "", "0", it->second);
+	}
+	else if (tokens[0] == "mtlo")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], "", tokens[1], "", "0", it->second);
+	}
+	else if (tokens[0] == "syscall")
+	{
+
+		it = R_Instructions.find(tokens[0]);
+		code = makeR_type(tokens[0], "", "", "", "0", it->second);
+	}
+	else if (tokens[0] == "mfc0" || tokens[0] == "mtc0")
+	{
+
+		/* mfc0/mtc0 rt, rd[, sel], with the coprocessor 0 register given by its number ($12 or 12) */
+		it = COP0_Instructions.find(tokens[0]);
+		uint32_t cp0_reg = stoul(tokens[2].substr(tokens[2][0] == '$')) & 0x1f;
+		uint32_t select = tokens[3].empty() ? 0 : stoul(tokens[3]) & 7;
+
+		code = 0x10 << 26 | stoul(it->second, nullptr, 2) << 21 | reg_address(tokens[1]) << 16 | cp0_reg << 11 | select;
+	}
+	else if (tokens[0] == "eret")
+	{
+
+		it = COP0_Instructions.find(tokens[0]);
+		code = 0x10 << 26 | stoul(it->second, nullptr, 2) << 21 | 0x18;
+	}
+	else if (tokens[0] == "lwc1" || tokens[0] == "swc1" || tokens[0] == "ldc1" || tokens[0] == "sdc1")
+	{
+
+		it = I_Instructions.find(tokens[0]);
+		size_t open_bracket = tokens[2].find('(');
+		size_t close_bracket = tokens[2].find(')');
+		string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+
+		code = makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]);
+	}
+	else if (tokens[0] == "mfc1" || tokens[0] == "mtc1")
+	{
+
+		it = COP1_Instructions.find(tokens[0]);
+		code = 0x11 << 26 | stoul(it->second, nullptr, 2) << 21 | reg_address(tokens[1]) << 16 | reg_address(tokens[2]) << 11;
+	}
+	else if (tokens[0] == "cfc1" || tokens[0] == "ctc1")
+	{
+
+		/* cfc1/ctc1 rt, fs, with the control register given by its number ($31 or 31) */
+		it = COP1_Instructions.find(tokens[0]);
+		uint32_t control_reg = stoul(tokens[2].substr(tokens[2][0] == '$')) & 0x1f;
+
+		code = 0x11 << 26 | stoul(it->second, nullptr, 2) << 21 | reg_address(tokens[1]) << 16 | control_reg << 11;
+	}
+	else if (tokens[0] == "bc1f" || tokens[0] == "bc1t")
+	{
+
+		/* bc1f/bc1t [cc,] label: the condition code goes in bits 20..18 and true/false in bit 16 */
+		it = COP1_Instructions.find(tokens[0]);
+		bool has_cc = !tokens[2].empty();
+		string target = has_cc ? tokens[2] : tokens[1];
+		uint32_t cc = has_cc ? stoul(tokens[1]) & 7 : 0;
+		int temp = label_address(target, symbols);
+		int offset = (temp == -1) ? stoi(target) : (temp - (0x400000 + ((PC * 4) + 4))) / 4;
+
+		code = 0x11 << 26 | stoul(it->second, nullptr, 2) << 21 | cc << 18 | (tokens[0] == "bc1t") << 16 | (offset & 0xffff);
+	}
+	else if (tokens[0].rfind('.') != string::npos && FP_Instructions.count(tokens[0].substr(0, tokens[0].rfind('.'))) != 0 &&
+			 COP1_Formats.count(tokens[0].substr(tokens[0].rfind('.') + 1)) != 0)
+	{
+
+		/* add.fmt fd, fs, ft, the one-operand operations fd, fs and c.cond.fmt [cc,] fs, ft */
+		it = FP_Instructions.find(tokens[0].substr(0, tokens[0].rfind('.')));
+		string fmt = COP1_Formats[tokens[0].substr(tokens[0].rfind('.') + 1)];
+		uint32_t funct = stoul(it->second, nullptr, 2);
+
+		if (funct >= 0x30)
+		{
+
+			bool has_cc = !tokens[3].empty();
+			uint32_t cc = has_cc ? stoul(tokens[1]) & 7 : 0;
+
+			code = makeFR_type(fmt, tokens[has_cc ? 3 : 2], tokens[has_cc ? 2 : 1], bitset<5>(cc << 2).to_string(), it->second);
+		}
+		else if (funct < 0x04)
+			code = makeFR_type(fmt, tokens[3], tokens[2], tokens[1], it->second);
+		else
+			code = makeFR_type(fmt, "", tokens[2], tokens[1], it->second);
+	}
+	else
+		return false;
+
+	return true;
+}
+
+/* Assembles a single tokenized instruction as a string of 32 '0'/'1' characters.
+   Returns an empty string if the instruction is not supported */
+string encodeInstruction(vector<string> &tokens, int PC, const SymbolTable &symbols)
+{
+	uint32_t code;
+
+	if (!encodeWord(tokens, PC, symbols, code))
+		return "";
+
+	return bitset<32>(code).to_string();
+}
+
+/* Writes each word as 32 ASCII '0'/'1' characters followed by a newline, the text format of
+   writeBitstrings. out must hold 33 bytes per word */
+void formatBitstrings(const uint32_t *words, size_t count, char *out)
+{
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	/* One word per vector: each byte picks the byte of the word that holds its bit, then tests the bit */
+	const __m256i select = _mm256_setr_epi8(3, 3, 3, 3, 3, 3, 3, 3, 2, 2, 2, 2, 2, 2, 2, 2,
+											1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i bits = _mm256_set1_epi64x(0x0102040810204080);
+	const __m256i zeros = _mm256_set1_epi8('0');
+
+	for (; i < count; i++)
+	{
+		__m256i bytes = _mm256_shuffle_epi8(_mm256_set1_epi32(words[i]), select);
+		__m256i set = _mm256_cmpeq_epi8(_mm256_and_si256(bytes, bits), bits);
+
+		_mm256_storeu_si256((__m256i *)(out + i * 33), _mm256_sub_epi8(zeros, set));
+		out[i * 33 + 32] = '\n';
+	}
+#elif defined(__SSE2__)
+	/* Each byte of the word, most significant first, is spread over 8 lanes that test one bit each */
+	const __m128i bits = _mm_set1_epi64x(0x0102040810204080);
+	const __m128i zeros = _mm_set1_epi8('0');
+
+	for (; i < count; i++)
+	{
+		uint32_t word = words[i];
+		uint32_t swapped = (word >> 24) | ((word >> 8) & 0xff00) | ((word << 8) & 0xff0000) | (word << 24);
+		__m128i bytes = _mm_cvtsi32_si128(swapped);
+
+		bytes = _mm_unpacklo_epi8(bytes, bytes);
+		bytes = _mm_unpacklo_epi16(bytes, bytes);
+
+		__m128i high = _mm_unpacklo_epi32(bytes, bytes);
+		__m128i low = _mm_unpackhi_epi32(bytes, bytes);
+
+		high = _mm_cmpeq_epi8(_mm_and_si128(high, bits), bits);
+		low = _mm_cmpeq_epi8(_mm_and_si128(low, bits), bits);
+
+		_mm_storeu_si128((__m128i *)(out + i * 33), _mm_sub_epi8(zeros, high));
+		_mm_storeu_si128((__m128i *)(out + i * 33 + 16), _mm_sub_epi8(zeros, low));
+		out[i * 33 + 32] = '\n';
+	}
+#endif
+
+	/* Scalar fallback, eight characters per byte from a table */
+	static const vector<std::array<char, 8>> table = []()
+	{
+		vector<std::array<char, 8>> result(256);
+
+		for (int byte = 0; byte < 256; byte++)
+		{
+			for (int bit = 0; bit < 8; bit++)
+				result[byte][bit] = (byte & (0x80 >> bit)) ? '1' : '0';
+		}
+
+		return result;
+	}();
+
+	for (; i < count; i++)
+	{
+		for (int byte = 0; byte < 4; byte++)
+			memcpy(out + i * 33 + byte * 8, table[(words[i] >> (24 - byte * 8)) & 0xff].data(), 8);
+
+		out[i * 33 + 32] = '\n';
+	}
+}
+
+/* Writes a whole buffer to a file descriptor */
+bool writeAll(int fd, const char *buffer, size_t length)
+{
+	while (length > 0)
+	{
+		ssize_t written = write(fd, buffer, length);
+
+		if (written < 0 && errno == EINTR)
+			continue;
+
+		if (written <= 0)
+			return false;
+
+		buffer += written;
+		length -= written;
+	}
+
+	return true;
+}
+
+/* The second parsing function that assembles the .text segment into the instructions of the program
+   that firstParse laid out in image, along with the relocations and the diagnostics */
+void secondParse(std::string_view source, Image &image, bool relocatable = false)
+{
+	PhaseTimer timer(COUNT_SECOND_PARSE_NANOSECONDS);
+	int PC = 0;
+	string line;
+	string formatted_line;
+	size_t position = 0;
+	ProgramIR &program = image.program;
+	const SymbolTable &symbols = program.symbols;
+	const SymbolTable *addresses = relocatable ? nullptr : &symbols;
+
+	program.instruction_count = 0;
+	image.relocations.clear();
+	image.unassembled.clear();
+
+	/* Looking for the .text segment */
+	while (readLine(source, position, line))
+	{
+
+		formatted_line = trim(line);
+
+		if (formatted_line == ".text")
+			break;
+	}
+
+	/* Assembling the .text segment */
+	while (readLine(source, position, line))
+	{
+
+		formatted_line = trim(line);
+
+		if (!formatted_line.empty())
+		{
 
 			/* Ignore the labels */
 			if (formatted_line.find(": ") != string::npos)
 			{ //For false-style formatting
 
-				size_t delimiter = formatted_line.find(' ');
-				formatted_line = formatted_line.substr(delimiter + 1);
-			}
-			else if (formatted_line.find(':') != string::npos)
-				continue; //For true-style formatting
+				size_t delimiter = formatted_line.find(' ');
+				formatted_line = formatted_line.substr(delimiter + 1);
+			}
+			else if (formatted_line.find(':') != string::npos)
+				continue; //For true-style formatting
+
+			/* Assembling the instructions, pseudo-instructions are expanded first */
+			for (auto &tokens : expandPseudoInstruction(tokenize(formatted_line), addresses))
+			{
+
+				uint32_t code = 0;
+				bool encoded;
+
+				/* Invalid immediates and unresolved labels make the encoders throw */
+				try
+				{
+					encoded = encodeWord(tokens, PC, symbols, code);
+				}
+				catch (const std::exception &)
+				{
+					encoded = false;
+				}
+
+				if (!encoded)
+				{
+					stringstream diagnostic;
+					diagnostic << "0x" << std::hex << 0x400000 + PC * 4 << ": cannot assemble '" << formatted_line << "'";
+					image.diagnostics.push_back(diagnostic.str());
+					image.unassembled.push_back(PC);
+				}
+
+				/* Unsupported instructions are kept as a nop so that the labels keep their addresses */
+				program.addInstruction(encoded ? code : 0);
+
+				string label;
+
+				if (tokens.size() > 1 && (tokens[0] == "j" || tokens[0] == "jal") && symbols.find(tokens[1]) >= 0)
+					image.relocations.push_back({(uint32_t)PC * 4, R_MIPS_26, tokens[1]});
+				else if (!tokens.empty() && !(label = addressHalf(tokens.back(), "%hi")).empty() && symbols.find(label) >= 0)
+					image.relocations.push_back({(uint32_t)PC * 4, R_MIPS_HI16, label});
+				else if (!tokens.empty() && !(label = addressHalf(tokens.back(), "%lo")).empty() && symbols.find(label) >= 0)
+					image.relocations.push_back({(uint32_t)PC * 4, R_MIPS_LO16, label});
+
+				PC++;
+			}
+		}
+	}
+}
+
+/* Writes the machine code of a program as 32 '0'/'1' characters per instruction and line, leaving out the
+   instructions that could not be assembled. Output goes through a large buffer so that it takes few write() calls */
+bool writeBitstrings(int fd, const Image &image)
+{
+	const size_t chunk = 1 << 15; //Words formatted per write()
+	vector<char> buffer(chunk * 33);
+	const uint32_t *text = image.program.words;
+	size_t count = image.program.instruction_count;
+	const vector<uint32_t> &unassembled = image.unassembled;
+	size_t skipped = 0;
+	size_t i = 0;
+
+	while (i < count)
+	{
+
+		size_t end = std::min(count, i + chunk);
+		size_t length = 0;
+
+		/* Format the runs of words between the instructions that are left out */
+		while (i < end)
+		{
+
+			size_t next = (skipped < unassembled.size()) ? std::min<size_t>(end, unassembled[skipped]) : end;
+
+			formatBitstrings(text + i, next - i, buffer.data() + length);
+			length += (next - i) * 33;
+			i = next;
+
+			if (skipped < unassembled.size() && i == unassembled[skipped])
+			{
+				i++;
+				skipped++;
+			}
+		}
+
+		if (!writeAll(fd, buffer.data(), length))
+			return false;
+	}
+
+	return true;
+}
+
+/* Instructions that write their first operand and read the others, used by the peephole optimizer */
+vector<string> alu_instructions{
+
+	"add", "addu", "and", "nor", "or", "slt", "sltu", "sub", "subu", "xor", "mul", "sllv", "srav", "srlv", "sll", "sra", "srl",
+	"addi", "addiu", "andi", "ori", "xori", "slti", "sltiu", "clo", "clz", "lui", "mfhi", "mflo"
+
+};
+
+/* Loads that write their first operand and read the base register of their second */
+vector<string> load_instructions{
+
+	"lb", "lbu", "lh", "lhu", "lw", "ll"
+
+};
+
+/* Returns true if the instruction writes reg without reading it first */
+bool overwrites(vector<string> &tokens, string reg)
+{
+	bool alu = find(alu_instructions.begin(), alu_instructions.end(), tokens[0]) != alu_instructions.end();
+	bool load = find(load_instructions.begin(), load_instructions.end(), tokens[0]) != load_instructions.end();
+
+	if ((!alu && !load) || tokens.size() < 2 || tokens[1] != reg)
+		return false;
+
+	for (size_t i = 2; i < tokens.size(); i++)
+	{
+
+		string operand = tokens[i];
+
+		if (load)
+		{
+			size_t open_bracket = operand.find('(');
+			size_t close_bracket = operand.find(')');
+
+			if (open_bracket == string::npos || close_bracket == string::npos)
+				return false;
+
+			operand = operand.substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+		}
+
+		/* Operands that are not register names might alias reg */
+		if (operand == reg || (operand[0] == '$' && registers.count(operand) == 0))
+			return false;
+	}
+
+	return true;
+}
+
+/* Returns true if the instruction only copies a register to itself */
+bool isSelfMove(vector<string> &tokens)
+{
+
+	if (tokens.size() != 4 || registers.count(tokens[1]) == 0)
+		return false;
+
+	string &op = tokens[0];
+
+	if (op == "add" || op == "addu" || op == "or" || op == "xor")
+		return (tokens[2] == tokens[1] && tokens[3] == "$zero") || (tokens[2] == "$zero" && tokens[3] == tokens[1]);
+
+	if (op == "addi" || op == "addiu" || op == "ori" || op == "xori")
+		return tokens[2] == tokens[1] && tokens[3] == "0";
+
+	/* sll $zero, $zero, 0 is the canonical nop and is kept */
+	if (op == "sll" || op == "srl" || op == "sra")
+		return tokens[2] == tokens[1] && tokens[3] == "0" && tokens[1] != "$zero";
+
+	return false;
+}
+
+/* Peephole optimizer over the expanded instructions of the .text segment. It removes self moves,
+   lui results that are overwritten before being read and branches to the next instruction, fuses
+   lui $x, 0 + ori $x, $x, imm into a single ori, and rewrites the source with the labels moved
+   to their new positions. Returns the number of instructions eliminated */
+int peephole(string &source)
+{
+	/* A label or an instruction of the .text segment */
+	struct Item
+	{
+		string label;
+		vector<string> tokens;
+		bool removed = false;
+	};
+
+	stringstream is(source);
+	string line;
+	string formatted_line;
+	string result;
+	vector<Item> items;
+	std::set<string> text_labels;
+
+	/* Everything up to the .text segment is kept as it is */
+	while (getline(is, line))
+	{
+
+		result += line + '\n';
+
+		if (trim(line) == ".text")
+			break;
+	}
+
+	while (getline(is, line))
+	{
+
+		formatted_line = trim(line);
+
+		if (formatted_line.empty())
+			continue;
+
+		if (formatted_line.find(':') != string::npos)
+		{
+
+			Item label;
+			label.label = formatted_line.substr(0, formatted_line.find(':'));
+			text_labels.insert(label.label);
+			items.push_back(label);
+
+			if (formatted_line.find(": ") == string::npos)
+				continue;
+
+			formatted_line = formatted_line.substr(formatted_line.find(' ') + 1);
+		}
+
+		for (auto &tokens : expandPseudoInstruction(tokenize(formatted_line)))
+		{
+			Item instruction;
+			instruction.tokens = tokens;
+			items.push_back(instruction);
+		}
+	}
+
+	/* Removing instructions moves the code, so branches and jumps must all go through labels */
+	for (auto &item : items)
+	{
+
+		vector<string> &tokens = item.tokens;
+		size_t operand = 0;
+
+		if (tokens.empty())
+			continue;
+
+		if (tokens[0] == "j" || tokens[0] == "jal")
+			operand = 1;
+		else if (tokens[0] == "beq" || tokens[0] == "bne")
+			operand = 3;
+		else if (tokens[0] == "bgez" || tokens[0] == "bgezal" || tokens[0] == "bgtz" || tokens[0] == "blez" ||
+				 tokens[0] == "bltzal" || tokens[0] == "bltz")
+			operand = 2;
+		else if (tokens[0] == "bc1f" || tokens[0] == "bc1t")
+			operand = tokens.size() - 1;
+
+		if (operand != 0 && (operand >= tokens.size() || text_labels.count(tokens[operand]) == 0))
+			return 0;
+	}
+
+	int eliminated = 0;
+	bool changed = true;
+
+	while (changed)
+	{
+
+		changed = false;
+
+		for (size_t i = 0; i < items.size(); i++)
+		{
+
+			Item &item = items[i];
+
+			if (item.removed || item.tokens.empty())
+				continue;
+
+			/* The next instruction, and the labels in between */
+			size_t next = i + 1;
+			std::set<string> between;
+
+			while (next < items.size() && (items[next].removed || !items[next].label.empty()))
+			{
+				if (!items[next].label.empty())
+					between.insert(items[next].label);
+
+				next++;
+			}
+
+			vector<string> &tokens = item.tokens;
+			string &op = tokens[0];
+			bool has_next = next < items.size() && !items[next].tokens.empty();
+
+			if (isSelfMove(tokens))
+				item.removed = true;
+			else if ((op == "beq" || op == "bne") && tokens.size() == 4 && between.count(tokens[3]) != 0)
+				item.removed = true;
+			else if ((op == "bgez" || op == "bgtz" || op == "blez" || op == "bltz") && tokens.size() == 3 &&
+					 between.count(tokens[2]) != 0)
+				item.removed = true;
+			else if (op == "j" && tokens.size() == 2 && between.count(tokens[1]) != 0)
+				item.removed = true;
+			else if (op == "lui" && tokens.size() == 3 && has_next && registers.count(tokens[1]) != 0)
+			{
+
+				vector<string> &next_tokens = items[next].tokens;
+
+				if (overwrites(next_tokens, tokens[1]))
+					item.removed = true;
+				else if (tokens[2] == "0" && between.empty() && next_tokens.size() == 4 && next_tokens[0] == "ori" &&
+						 next_tokens[1] == tokens[1] && next_tokens[2] == tokens[1])
+				{
+					next_tokens[2] = "$zero";
+					item.removed = true;
+				}
+			}
+
+			if (item.removed)
+			{
+				eliminated++;
+				changed = true;
+			}
+		}
+	}
+
+	for (auto &item : items)
+	{
+
+		if (!item.label.empty())
+			result += item.label + ":\n";
+		else if (!item.removed)
+		{
+
+			string instruction = "\t" + item.tokens[0];
+
+			for (size_t i = 1; i < item.tokens.size(); i++)
+				instruction += (i == 1 ? " " : ", ") + item.tokens[i];
+
+			result += instruction + '\n';
+		}
+	}
+
+	source = result;
+
+	return eliminated;
+}
+
+/* Assembler that keeps the line table of a source resident, so that editing a line of the .text segment
+   only re-encodes that line. The address of a line is not stored but summed from a Fenwick tree over the
+   number of instructions of each line, so an edit that changes that number moves every later label in
+   O(log n). The instructions that refer to a label depend on addresses anywhere in the program and are
+   encoded when the machine code is read, again only when their label or themselves moved since then.
+   Inserting or erasing a line renumbers the lines after it, which is linear but only moves integers */
+class IncrementalAssembler
+{
+
+public:
+	/* Assembles the whole source and builds the tables */
+	void load(string source)
+	{
+		stringstream ss(source);
+		string line;
+
+		this->source.clear();
+		while (getline(ss, line))
+			this->source.push_back(line);
+
+		reload();
+	}
+
+	/* Replaces a line of the source (0-based) and re-assembles what the edit affects.
+	   Returns the number of instructions encoded */
+	int editLine(size_t line_number, string text)
+	{
+		/* Edits outside of the .text segment or to the segment directives need a full reassembly */
+		if (line_number < text_start || line_number >= source.size() || isDirective(text))
+		{
+			if (line_number >= source.size())
+				source.resize(line_number + 1);
+
+			source[line_number] = text;
+			return reload();
+		}
+
+		size_t index = line_number - text_start;
+		Line line = parseLine(text);
+
+		source[line_number] = text;
+		line.id = lines[index].id;
+
+		untrack(lines[index]);
+		track(line);
+		counts.add(index, line.size - lines[index].size);
+
+		if (line.size != lines[index].size)
+		{
+			moved = true;
+			shifted = std::min(shifted, index + 1);
+		}
+
+		lines[index] = line;
+
+		return encode(lines[index]);
+	}
+
+	/* Inserts a line before line_number, or at the end when it is the number of lines.
+	   Returns the number of instructions encoded */
+	int insertLine(size_t line_number, string text)
+	{
+		if (line_number > source.size())
+			line_number = source.size();
+
+		source.insert(source.begin() + line_number, text);
+
+		if (line_number < text_start || isDirective(text))
+			return reload();
+
+		size_t index = line_number - text_start;
+		Line line = parseLine(text);
+
+		line.id = positions.size();
+		positions.push_back(index);
+		track(line);
+
+		lines.insert(lines.begin() + index, line);
+		renumber(index);
+
+		return encode(lines[index]);
+	}
+
+	/* Removes a line of the source */
+	void eraseLine(size_t line_number)
+	{
+		if (line_number >= source.size())
+			return;
+
+		bool directive = isDirective(source[line_number]);
+
+		source.erase(source.begin() + line_number);
+
+		if (line_number < text_start || directive)
+		{
+			reload();
+			return;
+		}
+
+		size_t index = line_number - text_start;
+
+		untrack(lines[index]);
+		positions[lines[index].id] = SIZE_MAX;
+		lines.erase(lines.begin() + index);
+		renumber(index);
+	}
+
+	/* Machine code of the .text segment, in the format of writeBitstrings. The instructions that
+	   could not be assembled are left out, as diagnostics() tells */
+	string machineCode()
+	{
+		resolve();
+
+		string result(counts.before(lines.size()) * 33, '\0');
+		char *out = &result[0];
+
+		for (auto &line : lines)
+		{
+			for (int j = 0; j < line.size; j++)
+			{
+				if (line.encoded[j])
+				{
+					formatBitstrings(&line.words[j], 1, out);
+					out += 33;
+				}
+			}
+		}
+
+		result.resize(out - result.data());
+
+		return result;
+	}
+
+	/* The declarations and instructions that could not be assembled, in the format of the diagnostics of
+	   firstParse and secondParse */
+	vector<string> diagnostics()
+	{
+		resolve();
+
+		vector<string> result = data_diagnostics;
+		int PC = 0;
+
+		for (size_t i = 0; i < lines.size(); i++)
+		{
+			for (int j = 0; j < lines[i].size; j++)
+			{
+				if (lines[i].encoded[j])
+					continue;
+
+				string formatted_line = trim(stripComment(source[text_start + i]));
+				stringstream diagnostic;
+
+				if (formatted_line.find(':') != string::npos)
+					formatted_line = formatted_line.substr(formatted_line.find(' ') + 1);
+
+				diagnostic << "0x" << std::hex << 0x400000 + (PC + j) * 4 << ": cannot assemble '" << formatted_line << "'";
+				result.push_back(diagnostic.str());
+			}
+
+			PC += lines[i].size;
+		}
+
+		return result;
+	}
+
+private:
+	/* A line of the .text segment */
+	struct Line
+	{
+		string label;						 //Label defined on the line
+		vector<vector<string>> instructions; //Tokens of the instructions on the line, pseudo-instructions expanded
+		vector<string> references;			 //Label each instruction refers to, or an empty string
+		int size = 0;						 //Number of instructions on the line
+		bool relocated = false;				 //True if an instruction refers to a label
+		vector<uint32_t> words;				 //Machine code of the instructions
+		vector<bool> encoded;				 //Whether each instruction could be assembled
+		int PC = -1;						 //Index of the first instruction when the ones referring to a label were encoded, -1 if they must be again
+		size_t id = 0;						 //Index of the line in positions, which does not change with edits
+	};
+
+	/* Fenwick tree over the number of instructions of each line */
+	struct Counts
+	{
+		vector<int> tree;
+
+		/* Builds the tree in linear time */
+		void assign(vector<Line> &lines)
+		{
+			tree.assign(lines.size(), 0);
+
+			for (size_t i = 0; i < lines.size(); i++)
+			{
+				tree[i] += lines[i].size;
+
+				size_t parent = i | (i + 1);
+
+				if (parent < tree.size())
+					tree[parent] += tree[i];
+			}
+		}
+
+		void add(size_t index, int delta)
+		{
+			for (; delta != 0 && index < tree.size(); index |= index + 1)
+				tree[index] += delta;
+		}
+
+		/* Number of instructions before the line */
+		int before(size_t index)
+		{
+			int sum = 0;
+
+			for (; index > 0; index &= index - 1)
+				sum += tree[index - 1];
+
+			return sum;
+		}
+	};
+
+	vector<string> source;					   //Lines of the source
+	size_t text_start = 0;					   //Index of the first line after .text
+	vector<Line> lines;						   //Line table of the .text segment
+	Counts counts;							   //Number of instructions of the lines of the line table
+	vector<size_t> positions;				   //Index in the line table of each line id
+	SymbolTable data_symbols;				   //Labels of the .data segment
+	vector<string> data_diagnostics;		   //Declarations of the .data segment that could not be assembled
+	map<string, vector<size_t>> definitions; //Ids of the lines defining each label of the .text segment
+	map<string, vector<size_t>> users;		   //Ids of the lines referring to each label
+	SymbolTable symbols;					   //Addresses the instructions referring to a label were encoded with
+	SymbolTable moved_symbols;			   //Table that moveLabels() builds, reused
+	bool moved = true;						   //Whether a label may have moved since the last read
+	size_t shifted = 0;						   //Index of the first line that may have moved since the last read
+	vector<size_t> stale;					   //Ids of the lines whose instructions referring to a label must be encoded again
+
+	static string stripComment(string line)
+	{
+		return line.substr(0, line.find('#'));
+	}
+
+	static bool isDirective(string text)
+	{
+		string formatted_line = trim(stripComment(text));
+
+		return formatted_line == ".data" || formatted_line == ".text";
+	}
+
+	/* Label an operand of the instruction is, or is the %hi or %lo half of. Empty if there is none */
+	static string referencedLabel(vector<string> &tokens)
+	{
+		int64_t value;
+
+		for (size_t i = 1; i < tokens.size(); i++)
+		{
+			string &operand = tokens[i];
+			string label = addressHalf(operand, "%hi");
+
+			if (label.empty())
+				label = addressHalf(operand, "%lo");
+
+			if (!label.empty())
+				return label;
+
+			if (!operand.empty() && operand[0] != '$' && operand.find('(') == string::npos && !parseNumber(operand, value))
+				return operand;
+		}
+
+		return "";
+	}
+
+	/* Invalid immediates and unresolved labels make the encoders throw, the instruction is then left
+	   out as secondParse does */
+	static bool tryEncode(vector<string> &tokens, int PC, const SymbolTable &symbols, uint32_t &code)
+	{
+		try
+		{
+			return encodeWord(tokens, PC, symbols, code);
+		}
+		catch (const std::exception &)
+		{
+			return false;
+		}
+	}
+
+	/* Splits a line of the .text segment the same way secondParse does */
+	Line parseLine(string text)
+	{
+		Line line;
+		string formatted_line = trim(stripComment(text));
+
+		if (formatted_line.empty())
+			return line;
+
+		size_t delimiter = formatted_line.find(':');
+
+		if (delimiter != string::npos)
+		{
+			line.label = formatted_line.substr(0, delimiter);
+
+			if (formatted_line.find(": ") == string::npos)
+				return line;
+
+			formatted_line = formatted_line.substr(formatted_line.find(' ') + 1);
+		}
+
+		line.instructions = expandPseudoInstruction(tokenize(formatted_line), &data_symbols);
+		line.size = line.instructions.size();
+
+		for (auto &tokens : line.instructions)
+			line.references.push_back(referencedLabel(tokens));
+
+		return line;
+	}
+
+	/* Encodes the instructions of a line that refer to no label. Returns the number encoded */
+	int encode(Line &line)
+	{
+		int count = 0;
+
+		line.words.assign(line.size, 0);
+		line.encoded.assign(line.size, false);
+		line.relocated = false;
+		line.PC = -1;
+
+		for (int i = 0; i < line.size; i++)
+		{
+			if (!line.references[i].empty())
+				line.relocated = true;
+			else
+			{
+				line.encoded[i] = tryEncode(line.instructions[i], 0, data_symbols, line.words[i]);
+				count += line.encoded[i];
+			}
+		}
+
+		if (line.relocated)
+			stale.push_back(line.id);
+
+		return count;
+	}
+
+	/* Registers the label a line defines and the labels it refers to */
+	void track(Line &line)
+	{
+		if (!line.label.empty())
+		{
+			definitions[line.label].push_back(line.id);
+			moved = true;
+		}
+
+		for (auto &label : line.references)
+		{
+			if (!label.empty())
+				users[label].push_back(line.id);
+		}
+	}
+
+	void untrack(Line &line)
+	{
+		if (!line.label.empty())
+		{
+			forget(definitions, line.label, line.id);
+			moved = true;
+		}
+
+		for (auto &label : line.references)
+		{
+			if (!label.empty())
+				forget(users, label, line.id);
+		}
+	}
+
+	static void forget(map<string, vector<size_t>> &table, const string &label, size_t id)
+	{
+		auto it = table.find(label);
+
+		if (it == table.end())
+			return;
+
+		it->second.erase(remove(it->second.begin(), it->second.end(), id), it->second.end());
+
+		if (it->second.empty())
+			table.erase(it);
+	}
+
+	/* Marks the lines referring to a label to be encoded again */
+	void invalidate(const string &label)
+	{
+		auto it = users.find(label);
+
+		if (it == users.end())
+			return;
+
+		for (auto &id : it->second)
+		{
+			lines[positions[id]].PC = -1;
+			stale.push_back(id);
+		}
+	}
+
+	/* Encodes the instructions of a line that refer to a label, the first one being at PC */
+	void relocate(Line &line, int PC)
+	{
+		for (int j = 0; j < line.size; j++)
+		{
+			if (!line.references[j].empty())
+				line.encoded[j] = tryEncode(line.instructions[j], PC + j, symbols, line.words[j]);
+		}
+
+		line.PC = PC;
+	}
+
+	/* Moves the labels whose address changed since the last read, and marks the lines referring to them.
+	   The table is built again: the labels of the .data segment win over all, then the first definition
+	   of each label of the .text segment */
+	void moveLabels()
+	{
+		moved_symbols = data_symbols;
+
+		for (auto &elem : definitions)
+		{
+			size_t first = SIZE_MAX;
+
+			for (auto &id : elem.second)
+				first = std::min(first, positions[id]);
+
+			uint32_t address = 0x400000 + counts.before(first) * 4;
+
+			if (!moved_symbols.add(elem.first, address, SymbolKind::Instruction))
+				continue;
+
+			int32_t symbol = symbols.find(elem.first);
+
+			if (symbol < 0 || symbols.address(symbol) != address)
+				invalidate(elem.first);
+		}
+
+		/* Labels that are no longer defined */
+		for (uint32_t symbol = 0; symbol < symbols.size(); symbol++)
+		{
+			if (moved_symbols.find(symbols.name(symbol)) < 0)
+				invalidate(symbols.name(symbol));
+		}
+
+		std::swap(symbols, moved_symbols);
+		moved = false;
+	}
+
+	/* Encodes again the instructions that refer to a label that moved, or that moved themselves, as
+	   branches are relative to their address. Only the lines after the first one that moved are walked */
+	void resolve()
+	{
+		if (moved)
+			moveLabels();
+
+		shifted = std::min(shifted, lines.size());
+
+		for (auto &id : stale)
+		{
+			size_t index = positions[id];
+
+			if (index < shifted && lines[index].PC == -1)
+				relocate(lines[index], counts.before(index));
+		}
+
+		stale.clear();
+
+		int PC = counts.before(shifted);
+
+		for (size_t i = shifted; i < lines.size(); i++)
+		{
+			if (lines[i].relocated && lines[i].PC != PC)
+				relocate(lines[i], PC);
+
+			PC += lines[i].size;
+		}
+
+		shifted = lines.size();
+	}
+
+	/* Updates the positions of the lines from index on, after an insertion or an erasure */
+	void renumber(size_t index)
+	{
+		for (size_t i = index; i < lines.size(); i++)
+			positions[lines[i].id] = i;
+
+		counts.assign(lines);
+		moved = true;
+		shifted = std::min(shifted, index);
+	}
+
+	/* Rebuilds every table from the source. Returns the number of instructions encoded */
+	int reload()
+	{
+		string no_comments;
+
+		for (auto &line : source)
+			no_comments += stripComment(line) + '\n';
+
+		Image image;
+
+		firstParse(no_comments, image);
+
+		data_symbols.clear();
+		for (uint32_t symbol = 0; symbol < image.program.symbols.size(); symbol++)
+		{
+			const SymbolTable &parsed = image.program.symbols;
+
+			if (parsed.kind(symbol) != SymbolKind::Instruction)
+				data_symbols.add(parsed.name(symbol), parsed.address(symbol), parsed.kind(symbol), parsed.bytes(symbol));
+		}
+
+		data_diagnostics = image.diagnostics;
+
+		lines.clear();
+		positions.clear();
+		definitions.clear();
+		users.clear();
+		symbols = data_symbols;
+		moved = true;
+		shifted = 0;
+		stale.clear();
+
+		text_start = source.size();
+		for (size_t i = 0; i < source.size(); i++)
+		{
+			if (trim(stripComment(source[i])) == ".text")
+			{
+				text_start = i + 1;
+				break;
+			}
+		}
+
+		int count = 0;
+		for (size_t i = text_start; i < source.size(); i++)
+		{
+			Line line = parseLine(source[i]);
+
+			line.id = positions.size();
+			positions.push_back(lines.size());
+			track(line);
+			count += encode(line);
+
+			lines.push_back(line);
+		}
+
+		counts.assign(lines);
+
+		return count;
+	}
+};
+
+/* Writes the assembled program as an ELF32 MIPS file. A relocatable object keeps the j/jal and la fixups
+   in .rel.text, an executable is laid out to be loaded with .text at 0x400000 and .data at 0x10000000 */
+bool writeELF(string filename, const Image &assembled, bool big_endian, bool executable)
+{
+	const uint32_t header_size = 52, program_header_size = 32, section_header_size = 40, page_size = 0x1000;
+
+	const ProgramIR &program = assembled.program;
+	const SymbolTable &symbols = program.symbols;
+	const vector<uint8_t> &data = program.data;
+
+	/* Symbol table, in the order of the program's symbols. Symbol i of the program is entry i + 1 */
+	vector<uint32_t> symbol_names;
+	string strtab(1, '\0');
+
+	for (uint32_t i = 0; i < symbols.size(); i++)
+	{
+		symbol_names.push_back(strtab.size());
+		strtab += symbols.name(i);
+		strtab += '\0';
+	}
+
+	/* Section names */
+	vector<string> section_names{".text", ".data", ".symtab", ".strtab"};
+
+	if (!executable)
+		section_names.push_back(".rel.text");
+
+	section_names.push_back(".shstrtab");
+
+	string shstrtab(1, '\0');
+	vector<uint32_t> section_name_offsets;
+
+	for (auto &name : section_names)
+	{
+		section_name_offsets.push_back(shstrtab.size());
+		shstrtab += name + '\0';
+	}
+
+	/* File layout */
+	auto align = [](uint32_t offset, uint32_t alignment)
+	{ return (offset + alignment - 1) / alignment * alignment; };
+
+	uint32_t program_headers = executable ? (data.empty() ? 1 : 2) : 0;
+	uint32_t text_offset = executable ? page_size : header_size;
+	uint32_t text_size = program.instruction_count * 4;
+	uint32_t data_offset = executable ? align(text_offset + text_size, page_size) : text_offset + text_size;
+	uint32_t symtab_offset = align(data_offset + data.size(), 4);
+	uint32_t symtab_size = (symbols.size() + 1) * 16;
+	uint32_t strtab_offset = symtab_offset + symtab_size;
+	uint32_t rel_offset = align(strtab_offset + strtab.size(), 4);
+	uint32_t rel_size = executable ? 0 : assembled.relocations.size() * 8;
+	uint32_t shstrtab_offset = rel_offset + rel_size;
+	uint32_t section_headers_offset = align(shstrtab_offset + shstrtab.size(), 4);
+	uint32_t sections = section_names.size() + 1;
+
+	vector<uint8_t> image(section_headers_offset + sections * section_header_size, 0);
+
+	auto put16 = [&](uint32_t offset, uint16_t value)
+	{
+		image[offset + (big_endian ? 0 : 1)] = value >> 8;
+		image[offset + (big_endian ? 1 : 0)] = value & 0xff;
+	};
+
+	auto put32 = [&](uint32_t offset, uint32_t value)
+	{
+		put16(offset + (big_endian ? 0 : 2), value >> 16);
+		put16(offset + (big_endian ? 2 : 0), value & 0xffff);
+	};
+
+	/* ELF header */
+	uint32_t entry = 0;
+
+	if (executable)
+	{
+		int32_t main_symbol = symbols.find("main");
+		entry = (main_symbol >= 0) ? symbols.address(main_symbol) : 0x400000;
+	}
+
+	image[0] = 0x7f;
+	image[1] = 'E';
+	image[2] = 'L';
+	image[3] = 'F';
+	image[4] = 1;					 //ELFCLASS32
+	image[5] = big_endian ? 2 : 1; //ELFDATA2MSB or ELFDATA2LSB
+	image[6] = 1;					 //EV_CURRENT
+	image[7] = executable ? 255 : 0; //ELFOSABI_STANDALONE marks executables that run without delay slots
+	put16(16, executable ? 2 : 1); //ET_EXEC or ET_REL
+	put16(18, 8);					 //EM_MIPS
+	put32(20, 1);
+	put32(24, entry);
+	put32(28, executable ? header_size : 0);
+	put32(32, section_headers_offset);
+	put32(36, 0x50001000); //EF_MIPS_ARCH_32 | EF_MIPS_ABI_O32
+	put16(40, header_size);
+	put16(42, executable ? program_header_size : 0);
+	put16(44, program_headers);
+	put16(46, section_header_size);
+	put16(48, sections);
+	put16(50, sections - 1);
+
+	/* Program headers */
+	auto program_header = [&](uint32_t index, uint32_t offset, uint32_t address, uint32_t size, uint32_t flags)
+	{
+		uint32_t at = header_size + index * program_header_size;
+
+		put32(at, 1); //PT_LOAD
+		put32(at + 4, offset);
+		put32(at + 8, address);
+		put32(at + 12, address);
+		put32(at + 16, size);
+		put32(at + 20, size);
+		put32(at + 24, flags);
+		put32(at + 28, page_size);
+	};
+
+	if (executable)
+	{
+		program_header(0, text_offset, 0x400000, text_size, 5); //PF_R | PF_X
+
+		if (!data.empty())
+			program_header(1, data_offset, 0x10000000, data.size(), 6); //PF_R | PF_W
+	}
+
+	/* .text, the fields that get relocated hold no addend in a relocatable object */
+	vector<uint32_t> text(program.words, program.words + program.instruction_count);
+
+	if (!executable)
+	{
+		for (auto &relocation : assembled.relocations)
+			text[relocation.offset / 4] &= (relocation.type == R_MIPS_26) ? 0xfc000000 : 0xffff0000;
+	}
+
+	for (size_t i = 0; i < text.size(); i++)
+		put32(text_offset + i * 4, text[i]);
+
+	/* .data */
+	copy(data.begin(), data.end(), image.begin() + data_offset);
+
+	/* .symtab */
+	for (size_t i = 0; i < symbols.size(); i++)
+	{
+
+		uint32_t at = symtab_offset + (i + 1) * 16;
+		bool is_text = symbols.kind(i) == SymbolKind::Instruction;
+		uint32_t base = is_text ? 0x400000 : 0x10000000;
+
+		put32(at, symbol_names[i]);
+		put32(at + 4, symbols.address(i) - (executable ? 0 : base));
+		put32(at + 8, is_text ? 0 : symbols.bytes(i));
+		image[at + 12] = is_text ? 0 : 1; //STB_LOCAL with STT_NOTYPE or STT_OBJECT
+		put16(at + 14, is_text ? 1 : 2);
+	}
+
+	/* .strtab and .shstrtab */
+	copy(strtab.begin(), strtab.end(), image.begin() + strtab_offset);
+	copy(shstrtab.begin(), shstrtab.end(), image.begin() + shstrtab_offset);
+
+	/* .rel.text */
+	for (size_t i = 0; i < rel_size / 8; i++)
+	{
+
+		const Relocation &relocation = assembled.relocations[i];
+
+		put32(rel_offset + i * 8, relocation.offset);
+		put32(rel_offset + i * 8 + 4, ((symbols.find(relocation.symbol) + 1) << 8) | relocation.type);
+	}
+
+	/* Section headers */
+	auto section_header = [&](uint32_t index, uint32_t type, uint32_t flags, uint32_t address, uint32_t offset,
+							  uint32_t size, uint32_t link, uint32_t info, uint32_t alignment, uint32_t entry_size)
+	{
+		uint32_t at = section_headers_offset + index * section_header_size;
+
+		put32(at, section_name_offsets[index - 1]);
+		put32(at + 4, type);
+		put32(at + 8, flags);
+		put32(at + 12, address);
+		put32(at + 16, offset);
+		put32(at + 20, size);
+		put32(at + 24, link);
+		put32(at + 28, info);
+		put32(at + 32, alignment);
+		put32(at + 36, entry_size);
+	};
+
+	section_header(1, 1, 6, executable ? 0x400000 : 0, text_offset, text_size, 0, 0, 4, 0);			   //SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR
+	section_header(2, 1, 3, executable ? 0x10000000 : 0, data_offset, data.size(), 0, 0, 4, 0);		   //SHT_PROGBITS, SHF_WRITE | SHF_ALLOC
+	section_header(3, 2, 0, 0, symtab_offset, symtab_size, 4, symbols.size() + 1, 4, 16);			   //SHT_SYMTAB, all symbols are local
+	section_header(4, 3, 0, 0, strtab_offset, strtab.size(), 0, 0, 1, 0);								   //SHT_STRTAB
+
+	if (!executable)
+		section_header(5, 9, 0x40, 0, rel_offset, rel_size, 3, 1, 4, 8); //SHT_REL, SHF_INFO_LINK
+
+	section_header(sections - 1, 3, 0, 0, shstrtab_offset, shstrtab.size(), 0, 0, 1, 0); //SHT_STRTAB
+
+	/* The whole file is written at once */
+	std::ofstream outfile(filename, std::ios::binary);
+
+	if (!outfile.is_open())
+		return false;
+
+	outfile.write((const char *)image.data(), image.size());
+
+	return outfile.good();
+}
+
+/* Assembler for programs held in memory. It can be reused for any number of programs: the source
+   without comments and the image are cleared and refilled by each call, keeping their memory. A
+   relocatable program keeps the full la expansion, for the linker to fix up */
+class Assembler
+{
+
+public:
+	Assembler(bool big_endian = true, bool relocatable = false)
+	{
+		this->big_endian = big_endian;
+		this->relocatable = relocatable;
+	}
+
+	/* Assembles a program. The image stays valid until the next call */
+	const Image &assemble(std::string_view source)
+	{
+		removeComments(source, no_comments);
+		firstParse(no_comments, image, big_endian, relocatable);
+		secondParse(no_comments, image, relocatable);
+
+		return image;
+	}
+
+private:
+	bool big_endian;
+	bool relocatable;
+	string no_comments;
+	Image image;
+};
+
+/* Table-driven disassembler. The tables are built once from R_Instructions, I_Instructions,
+   J_Instructions, REGIMM_Instructions, COP0_Instructions, COP1_Instructions and FP_Instructions and
+   indexed by the opcode, then by the funct, rt or rs field. Floating-point operations take a third
+   level, by their funct field */
+class Disassembler
+{
+
+public:
+	/* Longest line disassemble() writes for one instruction, including the newline */
+	size_t maxLine()
+	{
+		return 40 + longest_symbol;
+	}
+
+	Disassembler()
+	{
+		vector<string> special2{"clo", "clz", "mul", "madd", "maddu", "msub", "msubu"};
+
+		for (auto &elem : R_Instructions)
+		{
+			bool is_special2 = find(special2.begin(), special2.end(), elem.first) != special2.end();
+			setEntry((is_special2 ? special2_table : special_table)[stoi(elem.second, nullptr, 2)], elem.first);
+		}
+
+		for (auto &elem : I_Instructions)
+		{
+			auto it = REGIMM_Instructions.find(elem.first);
+
+			if (it != REGIMM_Instructions.end())
+				setEntry(regimm_table[stoi(it->second, nullptr, 2)], elem.first);
+			else
+				setEntry(primary_table[stoi(elem.second, nullptr, 2)], elem.first);
+		}
+
+		for (auto &elem : J_Instructions)
+			setEntry(primary_table[stoi(elem.second, nullptr, 2)], elem.first);
+
+		for (auto &elem : COP0_Instructions)
+			setEntry(cop0_table[stoi(elem.second, nullptr, 2)], elem.first);
+
+		/* bc1f and bc1t share their rs field, the branch format names them by the tf bit */
+		for (auto &elem : COP1_Instructions)
+			setEntry(cop1_table[stoi(elem.second, nullptr, 2)], elem.first);
+
+		for (auto &elem : COP1_Formats)
+			cop1_table[stoi(elem.second, nullptr, 2)].format = Format::Float;
+
+		/* The floating-point names overlap the integer ones, so their formats come from the function code */
+		for (auto &elem : FP_Instructions)
+		{
+			int funct = stoi(elem.second, nullptr, 2);
+
+			setName(float_table[funct].name, elem.first);
+			float_table[funct].format = (funct < 0x04) ? Format::FdFsFt : (funct >= 0x30) ? Format::CcFsFt : Format::FdFs;
+		}
+
+		for (auto &elem : registers)
+			setName(register_names[elem.second], elem.first);
+
+		for (auto &elem : fp_registers)
+			setName(fp_register_names[elem.second], elem.first);
+
+		/* The second level is selected by a shift and a mask, so that the lookup has no branches */
+		for (int opcode = 0; opcode < 64; opcode++)
+			levels[opcode] = {&primary_table[opcode], 0, 0};
+
+		levels[0] = {special_table, 0, 0x3f};
+		levels[0x1c] = {special2_table, 0, 0x3f};
+		levels[1] = {regimm_table, 16, 0x1f};
+		levels[0x10] = {cop0_table, 21, 0x1f};
+		levels[0x11] = {cop1_table, 21, 0x1f};
+	}
+
+	/* Uses the text labels of a program to name branch and jump targets */
+	void setSymbols(const ProgramIR &program)
+	{
+		symbol_slots.clear();
+		symbol_pool.clear();
+		symbol_base = 0x400000;
+		longest_symbol = 0;
+
+		for (uint32_t i = 0; i < program.symbols.size(); i++)
+		{
+			uint32_t address = program.symbols.address(i);
+
+			if (program.symbols.kind(i) != SymbolKind::Instruction || address < symbol_base || address % 4 != 0)
+				continue;
+
+			size_t index = (address - symbol_base) / 4;
+
+			if (index >= symbol_slots.size())
+				symbol_slots.resize(index + 1, 0);
+
+			if (symbol_slots[index] == 0)
+			{
+				string name = program.symbols.name(i);
+
+				symbol_slots[index] = symbol_pool.size() + 1;
+				symbol_pool += (char)std::min<size_t>(name.size(), 255);
+				symbol_pool += name.substr(0, 255);
+				longest_symbol = std::max<size_t>(longest_symbol, std::min<size_t>(name.size(), 255));
+			}
+		}
+	}
+
+	/* Disassembles count words located from address into out, one instruction per line.
+	   out must have room for count * maxLine() bytes. Returns the number of bytes written */
+	size_t disassemble(const uint32_t *words, size_t count, uint32_t address, char *out)
+	{
+		char *start = out;
+
+		for (size_t i = 0; i < count; i++, address += 4)
+		{
+			uint32_t word = words[i];
+			uint32_t opcode = word >> 26;
+			uint32_t rs = (word >> 21) & 0x1f;
+			uint32_t rt = (word >> 16) & 0x1f;
+			uint32_t rd = (word >> 11) & 0x1f;
+			int32_t immediate = (int16_t)(word & 0xffff);
+			const Level &level = levels[opcode];
+			const Entry *entry = &level.table[(word >> level.shift) & level.mask];
+			uint32_t fd = (word >> 6) & 0x1f;
+
+			/* Words only convert to singles and doubles */
+			if (entry->format == Format::Float)
+				entry = (rs != 0x14 || (word & 0x3e) == 0x20) ? &float_table[word & 0x3f] : &invalid_entry;
+
+			if (word == 0)
+			{
+				out = append(out, "nop", 3);
+				*out++ = '\n';
+				continue;
+			}
+
+			if (entry->name.length == 0)
+			{
+				out = append(out, ".word 0x", 8);
+				out = appendHex(out, word);
+				*out++ = '\n';
+				continue;
+			}
+
+			out = append(out, entry->name);
+
+			/* The fmt field of a floating-point operation is the suffix of its mnemonic */
+			if (opcode == 0x11 && rs >= 0x10)
+			{
+				*out++ = '.';
+				*out++ = rs == 0x10 ? 's' : rs == 0x11 ? 'd' : 'w';
+			}
+
+			*out = ' ';
+			out += entry->format != Format::None;
+
+			switch (entry->format)
+			{
+			case Format::None:
+				break;
+			case Format::RdRsRt:
+				out = appendRegisters(out, rd, rs, rt);
+				break;
+			case Format::RdRtRs:
+				out = appendRegisters(out, rd, rt, rs);
+				break;
+			case Format::RdRtShamt:
+				out = appendRegisters(out, rd, rt);
+				out = appendInt(append(out, ", ", 2), (word >> 6) & 0x1f);
+				break;
+			case Format::RsRt:
+				out = appendRegisters(out, rs, rt);
+				break;
+			case Format::RdRs:
+				out = appendRegisters(out, rd, rs);
+				break;
+			case Format::Rs:
+				out = appendRegister(out, rs);
+				break;
+			case Format::Rd:
+				out = appendRegister(out, rd);
+				break;
+			case Format::RtRsImmediate:
+				out = appendRegisters(out, rt, rs);
+				out = appendInt(append(out, ", ", 2), immediate);
+				break;
+			case Format::RtRsUnsigned:
+				out = appendRegisters(out, rt, rs);
+				out = appendInt(append(out, ", ", 2), word & 0xffff);
+				break;
+			case Format::RtUnsigned:
+				out = appendRegister(out, rt);
+				out = appendInt(append(out, ", ", 2), word & 0xffff);
+				break;
+			case Format::RtOffsetRs:
+				out = appendRegister(out, rt);
+				out = appendInt(append(out, ", ", 2), immediate);
+				*out++ = '(';
+				out = appendRegister(out, rs);
+				*out++ = ')';
+				break;
+			case Format::RsImmediate:
+				out = appendRegister(out, rs);
+				out = appendInt(append(out, ", ", 2), immediate);
+				break;
+			case Format::RsRtBranch:
+				out = appendRegisters(out, rs, rt);
+				out = appendTarget(append(out, ", ", 2), address + 4 + immediate * 4);
+				break;
+			case Format::RsBranch:
+				out = appendRegister(out, rs);
+				out = appendTarget(append(out, ", ", 2), address + 4 + immediate * 4);
+				break;
+			case Format::Jump:
+				out = appendTarget(out, ((address + 4) & 0xf0000000) | ((word & 0x3ffffff) << 2));
+				break;
+			case Format::RtCp0:
+				out = appendRegister(out, rt);
+				out = appendInt(append(out, ", $", 3), rd);
+
+				if ((word & 7) != 0)
+					out = appendInt(append(out, ", ", 2), word & 7);
+				break;
+			case Format::RtFs:
+				out = appendRegister(out, rt);
+				out = append(append(out, ", ", 2), fp_register_names[rd]);
+				break;
+			case Format::RtFcr:
+				out = appendRegister(out, rt);
+				out = appendInt(append(out, ", $", 3), rd);
+				break;
+			case Format::FtOffsetRs:
+				out = append(out, fp_register_names[rt]);
+				out = appendInt(append(out, ", ", 2), immediate);
+				*out++ = '(';
+				out = appendRegister(out, rs);
+				*out++ = ')';
+				break;
+			case Format::FdFsFt:
+				out = append(out, fp_register_names[fd]);
+				out = append(append(out, ", ", 2), fp_register_names[rd]);
+				out = append(append(out, ", ", 2), fp_register_names[rt]);
+				break;
+			case Format::FdFs:
+				out = append(out, fp_register_names[fd]);
+				out = append(append(out, ", ", 2), fp_register_names[rd]);
+				break;
+			case Format::CcFsFt:
+				if ((fd >> 2) != 0)
+					out = append(appendInt(out, fd >> 2), ", ", 2);
+
+				out = append(out, fp_register_names[rd]);
+				out = append(append(out, ", ", 2), fp_register_names[rt]);
+				break;
+			case Format::Cop1Branch:
+				out[-2] = ((word >> 16) & 1) ? 't' : 'f';
+
+				if (((word >> 18) & 7) != 0)
+					out = append(appendInt(out, (word >> 18) & 7), ", ", 2);
+
+				out = appendTarget(out, address + 4 + immediate * 4);
+				break;
+			case Format::Float:
+				break;
+			}
+
+			*out++ = '\n';
+		}
+
+		return out - start;
+	}
+
+private:
+	/* How the operands of an instruction are printed */
+	enum class Format : uint8_t
+	{
+		None,
+		RdRsRt,
+		RdRtRs,
+		RdRtShamt,
+		RsRt,
+		RdRs,
+		Rs,
+		Rd,
+		RtRsImmediate,
+		RtRsUnsigned,
+		RtUnsigned,
+		RtOffsetRs,
+		RsImmediate,
+		RsRtBranch,
+		RsBranch,
+		Jump,
+		RtCp0,
+		RtFs,
+		RtFcr,
+		FtOffsetRs,
+		FdFsFt,
+		FdFs,
+		CcFsFt,
+		Cop1Branch,
+		Float //Selects the third level of the floating-point operations
+	};
+
+	/* A mnemonic or register name, padded so that it can be copied with one fixed-size store */
+	struct Name
+	{
+		char text[8] = {};
+		uint8_t length = 0;
+	};
+
+	struct Entry
+	{
+		Name name;
+		Format format = Format::None;
+	};
+
+	/* First level of the lookup, indexed by the opcode */
+	struct Level
+	{
+		const Entry *table;
+		uint8_t shift;
+		uint8_t mask;
+	};
+
+	Level levels[64];
+	Entry primary_table[64];
+	Entry special_table[64];
+	Entry special2_table[64];
+	Entry regimm_table[32];
+	Entry cop0_table[32];
+	Entry cop1_table[32];
+	Entry float_table[64];
+	Entry invalid_entry;
+	Name register_names[32];
+	Name fp_register_names[32];
+	vector<uint32_t> symbol_slots; //For each text address from symbol_base, 1 + offset of its label in symbol_pool, or 0
+	string symbol_pool;			   //Labels, each preceded by its length
+	uint32_t symbol_base = 0x400000;
+	size_t longest_symbol = 0;
+
+	static void setName(Name &name, string text)
+	{
+		name.length = std::min(text.size(), sizeof(name.text));
+		memcpy(name.text, text.data(), name.length);
+	}
+
+	static void setEntry(Entry &entry, string name)
+	{
+		setName(entry.name, name);
+
+		if (name == "add" || name == "addu" || name == "and" || name == "nor" || name == "or" || name == "slt" ||
+			name == "sltu" || name == "sub" || name == "subu" || name == "xor" || name == "mul")
+			entry.format = Format::RdRsRt;
+		else if (name == "sllv" || name == "srav" || name == "srlv")
+			entry.format = Format::RdRtRs;
+		else if (name == "sll" || name == "sra" || name == "srl")
+			entry.format = Format::RdRtShamt;
+		else if (name == "div" || name == "divu" || name == "mult" || name == "multu" || name == "madd" ||
+				 name == "maddu" || name == "msub" || name == "msubu" || name == "teq" || name == "tne" ||
+				 name == "tge" || name == "tgeu" || name == "tlt" || name == "tltu")
+			entry.format = Format::RsRt;
+		else if (name == "jalr" || name == "clo" || name == "clz")
+			entry.format = Format::RdRs;
+		else if (name == "jr" || name == "mthi" || name == "mtlo")
+			entry.format = Format::Rs;
+		else if (name == "mfhi" || name == "mflo")
+			entry.format = Format::Rd;
+		else if (name == "andi" || name == "ori" || name == "xori")
+			entry.format = Format::RtRsUnsigned;
+		else if (name == "addi" || name == "addiu" || name == "slti" || name == "sltiu")
+			entry.format = Format::RtRsImmediate;
+		else if (name == "lui")
+			entry.format = Format::RtUnsigned;
+		else if (name == "beq" || name == "bne")
+			entry.format = Format::RsRtBranch;
+		else if (name == "bgez" || name == "bgezal" || name == "bgtz" || name == "blez" || name == "bltz" ||
+				 name == "bltzal")
+			entry.format = Format::RsBranch;
+		else if (name == "tgei" || name == "tgeiu" || name == "tlti" || name == "tltiu" || name == "teqi" ||
+				 name == "tnei")
+			entry.format = Format::RsImmediate;
+		else if (name == "j" || name == "jal")
+			entry.format = Format::Jump;
+		else if (name == "mfc0" || name == "mtc0")
+			entry.format = Format::RtCp0;
+		else if (name == "mfc1" || name == "mtc1")
+			entry.format = Format::RtFs;
+		else if (name == "cfc1" || name == "ctc1")
+			entry.format = Format::RtFcr;
+		else if (name == "bc1f" || name == "bc1t")
+			entry.format = Format::Cop1Branch;
+		else if (name == "lwc1" || name == "swc1" || name == "ldc1" || name == "sdc1")
+			entry.format = Format::FtOffsetRs;
+		else if (name != "syscall" && name != "eret")
+			entry.format = Format::RtOffsetRs;
+	}
+
+	static char *append(char *out, const char *text, size_t length)
+	{
+		memcpy(out, text, length);
+		return out + length;
+	}
+
+	/* Copies a whole padded name at once, the bytes past its length are overwritten afterwards */
+	static char *append(char *out, const Name &name)
+	{
+		memcpy(out, name.text, sizeof(name.text));
+		return out + name.length;
+	}
+
+	char *appendRegister(char *out, uint32_t reg)
+	{
+		return append(out, register_names[reg]);
+	}
+
+	char *appendRegisters(char *out, uint32_t first, uint32_t second)
+	{
+		out = appendRegister(out, first);
+		*out++ = ',';
+		*out++ = ' ';
+		return appendRegister(out, second);
+	}
+
+	char *appendRegisters(char *out, uint32_t first, uint32_t second, uint32_t third)
+	{
+		out = appendRegisters(out, first, second);
+		*out++ = ',';
+		*out++ = ' ';
+		return appendRegister(out, third);
+	}
+
+	/* Decimal immediate of at most 5 digits, written without branches since the number of digits
+	   is unpredictable. The digits are always computed and the copy is a fixed 5-byte store: the
+	   bytes past the number are overwritten by what follows it, and maxLine() leaves room for them */
+	static char *appendInt(char *out, int32_t value)
+	{
+		char digits[10] = {};
+		uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+		int count = 1 + (magnitude >= 10) + (magnitude >= 100) + (magnitude >= 1000) + (magnitude >= 10000);
+
+		*out = '-';
+		out += value < 0;
+
+		digits[0] = '0' + magnitude / 10000;
+		digits[1] = '0' + magnitude / 1000 % 10;
+		digits[2] = '0' + magnitude / 100 % 10;
+		digits[3] = '0' + magnitude / 10 % 10;
+		digits[4] = '0' + magnitude % 10;
+
+		memcpy(out, digits + 5 - count, 5);
+		return out + count;
+	}
+
+	static char *appendHex(char *out, uint32_t value)
+	{
+		for (int shift = 28; shift >= 0; shift -= 4)
+			*out++ = "0123456789abcdef"[(value >> shift) & 0xf];
+
+		return out;
+	}
+
+	/* Label of a target address, or the address itself */
+	char *appendTarget(char *out, uint32_t target)
+	{
+		size_t index = (target - symbol_base) / 4;
+
+		if (target >= symbol_base && target % 4 == 0 && index < symbol_slots.size() && symbol_slots[index] != 0)
+		{
+			const char *name = symbol_pool.data() + symbol_slots[index] - 1;
+			return append(out, name + 1, (uint8_t)name[0]);
+		}
+
+		*out++ = '0';
+		*out++ = 'x';
+		return appendHex(out, target);
+	}
+};
+
+/* Main assembling function. The machine code is printed, or written as an ELF32 file if elf_filename is given.
+   If optimize is set, the peephole optimizer runs before the labels are assigned */
+int assemble(string filename, string elf_filename = "", bool big_endian = true, bool executable = false,
+			 bool optimize = false)
+{
+	ifstream infile;
+	infile.open(filename);
+	if (infile.is_open())
+	{
+		string no_comments = removeComments(infile).str();
+
+		if (optimize)
+		{
+
+			int eliminated = peephole(no_comments);
+			std::cerr << "Peephole optimizer eliminated " << eliminated << " instructions" << endl;
+		}
+
+		bool relocatable = !elf_filename.empty() && !executable;
+		Image image;
+
+		firstParse(no_comments, image, big_endian, relocatable);
+		secondParse(no_comments, image, relocatable);
+
+		for (auto &diagnostic : image.diagnostics)
+			std::cerr << filename << ": " << diagnostic << endl;
+
+		if (!elf_filename.empty())
+		{
+
+			if (!writeELF(elf_filename, image, big_endian, executable))
+				return 1;
+		}
+		else
+		{
+
+			cout.flush();
+
+			if (!writeBitstrings(STDOUT_FILENO, image))
+				return 1;
+		}
+	}
+
+	infile.close();
+	return 0;
+}
+
+/* A range of guest memory backed by host memory */
+struct MemoryRegion
+{
+	uint32_t address; //Guest address of the first byte
+	uint32_t size;
+	uint8_t *host;	  //Host address of the first byte
+	size_t length;	  //Length of the host mapping
+};
+
+/* Guest memory of the simulator, made of the regions the loader maps */
+class GuestMemory
+{
+
+public:
+	bool big_endian = true;
+
+	GuestMemory() = default;
+	GuestMemory(const GuestMemory &) = delete;
+	GuestMemory &operator=(const GuestMemory &) = delete;
+
+	~GuestMemory()
+	{
+		for (auto &elem : regions)
+			munmap(elem.second.host, elem.second.length);
+	}
+
+	/* Maps zeroed memory at a page-aligned guest address. Returns its host address or nullptr */
+	uint8_t *allocate(uint32_t address, uint32_t size)
+	{
+		void *host = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (host == MAP_FAILED)
+			return nullptr;
+
+		if (!attach(address, size, (uint8_t *)host, size))
+		{
+			munmap(host, size);
+			return nullptr;
+		}
+
+		return (uint8_t *)host;
+	}
+
+	/* Adds a host mapping to the guest memory, which then owns it. Fails if it overlaps another region */
+	bool attach(uint32_t address, uint32_t size, uint8_t *host, size_t length)
+	{
+		auto next = regions.lower_bound(address);
+
+		if (next != regions.end() && next->first < (uint64_t)address + size)
+			return false;
+
+		if (next != regions.begin() && std::prev(next)->first + (uint64_t)std::prev(next)->second.size > address)
+			return false;
+
+		regions[address] = {address, size, host, length};
+		return true;
+	}
+
+	/* Region holding a guest address, or nullptr if it is not mapped */
+	MemoryRegion *find(uint32_t address)
+	{
+		auto it = regions.upper_bound(address);
+
+		if (it == regions.begin())
+			return nullptr;
+
+		--it;
+
+		if (address - it->second.address >= it->second.size)
+			return nullptr;
+
+		return &it->second;
+	}
+
+	/* Host address of a guest address, or nullptr if it is not mapped */
+	uint8_t *translate(uint32_t address)
+	{
+		if (last == nullptr || address - last->address >= last->size)
+		{
+			MemoryRegion *region = find(address);
+
+			if (region == nullptr)
+				return nullptr;
+
+			last = region;
+		}
+
+		return last->host + (address - last->address);
+	}
+
+	/* Lowest page-aligned guest address from address on where size bytes are unmapped, or 0 if there is none */
+	uint32_t freeAbove(uint32_t address, uint32_t size)
+	{
+		uint64_t page_size = sysconf(_SC_PAGESIZE);
+		uint64_t start = (address + page_size - 1) / page_size * page_size;
+
+		for (auto &elem : regions)
+		{
+			uint64_t end = (uint64_t)elem.second.address + elem.second.size;
+
+			if (end > start && elem.second.address < start + size)
+				start = (end + page_size - 1) / page_size * page_size;
+		}
+
+		return (start + size <= 0x100000000) ? start : 0;
+	}
+
+	/* The regions, by guest address */
+	const map<uint32_t, MemoryRegion> &mapped() const
+	{
+		return regions;
+	}
+
+	size_t mappedBytes()
+	{
+		size_t total = 0;
+
+		for (auto &elem : regions)
+			total += elem.second.size;
+
+		return total;
+	}
+
+private:
+	map<uint32_t, MemoryRegion> regions;
+	MemoryRegion *last = nullptr; //Region of the last translation
+};
+
+/* Architectural state of a processor of the simulator */
+struct Processor
+{
+	uint32_t regs[32] = {};
+	uint32_t pc = 0;
+	uint32_t hi = 0;
+	uint32_t lo = 0;
+
+	/* Coprocessor 0 registers of the exception model */
+	uint32_t status = 0;
+	uint32_t cause = 0;
+	uint32_t epc = 0;
+	uint32_t badvaddr = 0;
+	uint32_t ebase = 0x80000000; //Exceptions go to ebase + 0x180
+
+	/* Coprocessor 1 registers. Singles take one register and doubles an even/odd pair, the odd one
+	   holding the high word, as with Status.FR = 0 */
+	uint32_t fpr[32] = {};
+	uint32_t fcsr = 0; //Condition codes in bits 23 and 25..31, rounding mode in bits 1..0
+
+	uint32_t user_local = 0; //UserLocal, the thread pointer that rdhwr $29 reads and set_thread_area sets
+};
+
+/* FIR, the read-only implementation register of coprocessor 1: singles, doubles and words */
+const uint32_t FIR = 1 << 16 | 1 << 17 | 1 << 20;
+
+/* Size of the stack of the simulated programs, shared out among their harts */
+const uint32_t stack_size = 8 << 20;
+
+/* Maps the stack and sets up the registers of a program that starts at entry */
+bool setupProcessor(GuestMemory &memory, Processor &cpu, uint32_t entry, uint32_t gp)
+{
+	/* Stack below 0x7ffff000, the usual MIPS layout */
+	if (memory.allocate(0x7ffff000 - stack_size, stack_size) == nullptr)
+		return false;
+
+	cpu = Processor();
+	cpu.pc = entry;
+	cpu.regs[registers["$sp"]] = 0x7fffeffc;
+	cpu.regs[registers["$gp"]] = gp;
+
+	return true;
+}
+
+/* Writes the initial stack of a Linux process below the top of the stack and points $sp at it: argc,
+   argv with the program name, an empty environment and the auxiliary vector that the C library of a
+   static executable reads. Returns false if the stack is not mapped */
+bool setupLinuxStack(GuestMemory &memory, Processor &cpu, string name, uint32_t entry, uint32_t phdr, uint32_t phent, uint32_t phnum)
+{
+	uint32_t top = 0x7ffff000;
+	uint32_t random = top - 16; //AT_RANDOM bytes, constant so that runs can be compared
+	uint32_t path = (random - name.size() - 1) & ~15u;
+	uint32_t words[] = {1, path, 0, 0,
+						3, phdr, 4, phent, 5, phnum, 6, 4096, 9, entry, 25, random, 0, 0};
+	uint32_t sp = (path - sizeof(words)) & ~15u;
+	uint8_t *host = memory.translate(sp);
+
+	if (host == nullptr || memory.translate(top - 1) == nullptr)
+		return false;
+
+	for (uint32_t i = 0; i < 16; i++)
+		*memory.translate(random + i) = i * 37 + 11;
+
+	for (size_t i = 0; i <= name.size(); i++)
+		*memory.translate(path + i) = name.c_str()[i];
+
+	for (uint32_t i = 0; i < sizeof(words) / 4; i++)
+	{
+		uint32_t value = words[i];
+
+		for (int byte = 0; byte < 4; byte++)
+			*memory.translate(sp + i * 4 + byte) = value >> (memory.big_endian ? 24 - byte * 8 : byte * 8);
+	}
+
+	cpu.regs[registers["$sp"]] = sp;
+	return true;
+}
+
+/* Loads an ELF32 MIPS executable into guest memory and sets up the processor to run it.
+   PT_LOAD segments whose file offset and address agree modulo the host page size are mapped
+   from the file directly (copy-on-write), the others are copied. Executables of this assembler
+   carry the standalone OSABI (255); other ones come from a MIPS toolchain, which *toolchain
+   reports, and start with the stack of a Linux process. Returns false on failure */
+bool loadELF(string filename, GuestMemory &memory, Processor &cpu, bool *toolchain = nullptr)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+
+	if (fstat(fd, &info) != 0 || info.st_size < 52)
+	{
+		close(fd);
+		return false;
+	}
+
+	size_t file_size = info.st_size;
+	uint8_t *file = (uint8_t *)mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if (file == MAP_FAILED)
+	{
+		close(fd);
+		return false;
+	}
+
+	bool big_endian = file[5] == 2;
+
+	auto get16 = [&](size_t offset) -> uint32_t
+	{
+		return big_endian ? (file[offset] << 8) | file[offset + 1] : (file[offset + 1] << 8) | file[offset];
+	};
+
+	auto get32 = [&](size_t offset) -> uint32_t
+	{
+		return big_endian ? (get16(offset) << 16) | get16(offset + 2) : (get16(offset + 2) << 16) | get16(offset);
+	};
+
+	bool valid = memcmp(file, "\x7f"
+							  "ELF",
+						4) == 0 &&
+				 file[4] == 1 && get16(16) == 2 && get16(18) == 8;
+
+	bool ours = file[7] == 255;
+	uint32_t page_size = sysconf(_SC_PAGESIZE);
+	uint32_t entry = get32(24);
+	uint32_t program_headers = get32(28);
+	uint32_t program_header_count = get16(44);
+	uint32_t program_header_size = get16(42);
+
+	if (!valid || (uint64_t)program_headers + program_header_count * program_header_size > file_size)
+		valid = false;
+
+	memory.big_endian = big_endian;
+
+	uint32_t phdr = 0; //Guest address of the program headers, for the auxiliary vector
+
+	for (uint32_t i = 0; valid && i < program_header_count; i++)
+	{
+		size_t at = program_headers + i * program_header_size;
+
+		if (get32(at) == 6) //PT_PHDR
+			phdr = get32(at + 8);
+
+		if (get32(at) != 1) //PT_LOAD
+			continue;
+
+		uint32_t offset = get32(at + 4);
+		uint32_t address = get32(at + 8);
+		uint32_t file_bytes = get32(at + 16);
+		uint32_t memory_bytes = get32(at + 20);
+
+		if (phdr == 0 && program_headers >= offset && program_headers - offset < file_bytes)
+			phdr = address + (program_headers - offset);
+
+		if ((uint64_t)offset + file_bytes > file_size || file_bytes > memory_bytes)
+		{
+			valid = false;
+			break;
+		}
+
+		uint32_t base = address / page_size * page_size;
+		uint32_t size = (address + memory_bytes - base + page_size - 1) / page_size * page_size;
+		uint8_t *host = memory.allocate(base, size);
+
+		if (host == nullptr)
+		{
+			valid = false;
+			break;
+		}
+
+		uint8_t *segment = host + (address - base);
+
+		if (address % page_size == offset % page_size && file_bytes != 0)
+		{
+			/* Map the file pages over the zeroed region, then clear what follows the segment in its last page */
+			uint32_t file_base = offset / page_size * page_size;
+			size_t length = offset + file_bytes - file_base;
+
+			if (mmap(host, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, file_base) == MAP_FAILED)
+			{
+				valid = false;
+				break;
+			}
+
+			memset(host + length, 0, (length + page_size - 1) / page_size * page_size - length);
+		}
+		else
+			memcpy(segment, file + offset, file_bytes);
+	}
+
+	/* $gp comes from the _gp symbol of the .symtab when there is one */
+	uint32_t gp = 0x10008000;
+	uint32_t section_headers = get32(32);
+	uint32_t section_count = get16(48);
+
+	if (valid && (uint64_t)section_headers + section_count * 40 <= file_size)
+	{
+		for (uint32_t i = 0; i < section_count; i++)
+		{
+			size_t at = section_headers + i * 40;
+
+			if (get32(at + 4) != 2) //SHT_SYMTAB
+				continue;
+
+			uint32_t symbols = get32(at + 16);
+			uint32_t symbols_size = get32(at + 20);
+			size_t strtab_header = section_headers + get32(at + 24) * 40;
+
+			if (get32(at + 24) >= section_count || (uint64_t)symbols + symbols_size > file_size)
+				break;
+
+			uint32_t strtab = get32(strtab_header + 16);
+			uint32_t strtab_size = get32(strtab_header + 20);
+
+			if ((uint64_t)strtab + strtab_size > file_size)
+				break;
+
+			for (uint32_t symbol = symbols; symbol + 16 <= symbols + symbols_size; symbol += 16)
+			{
+				uint32_t name = get32(symbol);
+
+				if (name + 4 <= strtab_size && memcmp(file + strtab + name, "_gp", 4) == 0)
+					gp = get32(symbol + 4);
+			}
+		}
+	}
+
+	munmap(file, file_size);
+	close(fd);
+
+	if (!valid || !setupProcessor(memory, cpu, entry, gp))
+		return false;
+
+	if (toolchain != nullptr)
+		*toolchain = !ours;
+
+	return ours || setupLinuxStack(memory, cpu, filename, entry, phdr, program_header_size, program_header_count);
+}
+
+/* Loads a program from its IR into guest memory, with .text at 0x400000 and .data at 0x10000000.
+   The program starts at main if it has one */
+bool loadIR(const ProgramIR &program, GuestMemory &memory, Processor &cpu)
+{
+	uint32_t page_size = sysconf(_SC_PAGESIZE);
+	uint32_t text_size = (program.instruction_count * 4 + page_size - 1) / page_size * page_size;
+	uint32_t data_size = (program.data.size() + page_size - 1) / page_size * page_size;
+	uint8_t *text = memory.allocate(0x400000, std::max(text_size, page_size));
+	uint8_t *data = memory.allocate(0x10000000, std::max(data_size, page_size));
+
+	if (text == nullptr || data == nullptr)
+		return false;
+
+	for (uint32_t i = 0; i < program.instruction_count; i++)
+	{
+		uint32_t word = program.words[i];
+
+		for (int byte = 0; byte < 4; byte++)
+			text[i * 4 + byte] = word >> (memory.big_endian ? (3 - byte) * 8 : byte * 8);
+	}
+
+	memcpy(data, program.data.data(), program.data.size());
+
+	int32_t main_symbol = program.symbols.find("main");
+	uint32_t entry = (main_symbol != -1) ? program.symbols.address(main_symbol) : 0x400000;
+
+	return setupProcessor(memory, cpu, entry, 0x10008000);
+}
+
+/* Loads an ELF32 MIPS executable into the simulator and reports how long loading took */
+int loadProgram(string filename)
+{
+	GuestMemory memory;
+	Processor cpu;
+
+	auto start = std::chrono::steady_clock::now();
+	bool loaded = loadELF(filename, memory, cpu);
+	auto end = std::chrono::steady_clock::now();
+
+	if (!loaded)
+	{
+		std::cerr << filename << ": not a loadable ELF32 MIPS executable" << endl;
+		return 1;
+	}
+
+	cout << filename << ": " << memory.mappedBytes() << " bytes mapped in "
+		 << std::chrono::duration<double, std::milli>(end - start).count() << " ms, entry 0x" << std::hex
+		 << cpu.pc << std::dec << endl;
+
+	return 0;
+}
+
+/* Exception codes of the MIPS32 Cause register */
+enum ExceptionCause : uint8_t
+{
+	EXC_ADDRESS_LOAD = 4,  //AdEL: unaligned or unmapped load or instruction fetch
+	EXC_ADDRESS_STORE = 5, //AdES: unaligned or unmapped store
+	EXC_SYSCALL = 8,
+	EXC_BREAKPOINT = 9,
+	EXC_RESERVED_INSTRUCTION = 10,
+	EXC_OVERFLOW = 12,
+	EXC_TRAP = 13
+};
+
+const uint32_t STATUS_EXL = 1 << 1; //Exception level bit of the Status register, set while handling one
+const uint32_t CAUSE_BD = 1u << 31;	//Branch delay bit of the Cause register: EPC is the branch before the faulting instruction
+
+string exceptionName(ExceptionCause cause)
+{
+	switch (cause)
+	{
+	case EXC_ADDRESS_LOAD:
+		return "address error on load";
+	case EXC_ADDRESS_STORE:
+		return "address error on store";
+	case EXC_SYSCALL:
+		return "unknown syscall";
+	case EXC_BREAKPOINT:
+		return "breakpoint";
+	case EXC_RESERVED_INSTRUCTION:
+		return "reserved instruction";
+	case EXC_OVERFLOW:
+		return "arithmetic overflow";
+	case EXC_TRAP:
+		return "trap";
+	}
+
+	return "exception " + to_string(cause);
+}
+
+inline uint8_t byteSwap(uint8_t value) { return value; }
+inline uint16_t byteSwap(uint16_t value) { return __builtin_bswap16(value); }
+inline uint32_t byteSwap(uint32_t value) { return __builtin_bswap32(value); }
+inline uint64_t byteSwap(uint64_t value) { return __builtin_bswap64(value); }
+
+class Simulator;
+struct Hart;
+
+/* A data watchpoint of the debugger. Types are those of the Z packets of GDB: 2 for writes,
+   3 for reads and 4 for both */
+struct Watchpoint
+{
+	uint32_t address;
+	uint32_t length;
+	int type;
+};
+
+/* An instruction decoded once for the interpreter: the handler that executes it and its operands.
+   Handlers advance the pc themselves and leave it alone when they raise an exception */
+struct Decoded
+{
+	void (*handler)(Hart &hart, const Decoded &op);
+	uint8_t rs, rt, rd, shamt;
+	uint32_t imm; //Extended immediate, or the target of a branch or jump
+};
+
+/* Counts the instructions executed in each basic block, for the basic block vectors of SimPoint. The
+   interpreter reports the instructions the hart has retired at each change of flow, so the straight-line
+   code between two costs nothing, and the counters of recent blocks are cached in front of the map */
+struct BlockProfiler
+{
+	std::unordered_map<uint32_t, uint64_t> counts; //Instructions by address of the block
+	uint32_t block = 0;							   //Address of the current block
+	uint64_t start = 0;							   //Instructions the hart had retired when it entered it
+
+	/* Ends the current block at a branch or jump to next_pc */
+	void branch(uint32_t next_pc, uint64_t retired)
+	{
+		*counter(block) += retired - start;
+		block = next_pc;
+		start = retired;
+	}
+
+	/* Ends an interval, counting the block it stopped in */
+	void flush(uint64_t retired)
+	{
+		if (retired != start)
+			*counter(block) += retired - start;
+
+		start = retired;
+	}
+
+	/* Starts the counts of a new interval */
+	void clear()
+	{
+		counts.clear();
+		memset(recent, 0, sizeof(recent));
+	}
+
+private:
+	struct Recent
+	{
+		uint32_t block;
+		uint64_t *count; //Element of counts, whose nodes stay in place
+	};
+
+	Recent recent[1024] = {};
+
+	uint64_t *counter(uint32_t address)
+	{
+		Recent &entry = recent[(address >> 2) % 1024];
+
+		if (entry.count == nullptr || entry.block != address)
+			entry = {address, &counts[address]};
+
+		return entry.count;
+	}
+};
+
+/* Predecoded instructions of a region of guest memory */
+struct CodeRegion
+{
+	uint32_t base;
+	uint8_t *host; //Host address of the instruction words
+	vector<Decoded> code;
+	vector<uint8_t> classes; //InstructionClass of each word, for the counters
+	vector<uint32_t> words;	 //Words as they were decoded, in host order
+	vector<uint8_t> stale;	 //Whether each page was written since it was decoded
+};
+
+/* A guest hardware thread. The harts of a simulator share its guest memory and predecoded code,
+   and each one runs on its own host thread */
+struct Hart
+{
+	Processor cpu;
+	Simulator *machine = nullptr;
+	int id = 0;
+	bool running = true;
+	bool swap = false;				//Guest and host byte orders differ
+	uint64_t retired = 0;			//Instructions executed
+	uint32_t reserved_address = 1;	//Address reserved by ll, odd when there is no reservation
+	uint32_t reserved_value = 0;	//Word read by ll, in host memory order
+	MemoryRegion window = {};		//Memory the hart accessed last, which it may access directly
+	bool debugged = false;			//Exceptions go to the debugger instead of ending the program
+	int stop_signal = 0;			//Signal of the last stop for the debugger, 0 for none
+	uint32_t watch_address = 0;		//Address of the access that hit a watchpoint
+	int watch_type = 0;				//Type of the watchpoint hit, as in the Z packets of GDB
+	bool paused = false;			//A write to a protected page stopped the loop after its instruction
+	bool in_delay_slot = false;		//Running the instruction in the delay slot of a branch
+
+	/* Instruction in progress that wrote to a page with a write watchpoint: the host page and the state
+	   of the page and of the hart before the write */
+	uint8_t *watch_page = nullptr;
+	vector<uint8_t> watch_backup;
+	Processor watch_cpu;
+	uint64_t watch_retired = 0;
+	uint32_t watch_reserved_address = 1;
+	uint32_t watch_reserved_value = 0;
+
+	void execute(uint64_t until = UINT64_MAX, BlockProfiler *profiler = nullptr);
+	template <bool counted, bool profiled>
+	void run(uint64_t until, BlockProfiler *profiler);
+	void step(const Decoded *op = nullptr);
+	bool resume();
+
+	template <typename Observer>
+	void observe(uint64_t until, Observer &observer);
+	void raise(ExceptionCause cause, uint32_t address = 0);
+	void delaySlot(uint32_t target);
+	uint8_t *access(uint32_t address, uint32_t size, bool store);
+	uint8_t *remap(uint32_t address, uint32_t size, bool store);
+
+	/* Reads a value of guest memory. On failure the exception is raised and false returned */
+	template <typename T>
+	bool load(uint32_t address, T &value)
+	{
+		uint8_t *host = access(address, sizeof(T), false);
+
+		if (host == nullptr)
+			return false;
+
+		memcpy(&value, host, sizeof(T));
+
+		if (swap)
+			value = byteSwap(value);
+
+		return true;
+	}
+
+	/* Writes a value to guest memory. On failure the exception is raised and false returned */
+	template <typename T>
+	bool store(uint32_t address, T value)
+	{
+		uint8_t *host = access(address, sizeof(T), true);
+
+		if (host == nullptr)
+			return false;
+
+		if (swap)
+			value = byteSwap(value);
+
+		memcpy(host, &value, sizeof(T));
+		return true;
+	}
+};
+
+/* Runs a program on one or more harts sharing one guest memory. The regions of the memory are all
+   mapped before the harts start, so that they can translate addresses without locking */
+class Simulator
+{
+
+public:
+	GuestMemory memory;
+	Processor initial;				 //State of the processor when the program starts
+	vector<CodeRegion> code_regions; //The region holding the entry point, and the one of the exception vector if it is mapped
+	std::atomic<bool> stopped{false};
+	std::atomic<int> exit_code{0};
+	std::atomic<uint32_t> heap_break{0}; //Top of the heap that sbrk grows
+	uint32_t heap_start = 0;
+	uint32_t heap_end = 0;
+	std::mutex io;		  //Serializes the console syscalls of the harts
+	bool console = true; //Whether the console syscalls print anything
+	int hart_count = 1;	  //Harts that run the program
+	bool toolchain = false; //Running an executable of a MIPS toolchain: branches have delay slots, syscalls are those of Linux
+	SymbolTable symbols;	  //Labels of an assembled program, for the debugger
+
+	/* Writes to the code, which the page guard records */
+	std::atomic<bool> code_written{false};
+	std::atomic<bool> shared_code_written{false}; //By a program running on several harts
+
+	/* Debugger state, only changed while the harts are stopped */
+	map<uint32_t, Decoded> breakpoints; //Predecoded entries that breakpoints replaced, by address
+	vector<Watchpoint> watchpoints;
+	std::set<uint32_t> watched_pages;	//Guest pages that hold read or access watchpoints
+	std::set<uint32_t> protected_pages; //Guest pages that hold write watchpoints, write-protected
+
+	uint64_t retired = 0; //Instructions executed by the last run
+	double seconds = 0;	  //Duration of the last run
+
+	Simulator() = default;
+	Simulator(const Simulator &) = delete;
+	Simulator &operator=(const Simulator &) = delete;
+	~Simulator();
+
+	/* Loads an ELF32 executable, or assembles a source file. Returns false on failure */
+	bool load(string filename);
+
+	/* Assembles a program and loads it. Returns false on failure */
+	bool loadSource(std::string_view source, string name = "");
+
+	/* Runs the program on hart_count harts and returns its exit code. Hart i starts at the entry point
+	   with $a0 = i, $a1 = hart_count and its own slice of the stack */
+	int run(int hart_count);
+
+	void setupHart(Hart &hart, int id, int hart_count);
+	void syscall(Hart &hart);
+	void linuxSyscall(Hart &hart);
+
+	CodeRegion *codeRegion(uint32_t address);
+	Decoded *entry(uint32_t address);
+	bool predecode(uint32_t address);
+
+	bool insertBreakpoint(uint32_t address);
+	bool removeBreakpoint(uint32_t address);
+	void insertWatchpoint(uint32_t address, uint32_t length, int type);
+	bool removeWatchpoint(uint32_t address, uint32_t length, int type);
+	bool watchHit(Hart &hart, uint32_t address, uint32_t size, bool store);
+	void updateWatchedPages();
+	bool finishWatchedWrite(Hart &hart);
+	void redecode(uint32_t address);
+
+	void protectPages();
+	void pageFault(uint32_t address, Hart *hart);
+	void refreshCode();
+	bool writeMemory(uint32_t address, const uint8_t *data, uint32_t length);
+
+private:
+	bool prepare();
+	void protect(uint32_t page, int protection);
+	void refreshPage(CodeRegion &region, uint32_t page);
+};
+
+/* Write protection of the guest pages that hold predecoded code or write watchpoints, so that the
+   stores of the interpreter stay plain host stores. A store to such a page faults into a SIGSEGV
+   handler, which only records the write and lifts the protection of the page; the hart that wrote
+   stops after the instruction, where its code is decoded again and a watched write checked. The
+   handler takes no lock: simulators register in fixed slots, and a slot is only emptied once no
+   handler reads it. It only reads state of the simulator that changes while the harts are stopped */
+class PageGuard
+{
+
+public:
+	static const size_t capacity = 256;
+	static thread_local Hart *hart; //Hart that the thread is running, if any
+	static uint32_t page_size;
+
+	/* Registers a simulator. Returns false when all the slots are taken */
+	static bool add(Simulator *simulator)
+	{
+		static std::once_flag installed;
+
+		std::call_once(installed, []()
+					   {
+			struct sigaction action = {};
+
+			page_size = sysconf(_SC_PAGESIZE);
+			action.sa_sigaction = handler;
+			action.sa_flags = SA_SIGINFO;
+			sigemptyset(&action.sa_mask);
+			sigaction(SIGSEGV, &action, &previous); });
+
+		for (auto &slot : slots)
+		{
+			Simulator *empty = nullptr;
+
+			if (slot.simulator.compare_exchange_strong(empty, simulator))
+				return true;
+		}
+
+		return false;
+	}
+
+	static void remove(Simulator *simulator)
+	{
+		for (auto &slot : slots)
+		{
+			if (slot.simulator.load() != simulator)
+				continue;
+
+			slot.simulator.store(nullptr);
+
+			while (slot.readers.load() != 0)
+				std::this_thread::yield();
+		}
+	}
+
+	/* Handles a fault at a host address. Returns false if it is not in the guest memory of a simulator */
+	static bool handle(uint8_t *address)
+	{
+		for (auto &slot : slots)
+		{
+			slot.readers.fetch_add(1);
+
+			Simulator *simulator = slot.simulator.load();
+			bool found = false;
+
+			if (simulator != nullptr)
+			{
+				for (auto &elem : simulator->memory.mapped())
+				{
+					const MemoryRegion &region = elem.second;
+
+					if ((uintptr_t)address - (uintptr_t)region.host < region.size)
+					{
+						simulator->pageFault(region.address + (address - region.host), hart);
+						found = true;
+						break;
+					}
+				}
+			}
+
+			slot.readers.fetch_sub(1);
+
+			if (found)
+				return true;
+		}
+
+		return false;
+	}
+
+	/* Protects again the pages of the simulator that owns a guest memory, after another user of
+	   mprotect, the dirty page tracker, unprotected them */
+	static void restore(GuestMemory &memory)
+	{
+		for (auto &slot : slots)
+		{
+			Simulator *simulator = slot.simulator.load();
+
+			if (simulator != nullptr && &simulator->memory == &memory)
+				simulator->protectPages();
+		}
+	}
+
+private:
+	struct Slot
+	{
+		std::atomic<Simulator *> simulator{nullptr};
+		std::atomic<int> readers{0}; //Handlers reading the slot
+	};
+
+	static Slot slots[capacity];
+	static struct sigaction previous; //Handler to fall back on for faults outside the guest memory
+
+	static void handler(int signal, siginfo_t *info, void *context)
+	{
+		if (handle((uint8_t *)info->si_addr))
+			return;
+
+		/* A genuine fault: the access is retried under the previous handler, usually the default one */
+		sigaction(SIGSEGV, &previous, nullptr);
+	}
+};
+
+thread_local Hart *PageGuard::hart = nullptr;
+uint32_t PageGuard::page_size = 4096;
+PageGuard::Slot PageGuard::slots[PageGuard::capacity];
+struct sigaction PageGuard::previous;
+
+/* Host address of size bytes of guest memory, or nullptr after raising an address error. Accesses
+   inside the window of the hart take no lookup. Windows are page-aligned, so one compare checks both
+   the range and the alignment: a misaligned offset rotates into the top bits */
+inline uint8_t *Hart::access(uint32_t address, uint32_t size, bool store)
+{
+	uint32_t offset = address - window.address;
+	uint32_t shift = __builtin_ctz(size);
+	uint32_t index = (shift == 0) ? offset : (offset >> shift) | (offset << ((32 - shift) & 31));
+
+	if (index >= (window.size >> shift))
+		return remap(address, size, store);
+
+	return window.host + offset;
+}
+
+/* Slow path of access: looks up the region of the address and makes it the window of the hart.
+   While there are watchpoints, the window leaves out the pages that hold them, so that accesses to
+   those pages keep coming here to be checked */
+uint8_t *Hart::remap(uint32_t address, uint32_t size, bool store)
+{
+	MemoryRegion *found = machine->memory.find(address);
+
+	if (found == nullptr || address - found->address > found->size - size || (address & (size - 1)) != 0)
+	{
+		raise(store ? EXC_ADDRESS_STORE : EXC_ADDRESS_LOAD, address);
+		return nullptr;
+	}
+
+	uint8_t *host = found->host + (address - found->address);
+	std::set<uint32_t> &watched = machine->watched_pages;
+
+	metrics.slot()->add(COUNT_TLB_MISSES);
+	window = *found;
+
+	if (watched.empty())
+		return host;
+
+	if (machine->watchHit(*this, address, size, store))
+		return nullptr;
+
+	uint32_t page_size = sysconf(_SC_PAGESIZE);
+	uint32_t page = address / page_size * page_size;
+	uint64_t start = found->address;
+	uint64_t end = start + found->size;
+	auto next = watched.upper_bound(page);
+
+	if (watched.count(page) != 0)
+	{
+		window = MemoryRegion();
+		return host;
+	}
+
+	if (next != watched.end())
+		end = std::min<uint64_t>(end, *next);
+
+	if (next != watched.begin())
+		start = std::max<uint64_t>(start, *std::prev(next) + (uint64_t)page_size);
+
+	window.address = start;
+	window.size = end - start;
+	window.host = found->host + (start - found->address);
+	return host;
+}
+
+/* Exceptions are precise, as the instruction that raises one changes nothing. The exception is recorded
+   in coprocessor 0 and the hart goes on at ebase + 0x180 when the program has code there. Otherwise it
+   stops, and under the debugger the exception is reported as a signal */
+void Hart::raise(ExceptionCause cause, uint32_t address)
+{
+	uint32_t vector = (cpu.ebase & 0xfffff000) + 0x180;
+	CounterSlot *slot = metrics.slot();
+
+	slot->add(COUNT_EXCEPTIONS);
+
+	if (cause == EXC_TRAP)
+		slot->add(COUNT_TRAPS);
+
+	if (machine->entry(vector) != nullptr)
+	{
+
+		/* An exception in a handler keeps the EPC of the first one, as EXL is still set */
+		if ((cpu.status & STATUS_EXL) == 0)
+			cpu.epc = cpu.pc;
+
+		if (cause == EXC_ADDRESS_LOAD || cause == EXC_ADDRESS_STORE)
+			cpu.badvaddr = address;
+
+		cpu.cause = (cpu.cause & ~(CAUSE_BD | 0x7cu)) | (cause << 2);
+		cpu.status |= STATUS_EXL;
+		cpu.pc = vector;
+		reserved_address = 1;
+		return;
+	}
+
+	running = false;
+
+	if (debugged)
+	{
+		if (cause == EXC_ADDRESS_LOAD || cause == EXC_ADDRESS_STORE)
+			stop_signal = 11; //SIGSEGV
+		else if (cause == EXC_RESERVED_INSTRUCTION)
+			stop_signal = 4; //SIGILL
+		else if (cause == EXC_OVERFLOW)
+			stop_signal = 8; //SIGFPE
+		else
+			stop_signal = 5; //SIGTRAP
+
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(machine->io);
+
+	std::cerr << "hart " << id << ": " << exceptionName(cause) << " at 0x" << std::hex << cpu.pc;
+
+	if (cause == EXC_ADDRESS_LOAD || cause == EXC_ADDRESS_STORE)
+		std::cerr << " (address 0x" << address << ")";
+
+	std::cerr << std::dec << endl;
+
+	machine->exit_code = 1;
+}
+
+/* Runs the instruction in the delay slot of the branch or jump at the pc, then goes to target, for the
+   executables of a MIPS toolchain. An exception in the slot leaves EPC at the branch and sets Cause.BD,
+   so that eret runs both again */
+void Hart::delaySlot(uint32_t target)
+{
+	uint32_t branch = cpu.pc;
+	uint32_t status = cpu.status;
+	const Decoded *op = machine->entry(branch + 4);
+
+	cpu.pc = branch + 4;
+
+	/* The slot runs with its branch, so a breakpoint there does not stop it */
+	if (!machine->breakpoints.empty() && machine->breakpoints.count(cpu.pc) != 0)
+		op = &machine->breakpoints[cpu.pc];
+
+	/* A branch or a jump in a delay slot is unpredictable on MIPS32 */
+	if (in_delay_slot)
+		return raise(EXC_RESERVED_INSTRUCTION);
+
+	if (op == nullptr)
+		raise(EXC_ADDRESS_LOAD, cpu.pc);
+	else
+	{
+		if (metrics.enabled.load(std::memory_order_relaxed))
+		{
+			CodeRegion *region = machine->codeRegion(cpu.pc);
+
+			metrics.slot()->count((InstructionClass)region->classes[(cpu.pc - region->base) / 4]);
+		}
+
+		in_delay_slot = true;
+		op->handler(*this, *op);
+		in_delay_slot = false;
+		cpu.regs[0] = 0;
+		retired++;
+	}
+
+	if ((status & STATUS_EXL) == 0 && (cpu.status & STATUS_EXL) != 0)
+	{
+		cpu.epc = branch;
+		cpu.cause |= CAUSE_BD;
+	}
+	else if (cpu.pc == branch + 8)
+		cpu.pc = target;
+}
+
+/* The rounding mode of the FCSR lives in the host FPU of the thread that runs the hart, so that each
+   floating-point instruction is a single host operation. The default mode, to nearest, needs no
+   switching: ctc1 and the start of a run switch only when the program picks another mode */
+inline void setHostRounding(uint32_t fcsr)
+{
+	static const int modes[4] = {FE_TONEAREST, FE_TOWARDZERO, FE_UPWARD, FE_DOWNWARD};
+
+	fesetround(modes[fcsr & 3]);
+}
+
+/* Interpreter loop of a hart. It runs until the hart exits or stops on an exception, until it has
+   executed until instructions in all, or until another hart stops the program, which is checked every
+   few thousand instructions. The loops that count the instructions by class or by basic block are
+   separate instances, so that the one of the usual runs is unchanged */
+template <bool counted, bool profiled>
+void Hart::run(uint64_t until, BlockProfiler *profiler)
+{
+	const Decoded *code = nullptr;
+	const uint8_t *classes = nullptr;
+	uint32_t base = 0;
+	uint32_t count = 0;
+	CounterSlot *slot = counted ? metrics.slot() : nullptr;
+
+	while (running && retired < until && !machine->stopped.load(std::memory_order_relaxed))
+	{
+		uint64_t chunk = std::min<uint64_t>(4096, until - retired);
+
+		for (uint64_t n = 0; n < chunk && running; n++)
+		{
+			/* As for data, one compare checks the range and the alignment of the pc */
+			uint32_t offset = cpu.pc - base;
+			uint32_t index = (offset >> 2) | (offset << 30);
+
+			if (index >= count)
+			{
+				CodeRegion *region = machine->codeRegion(cpu.pc);
+
+				if (region == nullptr || (cpu.pc & 3) != 0)
+				{
+					raise(EXC_ADDRESS_LOAD, cpu.pc);
+					continue;
+				}
+
+				code = region->code.data();
+				classes = region->classes.data();
+				base = region->base;
+				count = region->code.size();
+				index = (cpu.pc - base) >> 2;
+			}
+
+			const Decoded &op = code[index];
+
+			if (counted)
+				slot->count((InstructionClass)classes[index]);
+
+			uint32_t pc = cpu.pc;
+
+			op.handler(*this, op);
+			cpu.regs[0] = 0;
+			retired++;
+
+			if (profiled && cpu.pc != pc + 4)
+				profiler->branch(cpu.pc, retired);
+		}
+	}
+}
+
+/* Runs the hart until it has executed until instructions in all, with the basic blocks counted in
+   profiler if it is given */
+void Hart::execute(uint64_t until, BlockProfiler *profiler)
+{
+	if ((cpu.fcsr & 3) != 0)
+		setHostRounding(cpu.fcsr);
+
+	PageGuard::hart = this;
+	machine->refreshCode();
+
+	do
+	{
+
+		bool counted = metrics.enabled.load(std::memory_order_relaxed);
+
+		if (profiler != nullptr)
+			counted ? run<true, true>(until, profiler) : run<false, true>(until, profiler);
+		else
+			counted ? run<true, false>(until, nullptr) : run<false, false>(until, nullptr);
+	} while (resume());
+
+	PageGuard::hart = nullptr;
+
+	if ((cpu.fcsr & 3) != 0)
+		setHostRounding(0);
+}
+
+/* After a loop of the interpreter: a write to a protected page stopped it after the instruction, at a
+   point where the code written can be decoded again and a watched write checked. Returns whether the
+   hart goes on */
+bool Hart::resume()
+{
+	if (!paused)
+		return false;
+
+	paused = false;
+	machine->refreshCode();
+
+	if (watch_page != nullptr && !machine->finishWatchedWrite(*this))
+		return false;
+
+	running = true;
+	return true;
+}
+
+/* Executes one instruction, for the debugger: the one at the pc, or op in its place */
+void Hart::step(const Decoded *op)
+{
+	machine->refreshCode();
+
+	if (op == nullptr && (cpu.pc & 3) == 0)
+		op = machine->entry(cpu.pc);
+
+	if (op == nullptr)
+	{
+		raise(EXC_ADDRESS_LOAD, cpu.pc);
+		return;
+	}
+
+	if (metrics.enabled.load(std::memory_order_relaxed))
+	{
+		CodeRegion *region = machine->codeRegion(cpu.pc);
+
+		metrics.slot()->count((InstructionClass)region->classes[(cpu.pc - region->base) / 4]);
+	}
+
+	setHostRounding(cpu.fcsr);
+	PageGuard::hart = this;
+	op->handler(*this, *op);
+	cpu.regs[0] = 0;
+	retired++;
+	PageGuard::hart = nullptr;
+	setHostRounding(0);
+	resume();
+}
+
+/* Runs like execute(), one instruction at a time, and reports each one to an observer with its word,
+   its pc, the pc after it and the address it accesses if it is a load or a store */
+template <typename Observer>
+void Hart::observe(uint64_t until, Observer &observer)
+{
+	CounterSlot *slot = metrics.enabled.load(std::memory_order_relaxed) ? metrics.slot() : nullptr;
+
+	setHostRounding(cpu.fcsr);
+	PageGuard::hart = this;
+	machine->refreshCode();
+
+	do
+	{
+
+		while (running && retired < until && !machine->stopped.load(std::memory_order_relaxed))
+		{
+			uint32_t pc = cpu.pc;
+			CodeRegion *region = ((pc & 3) == 0) ? machine->codeRegion(pc) : nullptr;
+
+			if (region == nullptr)
+			{
+				raise(EXC_ADDRESS_LOAD, pc);
+				continue;
+			}
+
+			uint32_t index = (pc - region->base) / 4;
+			const Decoded &op = region->code[index];
+			uint32_t address = cpu.regs[op.rs] + op.imm;
+			uint32_t word;
+
+			memcpy(&word, region->host + index * 4, 4);
+
+			if (swap)
+				word = byteSwap(word);
+
+			if (slot != nullptr)
+				slot->count((InstructionClass)region->classes[index]);
+
+			op.handler(*this, op);
+			cpu.regs[0] = 0;
+			retired++;
+			observer.retire(word, pc, cpu.pc, address);
+		}
+	} while (resume());
+
+	PageGuard::hart = nullptr;
+	setHostRounding(0);
+}
+
+/* Coprocessor 0 register of mfc0/mtc0, or nullptr for the ones that are not modelled */
+uint32_t *cp0Register(Processor &cpu, uint32_t reg, uint32_t select)
+{
+	if (reg == 8 && select == 0)
+		return &cpu.badvaddr;
+	else if (reg == 12 && select == 0)
+		return &cpu.status;
+	else if (reg == 13 && select == 0)
+		return &cpu.cause;
+	else if (reg == 14 && select == 0)
+		return &cpu.epc;
+	else if (reg == 15 && select == 1)
+		return &cpu.ebase;
+
+	return nullptr;
+}
+
+/* Byte of a word that lwl/lwr/swl/swr start at, counted from the most significant one */
+inline uint32_t unalignedShift(Hart &hart, uint32_t address)
+{
+	uint32_t byte = address & 3;
+
+	return 8 * (hart.machine->memory.big_endian ? byte : 3 - byte);
+}
+
+/* Floating-point values of the coprocessor 1 registers, by format */
+template <typename T>
+T readFloat(const Processor &cpu, uint32_t reg);
+
+template <>
+inline float readFloat<float>(const Processor &cpu, uint32_t reg)
+{
+	float value;
+
+	memcpy(&value, &cpu.fpr[reg], 4);
+	return value;
+}
+
+template <>
+inline double readFloat<double>(const Processor &cpu, uint32_t reg)
+{
+	uint64_t bits = (uint64_t)cpu.fpr[reg | 1] << 32 | cpu.fpr[reg & ~1u];
+	double value;
+
+	memcpy(&value, &bits, 8);
+	return value;
+}
+
+inline void writeFloat(Processor &cpu, uint32_t reg, float value)
+{
+	memcpy(&cpu.fpr[reg], &value, 4);
+}
+
+inline void writeFloat(Processor &cpu, uint32_t reg, double value)
+{
+	uint64_t bits;
+
+	memcpy(&bits, &value, 8);
+	cpu.fpr[reg & ~1u] = bits;
+	cpu.fpr[reg | 1] = bits >> 32;
+}
+
+/* Conversion of an integral value to a word. NaNs and values out of range give 2^31 - 1, the result
+   of MIPS when the invalid operation exception is disabled */
+inline uint32_t floatToWord(double value)
+{
+	if (!(value >= -2147483648.0 && value < 2147483648.0))
+		return 0x7fffffff;
+
+	return (int32_t)value;
+}
+
+/* Bit of a condition code in the FCSR */
+inline uint32_t conditionBit(uint32_t cc)
+{
+	return (cc == 0) ? 1u << 23 : 1u << (24 + cc);
+}
+
+/* c.cond.fmt: bit 0 of the condition accepts unordered operands, bit 1 equal ones and bit 2 less
+   ones. Bit 3 only makes NaNs signal, which is not modeled */
+template <typename T, int condition>
+void compareFloat(Hart &h, const Decoded &d)
+{
+	T first = readFloat<T>(h.cpu, d.rd);
+	T second = readFloat<T>(h.cpu, d.rt);
+	bool result = ((condition & 1) && (std::isnan(first) || std::isnan(second))) || ((condition & 2) && first == second) ||
+				  ((condition & 4) && first < second);
+
+	h.cpu.fcsr = result ? (h.cpu.fcsr | d.imm) : (h.cpu.fcsr & ~d.imm);
+	h.cpu.pc += 4;
+}
+
+/* Floating-point operations of format T (fmt S or D). The fd field is in shamt, fs in rd and ft in rt */
+template <typename T>
+void decodeFloat(Decoded &op, uint32_t word)
+{
+	static void (*const comparisons[8])(Hart &, const Decoded &) = {
+		compareFloat<T, 0>, compareFloat<T, 1>, compareFloat<T, 2>, compareFloat<T, 3>,
+		compareFloat<T, 4>, compareFloat<T, 5>, compareFloat<T, 6>, compareFloat<T, 7>};
+
+	if ((word & 0x30) == 0x30)
+	{
+		op.imm = conditionBit(op.shamt >> 2);
+		op.handler = comparisons[word & 7];
+		return;
+	}
+
+	switch (word & 63)
+	{
+	case 0x00: //add.fmt
+		op.handler = [](Hart &h, const Decoded &d)
+		{ writeFloat(h.cpu, d.shamt, readFloat<T>(h.cpu, d.rd) + readFloat<T>(h.cpu, d.rt)); h.cpu.pc += 4; };
+		break;
+	case 0x01: //sub.fmt
+		op.handler = [](Hart &h, const Decoded &d)
+		{ writeFloat(h.cpu, d.shamt, readFloat<T>(h.cpu, d.rd) - readFloat<T>(h.cpu, d.rt)); h.cpu.pc += 4; };
+		break;
+	case 0x02: //mul.fmt
+		op.handler = [](Hart &h, const Decoded &d)
+		{ writeFloat(h.cpu, d.shamt, readFloat<T>(h.cpu, d.rd) * readFloat<T>(h.cpu, d.rt)); h.cpu.pc += 4; };
+		break;
+	case 0x03: //div.fmt
+		op.handler = [](Hart &h, const Decoded &d)
+		{ writeFloat(h.cpu, d.shamt, readFloat<T>(h.cpu, d.rd) / readFloat<T>(h.cpu, d.rt)); h.cpu.pc += 4; };
+		break;
+	case 0x04: //sqrt.fmt
+		op.handler = [](Hart &h, const Decoded &d)
+		{ writeFloat(h.cpu, d.shamt, (T)std::sqrt(readFloat<T>(h.cpu, d.rd))); h.cpu.pc += 4; };
+		break;
+	case 0x05: //abs.fmt
+		op.handler = [](Hart &h, const Decoded &d)
+		{ writeFloat(h.cpu, d.shamt, (T)std::fabs(readFloat<T>(h.cpu, d.rd))); h.cpu.pc += 4; };
+		break;
+	case 0x06: //mov.fmt
+		op.handler = [](Hart &h, const Decoded &d)
+		{ writeFloat(h.cpu, d.shamt, readFloat<T>(h.cpu, d.rd)); h.cpu.pc += 4; };
+		break;
+	case 0x07: //neg.fmt
+		op.handler = [](Hart &h, const Decoded &d)
+		{ writeFloat(h.cpu, d.shamt, -readFloat<T>(h.cpu, d.rd)); h.cpu.pc += 4; };
+		break;
+	case 0x0c: //round.w.fmt, to nearest even whatever the rounding mode
+		op.handler = [](Hart &h, const Decoded &d)
+		{
+			double value = readFloat<T>(h.cpu, d.rd);
+			h.cpu.fpr[d.shamt] = floatToWord(value - std::remainder(value, 1.0));
+			h.cpu.pc += 4;
+		};
+		break;
+	case 0x0d: //trunc.w.fmt
+		op.handler = [](Hart &h, const Decoded &d)
+		{ h.cpu.fpr[d.shamt] = floatToWord(std::trunc((double)readFloat<T>(h.cpu, d.rd))); h.cpu.pc += 4; };
+		break;
+	case 0x0e: //ceil.w.fmt
+		op.handler = [](Hart &h, const Decoded &d)
+		{ h.cpu.fpr[d.shamt] = floatToWord(std::ceil((double)readFloat<T>(h.cpu, d.rd))); h.cpu.pc += 4; };
+		break;
+	case 0x0f: //floor.w.fmt
+		op.handler = [](Hart &h, const Decoded &d)
+		{ h.cpu.fpr[d.shamt] = floatToWord(std::floor((double)readFloat<T>(h.cpu, d.rd))); h.cpu.pc += 4; };
+		break;
+	case 0x20: //cvt.s.fmt
+		op.handler = [](Hart &h, const Decoded &d)
+		{ writeFloat(h.cpu, d.shamt, (float)readFloat<T>(h.cpu, d.rd)); h.cpu.pc += 4; };
+		break;
+	case 0x21: //cvt.d.fmt
+		op.handler = [](Hart &h, const Decoded &d)
+		{ writeFloat(h.cpu, d.shamt, (double)readFloat<T>(h.cpu, d.rd)); h.cpu.pc += 4; };
+		break;
+	case 0x24: //cvt.w.fmt, in the current rounding mode
+		op.handler = [](Hart &h, const Decoded &d)
+		{ h.cpu.fpr[d.shamt] = floatToWord(std::nearbyint((double)readFloat<T>(h.cpu, d.rd))); h.cpu.pc += 4; };
+		break;
+	}
+}
+
+/* Decodes a word of the .text segment at a guest address into its interpreter entry */
+Decoded decode(uint32_t word, uint32_t address)
+{
+	Decoded op;
+	uint32_t opcode = word >> 26;
+
+	op.rs = (word >> 21) & 31;
+	op.rt = (word >> 16) & 31;
+	op.rd = (word >> 11) & 31;
+	op.shamt = (word >> 6) & 31;
+	op.imm = (int16_t)word;
+
+	uint32_t branch = address + 4 + (op.imm << 2);
+	uint32_t funct = word & 63;
+
+	op.handler = [](Hart &h, const Decoded &d)
+	{ h.raise(EXC_RESERVED_INSTRUCTION); };
+
+	/* Checks whose outcome is known from the operands are folded away here, so that the handlers only
+	   check what can go either way. Additions with $zero or 0 and subtractions of $zero cannot overflow,
+	   so they decode as addu, addiu and subu */
+	if (opcode == 0x00 && (funct == 0x20 || funct == 0x22) && (op.rt == 0 || (funct == 0x20 && op.rs == 0)))
+		return decode(word | 0x01, address);
+
+	if (opcode == 0x08 && (op.imm == 0 || op.rs == 0))
+		return decode(word ^ (0x01u << 26), address);
+
+	/* Traps that compare a register with itself or $zero with a constant either always or never trap */
+	int trap = -1;
+
+	if (opcode == 0x00 && ((funct >= 0x30 && funct <= 0x34) || funct == 0x36) && op.rs == op.rt)
+		trap = funct == 0x30 || funct == 0x31 || funct == 0x34; //tge, tgeu, teq
+	else if (opcode == 0x01 && op.rs == 0)
+	{
+
+		if (op.rt == 0x08) //tgei
+			trap = 0 >= (int32_t)op.imm;
+		else if (op.rt == 0x09) //tgeiu
+			trap = op.imm == 0;
+		else if (op.rt == 0x0a) //tlti
+			trap = 0 < (int32_t)op.imm;
+		else if (op.rt == 0x0b) //tltiu
+			trap = op.imm != 0;
+		else if (op.rt == 0x0c) //teqi
+			trap = op.imm == 0;
+		else if (op.rt == 0x0e) //tnei
+			trap = op.imm != 0;
+	}
+	else if (opcode == 0x01 && (op.rt == 0x09 || op.rt == 0x0b) && op.imm == 0)
+		trap = op.rt == 0x09; //tgeiu always traps and tltiu never does with 0
+
+	if (trap == 0)
+		return decode(0, address);
+
+	if (trap == 1)
+	{
+		op.handler = [](Hart &h, const Decoded &d)
+		{ h.raise(EXC_TRAP); };
+
+		return op;
+	}
+
+	if (opcode == 0x00)
+	{
+
+		switch (word & 63)
+		{
+		case 0x00: //sll
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rd] = h.cpu.regs[d.rt] << d.shamt; h.cpu.pc += 4; };
+			break;
+		case 0x01: //movf, movt: the cc field is in imm as its FCSR bit, tf in shamt
+			op.imm = conditionBit(op.rt >> 2);
+			op.shamt = op.rt & 1;
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if (((h.cpu.fcsr & d.imm) != 0) == d.shamt)
+					h.cpu.regs[d.rd] = h.cpu.regs[d.rs];
+
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x02: //srl, or rotr when rs is 1
+			if (op.rs == 1)
+				op.handler = [](Hart &h, const Decoded &d)
+				{ h.cpu.regs[d.rd] = (h.cpu.regs[d.rt] >> d.shamt) | (h.cpu.regs[d.rt] << ((32 - d.shamt) & 31)); h.cpu.pc += 4; };
+			else
+				op.handler = [](Hart &h, const Decoded &d)
+				{ h.cpu.regs[d.rd] = h.cpu.regs[d.rt] >> d.shamt; h.cpu.pc += 4; };
+			break;
+		case 0x03: //sra
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rd] = (int32_t)h.cpu.regs[d.rt] >> d.shamt; h.cpu.pc += 4; };
+			break;
+		case 0x04: //sllv
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rd] = h.cpu.regs[d.rt] << (h.cpu.regs[d.rs] & 31); h.cpu.pc += 4; };
+			break;
+		case 0x06: //srlv, or rotrv when shamt is 1
+			if (op.shamt == 1)
+				op.handler = [](Hart &h, const Decoded &d)
+				{
+					uint32_t shift = h.cpu.regs[d.rs] & 31;
+					h.cpu.regs[d.rd] = (h.cpu.regs[d.rt] >> shift) | (h.cpu.regs[d.rt] << ((32 - shift) & 31));
+					h.cpu.pc += 4;
+				};
+			else
+				op.handler = [](Hart &h, const Decoded &d)
+				{ h.cpu.regs[d.rd] = h.cpu.regs[d.rt] >> (h.cpu.regs[d.rs] & 31); h.cpu.pc += 4; };
+			break;
+		case 0x07: //srav
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rd] = (int32_t)h.cpu.regs[d.rt] >> (h.cpu.regs[d.rs] & 31); h.cpu.pc += 4; };
+			break;
+		case 0x08: //jr
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.pc = h.cpu.regs[d.rs]; };
+			break;
+		case 0x09: //jalr
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint32_t target = h.cpu.regs[d.rs];
+				h.cpu.regs[d.rd] = h.cpu.pc + 4;
+				h.cpu.pc = target;
+			};
+			break;
+		case 0x0a: //movz
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if (h.cpu.regs[d.rt] == 0)
+					h.cpu.regs[d.rd] = h.cpu.regs[d.rs];
+
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x0b: //movn
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if (h.cpu.regs[d.rt] != 0)
+					h.cpu.regs[d.rd] = h.cpu.regs[d.rs];
+
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x0c: //syscall
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.machine->syscall(h); };
+			break;
+		case 0x0d: //break
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.raise(EXC_BREAKPOINT); };
+			break;
+		case 0x0f: //sync
+			op.handler = [](Hart &h, const Decoded &d)
+			{ std::atomic_thread_fence(std::memory_order_seq_cst); h.cpu.pc += 4; };
+			break;
+		case 0x10: //mfhi
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rd] = h.cpu.hi; h.cpu.pc += 4; };
+			break;
+		case 0x11: //mthi
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.hi = h.cpu.regs[d.rs]; h.cpu.pc += 4; };
+			break;
+		case 0x12: //mflo
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rd] = h.cpu.lo; h.cpu.pc += 4; };
+			break;
+		case 0x13: //mtlo
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.lo = h.cpu.regs[d.rs]; h.cpu.pc += 4; };
+			break;
+		case 0x18: //mult
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				int64_t product = (int64_t)(int32_t)h.cpu.regs[d.rs] * (int32_t)h.cpu.regs[d.rt];
+				h.cpu.hi = (uint64_t)product >> 32;
+				h.cpu.lo = product;
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x19: //multu
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint64_t product = (uint64_t)h.cpu.regs[d.rs] * h.cpu.regs[d.rt];
+				h.cpu.hi = product >> 32;
+				h.cpu.lo = product;
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x1a: //div, whose result is unpredictable when dividing by zero: hi and lo are left alone
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				int32_t dividend = h.cpu.regs[d.rs];
+				int32_t divisor = h.cpu.regs[d.rt];
+
+				if (divisor == -1)
+				{
+					h.cpu.lo = 0u - (uint32_t)dividend;
+					h.cpu.hi = 0;
+				}
+				else if (divisor != 0)
+				{
+					h.cpu.lo = dividend / divisor;
+					h.cpu.hi = dividend % divisor;
+				}
+
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x1b: //divu
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint32_t divisor = h.cpu.regs[d.rt];
+
+				if (divisor != 0)
+				{
+					h.cpu.lo = h.cpu.regs[d.rs] / divisor;
+					h.cpu.hi = h.cpu.regs[d.rs] % divisor;
+				}
+
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x20: //add
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				int32_t sum;
+
+				if (__builtin_add_overflow((int32_t)h.cpu.regs[d.rs], (int32_t)h.cpu.regs[d.rt], &sum))
+					return h.raise(EXC_OVERFLOW);
+
+				h.cpu.regs[d.rd] = sum;
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x21: //addu
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rd] = h.cpu.regs[d.rs] + h.cpu.regs[d.rt]; h.cpu.pc += 4; };
+			break;
+		case 0x22: //sub
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				int32_t difference;
+
+				if (__builtin_sub_overflow((int32_t)h.cpu.regs[d.rs], (int32_t)h.cpu.regs[d.rt], &difference))
+					return h.raise(EXC_OVERFLOW);
+
+				h.cpu.regs[d.rd] = difference;
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x23: //subu
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rd] = h.cpu.regs[d.rs] - h.cpu.regs[d.rt]; h.cpu.pc += 4; };
+			break;
+		case 0x24: //and
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rd] = h.cpu.regs[d.rs] & h.cpu.regs[d.rt]; h.cpu.pc += 4; };
+			break;
+		case 0x25: //or
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rd] = h.cpu.regs[d.rs] | h.cpu.regs[d.rt]; h.cpu.pc += 4; };
+			break;
+		case 0x26: //xor
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rd] = h.cpu.regs[d.rs] ^ h.cpu.regs[d.rt]; h.cpu.pc += 4; };
+			break;
+		case 0x27: //nor
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rd] = ~(h.cpu.regs[d.rs] | h.cpu.regs[d.rt]); h.cpu.pc += 4; };
+			break;
+		case 0x2a: //slt
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rd] = (int32_t)h.cpu.regs[d.rs] < (int32_t)h.cpu.regs[d.rt]; h.cpu.pc += 4; };
+			break;
+		case 0x2b: //sltu
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rd] = h.cpu.regs[d.rs] < h.cpu.regs[d.rt]; h.cpu.pc += 4; };
+			break;
+		case 0x30: //tge
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if ((int32_t)h.cpu.regs[d.rs] >= (int32_t)h.cpu.regs[d.rt])
+					return h.raise(EXC_TRAP);
+
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x31: //tgeu
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if (h.cpu.regs[d.rs] >= h.cpu.regs[d.rt])
+					return h.raise(EXC_TRAP);
+
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x32: //tlt
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if ((int32_t)h.cpu.regs[d.rs] < (int32_t)h.cpu.regs[d.rt])
+					return h.raise(EXC_TRAP);
+
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x33: //tltu
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if (h.cpu.regs[d.rs] < h.cpu.regs[d.rt])
+					return h.raise(EXC_TRAP);
+
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x34: //teq
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if (h.cpu.regs[d.rs] == h.cpu.regs[d.rt])
+					return h.raise(EXC_TRAP);
+
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x36: //tne
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if (h.cpu.regs[d.rs] != h.cpu.regs[d.rt])
+					return h.raise(EXC_TRAP);
+
+				h.cpu.pc += 4;
+			};
+			break;
+		}
+	}
+	else if (opcode == 0x01)
+	{
+
+		if (op.rt == 0x00 || op.rt == 0x01 || op.rt == 0x10 || op.rt == 0x11)
+			op.imm = branch;
+
+		switch (op.rt)
+		{
+		case 0x00: //bltz
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.pc = ((int32_t)h.cpu.regs[d.rs] < 0) ? d.imm : h.cpu.pc + 4; };
+			break;
+		case 0x01: //bgez
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.pc = ((int32_t)h.cpu.regs[d.rs] >= 0) ? d.imm : h.cpu.pc + 4; };
+			break;
+		case 0x10: //bltzal
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				bool taken = (int32_t)h.cpu.regs[d.rs] < 0;
+				h.cpu.regs[31] = h.cpu.pc + 4;
+				h.cpu.pc = taken ? d.imm : h.cpu.pc + 4;
+			};
+			break;
+		case 0x11: //bgezal
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				bool taken = (int32_t)h.cpu.regs[d.rs] >= 0;
+				h.cpu.regs[31] = h.cpu.pc + 4;
+				h.cpu.pc = taken ? d.imm : h.cpu.pc + 4;
+			};
+			break;
+		case 0x08: //tgei
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if ((int32_t)h.cpu.regs[d.rs] >= (int32_t)d.imm)
+					return h.raise(EXC_TRAP);
+
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x09: //tgeiu
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if (h.cpu.regs[d.rs] >= d.imm)
+					return h.raise(EXC_TRAP);
+
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x0a: //tlti
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if ((int32_t)h.cpu.regs[d.rs] < (int32_t)d.imm)
+					return h.raise(EXC_TRAP);
+
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x0b: //tltiu
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if (h.cpu.regs[d.rs] < d.imm)
+					return h.raise(EXC_TRAP);
+
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x0c: //teqi
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if (h.cpu.regs[d.rs] == d.imm)
+					return h.raise(EXC_TRAP);
+
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x0e: //tnei
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if (h.cpu.regs[d.rs] != d.imm)
+					return h.raise(EXC_TRAP);
+
+				h.cpu.pc += 4;
+			};
+			break;
+		}
+	}
+	else if (opcode == 0x02 || opcode == 0x03)
+	{
+
+		op.imm = ((address + 4) & 0xf0000000) | ((word & 0x3ffffff) << 2);
+
+		if (opcode == 0x02) //j
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.pc = d.imm; };
+		else //jal
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[31] = h.cpu.pc + 4; h.cpu.pc = d.imm; };
+	}
+	else if (opcode == 0x10)
+	{
+
+		op.shamt = word & 7; //The select field of mfc0/mtc0
+
+		if (op.rs == 0x00) //mfc0
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint32_t *reg = cp0Register(h.cpu, d.rd, d.shamt);
+				h.cpu.regs[d.rt] = (reg != nullptr) ? *reg : 0;
+				h.cpu.pc += 4;
+			};
+		else if (op.rs == 0x04) //mtc0: BadVAddr is read-only, and only the software interrupt bits of Cause can be written
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint32_t *reg = cp0Register(h.cpu, d.rd, d.shamt);
+				uint32_t value = h.cpu.regs[d.rt];
+
+				if (reg == &h.cpu.cause)
+					h.cpu.cause = (h.cpu.cause & ~0x300u) | (value & 0x300);
+				else if (reg == &h.cpu.ebase)
+					h.cpu.ebase = value & 0xfffff000;
+				else if (reg != nullptr && reg != &h.cpu.badvaddr)
+					*reg = value;
+
+				h.cpu.pc += 4;
+			};
+		else if (word == 0x42000018) //eret
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				h.cpu.status &= ~STATUS_EXL;
+				h.cpu.pc = h.cpu.epc;
+				h.reserved_address = 1;
+			};
+	}
+	else if (opcode == 0x11)
+	{
+
+		if (op.rs == 0x10)
+			decodeFloat<float>(op, word);
+		else if (op.rs == 0x11)
+			decodeFloat<double>(op, word);
+		else if (op.rs == 0x14 && funct == 0x20) //cvt.s.w
+			op.handler = [](Hart &h, const Decoded &d)
+			{ writeFloat(h.cpu, d.shamt, (float)(int32_t)h.cpu.fpr[d.rd]); h.cpu.pc += 4; };
+		else if (op.rs == 0x14 && funct == 0x21) //cvt.d.w
+			op.handler = [](Hart &h, const Decoded &d)
+			{ writeFloat(h.cpu, d.shamt, (double)(int32_t)h.cpu.fpr[d.rd]); h.cpu.pc += 4; };
+		else if (op.rs == 0x00) //mfc1
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rt] = h.cpu.fpr[d.rd]; h.cpu.pc += 4; };
+		else if (op.rs == 0x04) //mtc1
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.fpr[d.rd] = h.cpu.regs[d.rt]; h.cpu.pc += 4; };
+		else if (op.rs == 0x02) //cfc1: FIR and FCSR
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				h.cpu.regs[d.rt] = (d.rd == 0) ? FIR : (d.rd == 31) ? h.cpu.fcsr : 0;
+				h.cpu.pc += 4;
+			};
+		else if (op.rs == 0x06) //ctc1: the FCSR, whose rounding mode goes to the host
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if (d.rd == 31)
+				{
+					uint32_t previous = h.cpu.fcsr;
+
+					h.cpu.fcsr = h.cpu.regs[d.rt] & 0xfe83ffff;
+
+					if (((previous ^ h.cpu.fcsr) & 3) != 0)
+						setHostRounding(h.cpu.fcsr);
+				}
+
+				h.cpu.pc += 4;
+			};
+		else if (op.rs == 0x08) //bc1f, bc1t
+		{
+
+			op.rs = (word >> 16) & 1;
+			op.rt = 0;
+			op.shamt = 0;
+			op.imm = branch;
+			op.rd = (word >> 18) & 7;
+
+			if (op.rs != 0)
+				op.handler = [](Hart &h, const Decoded &d)
+				{ h.cpu.pc = (h.cpu.fcsr & conditionBit(d.rd)) ? d.imm : h.cpu.pc + 4; };
+			else
+				op.handler = [](Hart &h, const Decoded &d)
+				{ h.cpu.pc = (h.cpu.fcsr & conditionBit(d.rd)) ? h.cpu.pc + 4 : d.imm; };
+		}
+	}
+	else if (opcode == 0x1c)
+	{
+
+		switch (word & 63)
+		{
+		case 0x00: //madd
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				int64_t sum = (int64_t)(((uint64_t)h.cpu.hi << 32) | h.cpu.lo) + (int64_t)(int32_t)h.cpu.regs[d.rs] * (int32_t)h.cpu.regs[d.rt];
+				h.cpu.hi = (uint64_t)sum >> 32;
+				h.cpu.lo = sum;
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x01: //maddu
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint64_t sum = (((uint64_t)h.cpu.hi << 32) | h.cpu.lo) + (uint64_t)h.cpu.regs[d.rs] * h.cpu.regs[d.rt];
+				h.cpu.hi = sum >> 32;
+				h.cpu.lo = sum;
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x02: //mul
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rd] = (int32_t)h.cpu.regs[d.rs] * (int64_t)(int32_t)h.cpu.regs[d.rt]; h.cpu.pc += 4; };
+			break;
+		case 0x04: //msub
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				int64_t difference = (int64_t)(((uint64_t)h.cpu.hi << 32) | h.cpu.lo) - (int64_t)(int32_t)h.cpu.regs[d.rs] * (int32_t)h.cpu.regs[d.rt];
+				h.cpu.hi = (uint64_t)difference >> 32;
+				h.cpu.lo = difference;
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x05: //msubu
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint64_t difference = (((uint64_t)h.cpu.hi << 32) | h.cpu.lo) - (uint64_t)h.cpu.regs[d.rs] * h.cpu.regs[d.rt];
+				h.cpu.hi = difference >> 32;
+				h.cpu.lo = difference;
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x20: //clz
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint32_t value = h.cpu.regs[d.rs];
+				h.cpu.regs[d.rd] = (value == 0) ? 32 : __builtin_clz(value);
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x21: //clo
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint32_t value = ~h.cpu.regs[d.rs];
+				h.cpu.regs[d.rd] = (value == 0) ? 32 : __builtin_clz(value);
+				h.cpu.pc += 4;
+			};
+			break;
+		}
+	}
+	else if (opcode == 0x1f)
+	{
+
+		/* The bit fields of ext and ins are in rd (msbd or msb) and shamt (lsb) */
+		switch (word & 63)
+		{
+		case 0x00: //ext
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint32_t mask = (uint32_t)((2ull << d.rd) - 1);
+				h.cpu.regs[d.rt] = (h.cpu.regs[d.rs] >> d.shamt) & mask;
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x04: //ins
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint32_t mask = (uint32_t)((2ull << d.rd) - (1ull << d.shamt));
+				h.cpu.regs[d.rt] = (h.cpu.regs[d.rt] & ~mask) | ((h.cpu.regs[d.rs] << d.shamt) & mask);
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x20: //wsbh, seb, seh, selected by shamt
+			if (op.shamt == 0x02)
+				op.handler = [](Hart &h, const Decoded &d)
+				{
+					uint32_t value = h.cpu.regs[d.rt];
+					h.cpu.regs[d.rd] = ((value & 0x00ff00ff) << 8) | ((value >> 8) & 0x00ff00ff);
+					h.cpu.pc += 4;
+				};
+			else if (op.shamt == 0x10)
+				op.handler = [](Hart &h, const Decoded &d)
+				{ h.cpu.regs[d.rd] = (int8_t)h.cpu.regs[d.rt]; h.cpu.pc += 4; };
+			else if (op.shamt == 0x18)
+				op.handler = [](Hart &h, const Decoded &d)
+				{ h.cpu.regs[d.rd] = (int16_t)h.cpu.regs[d.rt]; h.cpu.pc += 4; };
+			break;
+		case 0x3b: //rdhwr: the CPU number, the synci step (none needed), the cycle counter, its resolution and UserLocal
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if (d.rd == 0)
+					h.cpu.regs[d.rt] = h.id;
+				else if (d.rd == 1)
+					h.cpu.regs[d.rt] = 0;
+				else if (d.rd == 2)
+					h.cpu.regs[d.rt] = h.retired;
+				else if (d.rd == 3)
+					h.cpu.regs[d.rt] = 1;
+				else if (d.rd == 29)
+					h.cpu.regs[d.rt] = h.cpu.user_local;
+				else
+					return h.raise(EXC_RESERVED_INSTRUCTION);
+
+				h.cpu.pc += 4;
+			};
+			break;
+		}
+	}
+	else if (opcode == 0x33) //pref, a hint
+		op.handler = [](Hart &h, const Decoded &d)
+		{ h.cpu.pc += 4; };
+	else
+	{
+
+		if (opcode == 0x04 || opcode == 0x05 || opcode == 0x06 || opcode == 0x07)
+			op.imm = branch;
+		else if (opcode == 0x0c || opcode == 0x0d || opcode == 0x0e)
+			op.imm = word & 0xffff;
+		else if (opcode == 0x0f)
+			op.imm = word << 16;
+
+		switch (opcode)
+		{
+		case 0x04: //beq
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.pc = (h.cpu.regs[d.rs] == h.cpu.regs[d.rt]) ? d.imm : h.cpu.pc + 4; };
+			break;
+		case 0x05: //bne
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.pc = (h.cpu.regs[d.rs] != h.cpu.regs[d.rt]) ? d.imm : h.cpu.pc + 4; };
+			break;
+		case 0x06: //blez
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.pc = ((int32_t)h.cpu.regs[d.rs] <= 0) ? d.imm : h.cpu.pc + 4; };
+			break;
+		case 0x07: //bgtz
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.pc = ((int32_t)h.cpu.regs[d.rs] > 0) ? d.imm : h.cpu.pc + 4; };
+			break;
+		case 0x08: //addi
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				int32_t sum;
+
+				if (__builtin_add_overflow((int32_t)h.cpu.regs[d.rs], (int32_t)d.imm, &sum))
+					return h.raise(EXC_OVERFLOW);
+
+				h.cpu.regs[d.rt] = sum;
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x09: //addiu
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rt] = h.cpu.regs[d.rs] + d.imm; h.cpu.pc += 4; };
+			break;
+		case 0x0a: //slti
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rt] = (int32_t)h.cpu.regs[d.rs] < (int32_t)d.imm; h.cpu.pc += 4; };
+			break;
+		case 0x0b: //sltiu
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rt] = h.cpu.regs[d.rs] < d.imm; h.cpu.pc += 4; };
+			break;
+		case 0x0c: //andi
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rt] = h.cpu.regs[d.rs] & d.imm; h.cpu.pc += 4; };
+			break;
+		case 0x0d: //ori
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rt] = h.cpu.regs[d.rs] | d.imm; h.cpu.pc += 4; };
+			break;
+		case 0x0e: //xori
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rt] = h.cpu.regs[d.rs] ^ d.imm; h.cpu.pc += 4; };
+			break;
+		case 0x0f: //lui
+			op.handler = [](Hart &h, const Decoded &d)
+			{ h.cpu.regs[d.rt] = d.imm; h.cpu.pc += 4; };
+			break;
+		case 0x20: //lb
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint8_t value;
+
+				if (h.load(h.cpu.regs[d.rs] + d.imm, value))
+				{
+					h.cpu.regs[d.rt] = (int8_t)value;
+					h.cpu.pc += 4;
+				}
+			};
+			break;
+		case 0x21: //lh
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint16_t value;
+
+				if (h.load(h.cpu.regs[d.rs] + d.imm, value))
+				{
+					h.cpu.regs[d.rt] = (int16_t)value;
+					h.cpu.pc += 4;
+				}
+			};
+			break;
+		case 0x22: //lwl
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint32_t address = h.cpu.regs[d.rs] + d.imm;
+				uint32_t shift = unalignedShift(h, address);
+				uint32_t value;
+
+				if (h.load(address & ~3u, value))
+				{
+					h.cpu.regs[d.rt] = (value << shift) | (h.cpu.regs[d.rt] & ((1u << shift) - 1));
+					h.cpu.pc += 4;
+				}
+			};
+			break;
+		case 0x23: //lw
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint32_t value;
+
+				if (h.load(h.cpu.regs[d.rs] + d.imm, value))
+				{
+					h.cpu.regs[d.rt] = value;
+					h.cpu.pc += 4;
+				}
+			};
+			break;
+		case 0x24: //lbu
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint8_t value;
+
+				if (h.load(h.cpu.regs[d.rs] + d.imm, value))
+				{
+					h.cpu.regs[d.rt] = value;
+					h.cpu.pc += 4;
+				}
+			};
+			break;
+		case 0x25: //lhu
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint16_t value;
+
+				if (h.load(h.cpu.regs[d.rs] + d.imm, value))
+				{
+					h.cpu.regs[d.rt] = value;
+					h.cpu.pc += 4;
+				}
+			};
+			break;
+		case 0x26: //lwr
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint32_t address = h.cpu.regs[d.rs] + d.imm;
+				uint32_t shift = 24 - unalignedShift(h, address);
+				uint32_t value;
+
+				if (h.load(address & ~3u, value))
+				{
+					h.cpu.regs[d.rt] = (value >> shift) | (h.cpu.regs[d.rt] & ~(0xffffffffu >> shift));
+					h.cpu.pc += 4;
+				}
+			};
+			break;
+		case 0x28: //sb
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if (h.store(h.cpu.regs[d.rs] + d.imm, (uint8_t)h.cpu.regs[d.rt]))
+					h.cpu.pc += 4;
+			};
+			break;
+		case 0x29: //sh
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if (h.store(h.cpu.regs[d.rs] + d.imm, (uint16_t)h.cpu.regs[d.rt]))
+					h.cpu.pc += 4;
+			};
+			break;
+		case 0x2a: //swl
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint32_t address = h.cpu.regs[d.rs] + d.imm;
+				uint32_t shift = unalignedShift(h, address);
+				uint32_t value;
+
+				if (h.load(address & ~3u, value) &&
+					h.store(address & ~3u, (value & ~(0xffffffffu >> shift)) | (h.cpu.regs[d.rt] >> shift)))
+					h.cpu.pc += 4;
+			};
+			break;
+		case 0x2b: //sw
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if (h.store(h.cpu.regs[d.rs] + d.imm, h.cpu.regs[d.rt]))
+					h.cpu.pc += 4;
+			};
+			break;
+		case 0x2e: //swr
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint32_t address = h.cpu.regs[d.rs] + d.imm;
+				uint32_t shift = 24 - unalignedShift(h, address);
+				uint32_t value;
+
+				if (h.load(address & ~3u, value) &&
+					h.store(address & ~3u, (h.cpu.regs[d.rt] << shift) | (value & ((1u << shift) - 1))))
+					h.cpu.pc += 4;
+			};
+			break;
+		case 0x30: //ll: reserves the address and remembers the word it read
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint32_t address = h.cpu.regs[d.rs] + d.imm;
+				uint8_t *host = h.access(address, 4, false);
+
+				if (host == nullptr)
+					return;
+
+				uint32_t value = __atomic_load_n((uint32_t *)host, __ATOMIC_ACQUIRE);
+
+				h.reserved_address = address;
+				h.reserved_value = value;
+				h.cpu.regs[d.rt] = h.swap ? byteSwap(value) : value;
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x38: //sc: succeeds if the reserved word still holds what ll read, swapping it atomically
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint32_t address = h.cpu.regs[d.rs] + d.imm;
+				uint8_t *host = h.access(address, 4, true);
+
+				if (host == nullptr)
+					return;
+
+				uint32_t expected = h.reserved_value;
+				uint32_t desired = h.swap ? byteSwap(h.cpu.regs[d.rt]) : h.cpu.regs[d.rt];
+				bool stored = address == h.reserved_address &&
+							  __atomic_compare_exchange_n((uint32_t *)host, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+
+				h.reserved_address = 1;
+				h.cpu.regs[d.rt] = stored;
+				h.cpu.pc += 4;
+			};
+			break;
+		case 0x31: //lwc1
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if (h.load(h.cpu.regs[d.rs] + d.imm, h.cpu.fpr[d.rt]))
+					h.cpu.pc += 4;
+			};
+			break;
+		case 0x35: //ldc1, whose words are in memory order: the high one first on big-endian guests
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				uint64_t value;
+
+				if (h.load(h.cpu.regs[d.rs] + d.imm, value))
+				{
+					h.cpu.fpr[d.rt & ~1u] = value;
+					h.cpu.fpr[d.rt | 1] = value >> 32;
+					h.cpu.pc += 4;
+				}
+			};
+			break;
+		case 0x39: //swc1
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if (h.store(h.cpu.regs[d.rs] + d.imm, h.cpu.fpr[d.rt]))
+					h.cpu.pc += 4;
+			};
+			break;
+		case 0x3d: //sdc1
+			op.handler = [](Hart &h, const Decoded &d)
+			{
+				if (h.store(h.cpu.regs[d.rs] + d.imm, (uint64_t)h.cpu.fpr[d.rt | 1] << 32 | h.cpu.fpr[d.rt & ~1u]))
+					h.cpu.pc += 4;
+			};
+			break;
+		}
+	}
+
+	return op;
+}
+
+/* Decodes a word for the executables of a MIPS toolchain, whose branches and jumps have a delay slot:
+   they link the address after the slot and run it before going on. The targets are those of decode() */
+Decoded decodeDelayed(uint32_t word, uint32_t address)
+{
+	Decoded op = decode(word, address);
+	uint32_t opcode = word >> 26;
+	uint32_t funct = word & 63;
+	uint32_t rs = (word >> 21) & 31;
+	uint32_t rt = (word >> 16) & 31;
+
+	if (opcode == 0x00 && funct == 0x08) //jr
+		op.handler = [](Hart &h, const Decoded &d)
+		{ h.delaySlot(h.cpu.regs[d.rs]); };
+	else if (opcode == 0x00 && funct == 0x09) //jalr
+		op.handler = [](Hart &h, const Decoded &d)
+		{
+			uint32_t target = h.cpu.regs[d.rs];
+			h.cpu.regs[d.rd] = h.cpu.pc + 8;
+			h.delaySlot(target);
+		};
+	else if (opcode == 0x02) //j
+		op.handler = [](Hart &h, const Decoded &d)
+		{ h.delaySlot(d.imm); };
+	else if (opcode == 0x03) //jal
+		op.handler = [](Hart &h, const Decoded &d)
+		{ h.cpu.regs[31] = h.cpu.pc + 8; h.delaySlot(d.imm); };
+	else if (opcode == 0x04) //beq
+		op.handler = [](Hart &h, const Decoded &d)
+		{ h.delaySlot((h.cpu.regs[d.rs] == h.cpu.regs[d.rt]) ? d.imm : h.cpu.pc + 8); };
+	else if (opcode == 0x05) //bne
+		op.handler = [](Hart &h, const Decoded &d)
+		{ h.delaySlot((h.cpu.regs[d.rs] != h.cpu.regs[d.rt]) ? d.imm : h.cpu.pc + 8); };
+	else if (opcode == 0x06) //blez
+		op.handler = [](Hart &h, const Decoded &d)
+		{ h.delaySlot(((int32_t)h.cpu.regs[d.rs] <= 0) ? d.imm : h.cpu.pc + 8); };
+	else if (opcode == 0x07) //bgtz
+		op.handler = [](Hart &h, const Decoded &d)
+		{ h.delaySlot(((int32_t)h.cpu.regs[d.rs] > 0) ? d.imm : h.cpu.pc + 8); };
+	else if (opcode == 0x01 && rt == 0x00) //bltz
+		op.handler = [](Hart &h, const Decoded &d)
+		{ h.delaySlot(((int32_t)h.cpu.regs[d.rs] < 0) ? d.imm : h.cpu.pc + 8); };
+	else if (opcode == 0x01 && rt == 0x01) //bgez
+		op.handler = [](Hart &h, const Decoded &d)
+		{ h.delaySlot(((int32_t)h.cpu.regs[d.rs] >= 0) ? d.imm : h.cpu.pc + 8); };
+	else if (opcode == 0x01 && rt == 0x10) //bltzal
+		op.handler = [](Hart &h, const Decoded &d)
+		{
+			bool taken = (int32_t)h.cpu.regs[d.rs] < 0;
+			h.cpu.regs[31] = h.cpu.pc + 8;
+			h.delaySlot(taken ? d.imm : h.cpu.pc + 8);
+		};
+	else if (opcode == 0x01 && rt == 0x11) //bgezal, and bal
+		op.handler = [](Hart &h, const Decoded &d)
+		{
+			bool taken = (int32_t)h.cpu.regs[d.rs] >= 0;
+			h.cpu.regs[31] = h.cpu.pc + 8;
+			h.delaySlot(taken ? d.imm : h.cpu.pc + 8);
+		};
+	else if (opcode == 0x11 && rs == 0x08) //bc1f, bc1t, whose tf bit decode() puts in rs and cc in rd
+		op.handler = [](Hart &h, const Decoded &d)
+		{ h.delaySlot((((h.cpu.fcsr & conditionBit(d.rd)) != 0) == d.rs) ? d.imm : h.cpu.pc + 8); };
+
+	return op;
+}
+
+/* Class of an instruction word for the counters */
+InstructionClass classify(uint32_t word)
+{
+	uint32_t opcode = word >> 26;
+	uint32_t funct = word & 63;
+	uint32_t rs = (word >> 21) & 31;
+	uint32_t rt = (word >> 16) & 31;
+
+	if (opcode == 0x00)
+	{
+
+		if (funct == 0x08 || funct == 0x09)
+			return CLASS_JUMP;
+		else if (funct == 0x0c || funct == 0x0d || funct == 0x0f)
+			return CLASS_SYSTEM;
+		else if (funct >= 0x10 && funct <= 0x1b)
+			return CLASS_MULTIPLY_DIVIDE;
+		else if (funct >= 0x30 && funct <= 0x36)
+			return CLASS_TRAP;
+
+		return CLASS_ALU;
+	}
+	else if (opcode == 0x01)
+		return (rt >= 0x08 && rt <= 0x0e) ? CLASS_TRAP : CLASS_BRANCH;
+	else if (opcode == 0x02 || opcode == 0x03)
+		return CLASS_JUMP;
+	else if (opcode >= 0x04 && opcode <= 0x07)
+		return CLASS_BRANCH;
+	else if (opcode >= 0x08 && opcode <= 0x0f)
+		return CLASS_ALU;
+	else if (opcode == 0x10)
+		return CLASS_SYSTEM;
+	else if (opcode == 0x11)
+		return rs == 0x08 ? CLASS_BRANCH : CLASS_FLOATING_POINT;
+	else if (opcode == 0x1c)
+		return (funct == 0x20 || funct == 0x21) ? CLASS_ALU : CLASS_MULTIPLY_DIVIDE;
+	else if (opcode == 0x1f)
+		return CLASS_ALU;
+	else if ((opcode >= 0x20 && opcode <= 0x26) || opcode == 0x31 || opcode == 0x33 || opcode == 0x35)
+		return CLASS_LOAD;
+	else if ((opcode >= 0x28 && opcode <= 0x2e) || opcode == 0x39 || opcode == 0x3d)
+		return CLASS_STORE;
+	else if (opcode == 0x30 || opcode == 0x38)
+		return CLASS_ATOMIC;
+
+	return CLASS_INVALID;
+}
+
+/* Formats a float or a double as MARS prints them, the way Java does: the shortest digits that read back
+   to the same value, in plain notation from 10^-3 to 10^7 and in scientific notation (1.0E10) otherwise */
+template <typename T>
+string formatFloat(T value)
+{
+	char buffer[64];
+
+	if (std::isnan(value))
+		return "NaN";
+
+	if (std::isinf(value))
+		return value > 0 ? "Infinity" : "-Infinity";
+
+	T magnitude = std::fabs(value);
+	bool plain = magnitude == 0 || (magnitude >= (T)1e-3 && magnitude < (T)1e7);
+	char *end = std::to_chars(buffer, buffer + sizeof(buffer), value, plain ? std::chars_format::fixed : std::chars_format::scientific).ptr;
+	string text(buffer, end);
+	size_t exponent = text.find('e');
+	string mantissa = text.substr(0, exponent);
+
+	if (mantissa.find('.') == string::npos)
+		mantissa += ".0";
+
+	if (plain)
+		return mantissa;
+
+	return mantissa + "E" + to_string(stoi(text.substr(exponent + 1)));
+}
+
+/* The console syscalls of MARS and SPIM: 1 print_int, 2 print_float, 3 print_double, 4 print_string,
+   5 read_int, 6 read_float, 7 read_double, 9 sbrk, 10 exit, 11 print_char, 12 read_char, 15 write (to
+   descriptors 1 and 2) and 17 exit2. Floats and doubles are printed from $f12 ($f12/$f13) and read into
+   $f0 ($f0/$f1). exit stops the hart that calls it, exit2 the whole program */
+void Simulator::syscall(Hart &hart)
+{
+	uint32_t *regs = hart.cpu.regs;
+	uint32_t service = regs[2];
+
+	if (toolchain)
+		return linuxSyscall(hart);
+
+	metrics.slot()->add(COUNT_SYSCALLS);
+
+	if ((service >= 1 && service <= 4) || service == 11 || service == 15)
+	{
+
+		string text;
+
+		if (service == 1)
+			text = to_string((int32_t)regs[4]);
+		else if (service == 2)
+			text = formatFloat(readFloat<float>(hart.cpu, 12));
+		else if (service == 3)
+			text = formatFloat(readFloat<double>(hart.cpu, 12));
+		else if (service == 11)
+			text = string(1, (char)regs[4]);
+		else
+		{
+
+			/* Strings end at a null byte, buffers have the length in $a2 */
+			uint32_t address = (service == 4) ? regs[4] : regs[5];
+			uint8_t byte;
+
+			while ((service == 4 || text.size() < regs[6]) && hart.load(address + text.size(), byte) && (service != 4 || byte != 0))
+				text += (char)byte;
+
+			if (!hart.running)
+				return;
+
+			if (service == 15 && regs[4] != 1 && regs[4] != 2)
+			{
+				regs[2] = -1;
+				hart.cpu.pc += 4;
+				return;
+			}
+
+			if (service == 15)
+				regs[2] = text.size();
+		}
+
+		std::lock_guard<std::mutex> lock(io);
+
+		if (console)
+			(service == 15 && regs[4] == 2 ? std::cerr : cout) << text;
+	}
+	else if ((service >= 5 && service <= 7) || service == 12)
+	{
+
+		std::lock_guard<std::mutex> lock(io);
+		cout.flush();
+
+		/* Without a console the input is empty, so that every pass over a program reads the same */
+		if (service == 6)
+		{
+			float value = 0;
+
+			if (console)
+				std::cin >> value;
+
+			writeFloat(hart.cpu, 0, value);
+		}
+		else if (service == 7)
+		{
+			double value = 0;
+
+			if (console)
+				std::cin >> value;
+
+			writeFloat(hart.cpu, 0, value);
+		}
+		else if (!console)
+			regs[2] = (service == 5) ? 0 : -1;
+		else if (service == 5)
+		{
+			int32_t value = 0;
+			std::cin >> value;
+			regs[2] = value;
+		}
+		else
+			regs[2] = std::cin.get();
+	}
+	else if (service == 9)
+	{
+
+		/* sbrk keeps the heap word-aligned. A negative increment shrinks the heap, and the break
+		   only moves when the new one stays inside it, as other harts may move it meanwhile */
+		int64_t increment = ((int64_t)(int32_t)regs[4] + 3) & ~(int64_t)3;
+		uint32_t top = heap_break;
+		bool fits;
+
+		do
+			fits = top + increment >= heap_start && top + increment <= heap_end;
+		while (fits && !heap_break.compare_exchange_weak(top, (uint32_t)(top + increment)));
+
+		regs[2] = fits ? top : -1;
+	}
+	else if (service == 10)
+	{
+
+		hart.running = false;
+	}
+	else if (service == 17)
+	{
+
+		exit_code = regs[4];
+		stopped = true;
+		hart.running = false;
+	}
+	else
+	{
+
+		hart.raise(EXC_SYSCALL);
+		return;
+	}
+
+	hart.cpu.pc += 4;
+}
+
+/* Error numbers of Linux on MIPS, where some (ENOSYS) differ from those of x86 */
+enum LinuxError : int32_t
+{
+	LINUX_ENOENT = 2,
+	LINUX_EBADF = 9,
+	LINUX_ENOMEM = 12,
+	LINUX_EFAULT = 14,
+	LINUX_ENODEV = 19,
+	LINUX_EINVAL = 22,
+	LINUX_ENOTTY = 25,
+	LINUX_ESPIPE = 29,
+	LINUX_ENOSYS = 89
+};
+
+/* The system calls of the o32 Linux ABI that static executables of a MIPS toolchain make for a console
+   program: $v0 is 4000 + the number and the arguments are in $a0-$a3, the others on the stack are unused. The
+   result goes to $v0 with $a3 = 0, or the error number with $a3 = 1. Memory comes from the heap: brk
+   moves its bottom part and anonymous mmap takes pages from its top, files cannot be opened, and the
+   others report ENOSYS as an older kernel would */
+void Simulator::linuxSyscall(Hart &hart)
+{
+	uint32_t *regs = hart.cpu.regs;
+	uint32_t service = regs[2];
+	int64_t result = -LINUX_ENOSYS;
+
+	metrics.slot()->add(COUNT_SYSCALLS);
+
+	/* Host address of a guest buffer, or nullptr if it is not mapped in one piece */
+	auto buffer = [&](uint32_t address, uint32_t length) -> uint8_t *
+	{
+		MemoryRegion *region = memory.find(address);
+
+		if (region == nullptr || (uint64_t)address - region->address + length > region->size)
+			return nullptr;
+
+		return region->host + (address - region->address);
+	};
+
+	auto put32 = [&](uint8_t *host, uint32_t value)
+	{
+		if (hart.swap)
+			value = byteSwap(value);
+
+		memcpy(host, &value, 4);
+	};
+
+	auto output = [&](uint32_t fd, const uint8_t *data, uint32_t length)
+	{
+		if (console)
+			(fd == 2 ? std::cerr : cout).write((const char *)data, length);
+	};
+
+	if (service == 4001 || service == 4246) //exit, exit_group: a program has a single thread
+	{
+
+		exit_code = (int32_t)regs[4];
+		stopped = true;
+		hart.running = false;
+		return;
+	}
+	else if (service == 4003) //read, of the console only
+	{
+
+		uint8_t *host = buffer(regs[5], regs[6]);
+
+		if (regs[4] != 0)
+			result = -LINUX_EBADF;
+		else if (host == nullptr)
+			result = -LINUX_EFAULT;
+		else
+		{
+
+			std::lock_guard<std::mutex> lock(io);
+			int c;
+
+			cout.flush();
+			result = 0;
+
+			/* Without a console the input is empty, and a line at most is read at once like a terminal does */
+			while (console && result < regs[6] && (c = std::cin.get()) != EOF)
+			{
+				host[result++] = c;
+
+				if (c == '\n')
+					break;
+			}
+		}
+	}
+	else if (service == 4004) //write
+	{
+
+		uint8_t *host = buffer(regs[5], regs[6]);
+
+		if (regs[4] != 1 && regs[4] != 2)
+			result = -LINUX_EBADF;
+		else if (host == nullptr)
+			result = -LINUX_EFAULT;
+		else
+		{
+
+			std::lock_guard<std::mutex> lock(io);
+
+			output(regs[4], host, regs[6]);
+			result = regs[6];
+		}
+	}
+	else if (service == 4146) //writev
+	{
+
+		uint8_t *vector = buffer(regs[5], regs[6] * 8);
+
+		if (regs[4] != 1 && regs[4] != 2)
+			result = -LINUX_EBADF;
+		else if (vector == nullptr)
+			result = -LINUX_EFAULT;
+		else
+		{
+
+			std::lock_guard<std::mutex> lock(io);
+
+			result = 0;
+
+			for (uint32_t i = 0; i < regs[6]; i++)
+			{
+				uint32_t base, length;
+
+				memcpy(&base, vector + i * 8, 4);
+				memcpy(&length, vector + i * 8 + 4, 4);
+
+				if (hart.swap)
+				{
+					base = byteSwap(base);
+					length = byteSwap(length);
+				}
+
+				uint8_t *host = buffer(base, length);
+
+				if (host == nullptr)
+				{
+					result = (result == 0) ? -LINUX_EFAULT : result;
+					break;
+				}
+
+				output(regs[4], host, length);
+				result += length;
+			}
+		}
+	}
+	else if (service == 4006 || service == 4091 || service == 4125 || service == 4194 || service == 4195 || service == 4309)
+	{
+
+		result = 0; //close, munmap, mprotect, rt_sigaction, rt_sigprocmask, set_robust_list
+	}
+	else if (service == 4019) //lseek, on the console
+	{
+
+		result = -LINUX_ESPIPE;
+	}
+	else if (service == 4054) //ioctl: the console is no terminal
+	{
+
+		result = -LINUX_ENOTTY;
+	}
+	else if (service == 4005 || service == 4288 || service == 4085) //open, openat, readlink
+	{
+
+		result = -LINUX_ENOENT;
+	}
+	else if (service == 4045) //brk, which returns the break it ends at
+	{
+
+		if (regs[4] >= heap_start && regs[4] <= heap_end)
+			heap_break = regs[4];
+
+		result = heap_break;
+	}
+	else if (service == 4090 || service == 4210) //mmap, mmap2
+	{
+
+		uint64_t length = ((uint64_t)regs[5] + 0xfff) & ~0xfffull;
+
+		if ((regs[7] & 0x800) == 0) //MAP_ANONYMOUS
+			result = -LINUX_ENODEV;
+		else if (length == 0)
+			result = -LINUX_EINVAL;
+		else if (length > heap_end - heap_break)
+			result = -LINUX_ENOMEM;
+		else
+		{
+
+			heap_end -= length;
+			memset(buffer(heap_end, length), 0, length);
+			result = heap_end;
+		}
+	}
+	else if (service == 4122) //uname
+	{
+
+		uint8_t *host = buffer(regs[4], 6 * 65);
+		const char *fields[6] = {"Linux", "mips", "4.19.0", "#1", "mips", "(none)"};
+
+		if (host == nullptr)
+			result = -LINUX_EFAULT;
+		else
+		{
+
+			memset(host, 0, 6 * 65);
+
+			for (int i = 0; i < 6; i++)
+				strcpy((char *)host + i * 65, fields[i]);
+
+			result = 0;
+		}
+	}
+	else if (service == 4283) //set_thread_area
+	{
+
+		hart.cpu.user_local = regs[4];
+		result = 0;
+	}
+	else if (service == 4020 || service == 4222 || service == 4252) //getpid, gettid, set_tid_address
+	{
+
+		result = 1;
+	}
+	else if (service == 4024 || service == 4047 || service == 4049 || service == 4050) //getuid, getgid, geteuid, getegid
+	{
+
+		result = 0;
+	}
+	else if (service == 4013 || service == 4078 || service == 4263 || service == 4403) //time, gettimeofday, clock_gettime, clock_gettime64
+	{
+
+		auto now = std::chrono::system_clock::now().time_since_epoch();
+		uint64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+		uint32_t seconds = nanoseconds / 1000000000;
+		uint32_t address = (service == 4013 || service == 4078) ? regs[4] : regs[5];
+		uint8_t *host = buffer(address, (service == 4403) ? 12 : (service == 4013) ? 4 : 8);
+
+		result = (service == 4013) ? seconds : 0;
+
+		if (host == nullptr)
+			result = (address == 0 && service == 4013) ? result : -LINUX_EFAULT;
+		else if (service == 4013)
+			put32(host, seconds);
+		else if (service == 4078)
+		{
+			put32(host, seconds);
+			put32(host + 4, nanoseconds % 1000000000 / 1000);
+		}
+		else if (service == 4263)
+		{
+			put32(host, seconds);
+			put32(host + 4, nanoseconds % 1000000000);
+		}
+		else
+		{
+			/* timespec64 has a 64-bit tv_sec, in guest byte order */
+			put32(host + (memory.big_endian ? 4 : 0), seconds);
+			put32(host + (memory.big_endian ? 0 : 4), 0);
+			put32(host + 8, nanoseconds % 1000000000);
+		}
+	}
+	else if (service == 4353) //getrandom: the same bytes on every run, so that runs can be compared
+	{
+
+		uint8_t *host = buffer(regs[4], regs[5]);
+		std::mt19937 random(regs[5]);
+
+		if (host == nullptr)
+			result = -LINUX_EFAULT;
+		else
+		{
+
+			for (uint32_t i = 0; i < regs[5]; i++)
+				host[i] = random();
+
+			result = regs[5];
+		}
+	}
+
+	if (result < 0 && result > -4096)
+	{
+		regs[2] = -result;
+		regs[7] = 1;
+	}
+	else
+	{
+		regs[2] = result;
+		regs[7] = 0;
+	}
+
+	hart.cpu.pc += 4;
+}
+
+bool Simulator::load(string filename)
+{
+	std::ifstream infile(filename, std::ios::binary);
+	stringstream source;
+
+	if (!infile.is_open())
+		return false;
+
+	source << infile.rdbuf();
+
+	if (source.str().compare(0, 4, "\x7f"
+									"ELF") != 0)
+		return loadSource(source.str(), filename);
+
+	return loadELF(filename, memory, initial, &toolchain) && prepare();
+}
+
+bool Simulator::loadSource(std::string_view source, string name)
+{
+	Assembler assembler;
+	const Image &image = assembler.assemble(source);
+
+	for (auto &diagnostic : image.diagnostics)
+		std::cerr << name << ": " << diagnostic << endl;
+
+	/* A line that did not assemble leaves a hole in the program, so it is not run */
+	if (!image.diagnostics.empty())
+		return false;
+
+	symbols = image.program.symbols;
+
+	return loadIR(image.program, memory, initial) && prepare();
+}
+
+/* Predecodes the code of a loaded program and maps its heap */
+bool Simulator::prepare()
+{
+	if (!predecode(initial.pc))
+		return false;
+
+	/* Exception handlers of the program, if it maps the exception vector */
+	predecode(0x80000180);
+
+	/* The heap is mapped up front, as the harts translate addresses without locking */
+	uint32_t heap_size = 64 << 20;
+	uint32_t heap = memory.freeAbove(0x10040000, heap_size);
+
+	if (heap == 0 || memory.allocate(heap, heap_size) == nullptr)
+		return false;
+
+	heap_break = heap;
+	heap_start = heap;
+	heap_end = heap + heap_size;
+
+	if (!PageGuard::add(this))
+	{
+		std::cerr << "too many simulators to protect their code" << endl;
+		return false;
+	}
+
+	protectPages();
+	return true;
+}
+
+Simulator::~Simulator()
+{
+	PageGuard::remove(this);
+}
+
+CodeRegion *Simulator::codeRegion(uint32_t address)
+{
+	for (auto &region : code_regions)
+	{
+		if (address - region.base < region.code.size() * 4)
+			return &region;
+	}
+
+	return nullptr;
+}
+
+/* Predecoded entry of the instruction at an address, or nullptr if it is not in a predecoded region */
+Decoded *Simulator::entry(uint32_t address)
+{
+	CodeRegion *region = codeRegion(address);
+
+	if (region == nullptr || (address & 3) != 0)
+		return nullptr;
+
+	return &region->code[(address - region->base) / 4];
+}
+
+/* Predecodes the memory region holding an address. Returns false if it is not mapped */
+bool Simulator::predecode(uint32_t address)
+{
+	if (codeRegion(address) != nullptr)
+		return true;
+
+	MemoryRegion *region = memory.find(address);
+
+	if (region == nullptr)
+		return false;
+
+	uint32_t count = region->size / 4;
+
+	uint32_t page_count = (region->size + PageGuard::page_size - 1) / PageGuard::page_size;
+
+	code_regions.push_back({region->address, region->host, vector<Decoded>(count), vector<uint8_t>(count), vector<uint32_t>(count),
+							vector<uint8_t>(page_count)});
+
+	for (uint32_t i = 0; i < count; i++)
+		redecode(region->address + i * 4);
+
+	return true;
+}
+
+void Simulator::setupHart(Hart &hart, int id, int hart_count)
+{
+	uint32_t stack_slice = stack_size / hart_count / 16 * 16;
+
+	this->hart_count = hart_count;
+	hart.machine = this;
+	hart.id = id;
+	hart.swap = memory.big_endian != (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__);
+	hart.cpu = initial;
+	hart.watch_backup.resize(PageGuard::page_size);
+	hart.cpu.regs[registers["$sp"]] -= id * stack_slice;
+	hart.cpu.regs[registers["$a0"]] = id;
+	hart.cpu.regs[registers["$a1"]] = hart_count;
+}
+
+int Simulator::run(int hart_count)
+{
+	vector<Hart> harts(hart_count);
+	vector<std::thread> threads;
+
+	for (int i = 0; i < hart_count; i++)
+		setupHart(harts[i], i, hart_count);
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (auto &hart : harts)
+		threads.emplace_back(&Hart::execute, &hart, UINT64_MAX, nullptr);
+
+	for (auto &thread : threads)
+		thread.join();
+
+	auto end = std::chrono::steady_clock::now();
+
+	seconds = std::chrono::duration<double>(end - start).count();
+	retired = 0;
+
+	for (auto &hart : harts)
+		retired += hart.retired;
+
+	if (shared_code_written)
+	{
+		std::cerr << "the program modified its code while running on " << hart_count << " harts, which is only supported on one" << endl;
+		exit_code = 1;
+	}
+
+	return exit_code;
+}
+
+/* Runs an ELF32 executable or an assembly source file on hart_count harts */
+int runProgram(string filename, int hart_count)
+{
+	Simulator simulator;
+
+	if (!simulator.load(filename))
+	{
+		std::cerr << filename << ": cannot load the program" << endl;
+		return 1;
+	}
+
+	/* Their C library keeps a single thread, and exit_group ends the process */
+	if (simulator.toolchain && hart_count != 1)
+	{
+		std::cerr << filename << ": executables of a MIPS toolchain run on one hart" << endl;
+		return 1;
+	}
+
+	int exit_code = simulator.run(hart_count);
+
+	cout.flush();
+	std::cerr << hart_count << " harts executed " << simulator.retired << " instructions in " << simulator.seconds
+			  << " s (" << simulator.retired / simulator.seconds / 1e6 << " MIPS)" << endl;
+
+	return exit_code;
+}
+
+/* Entry that a breakpoint puts in place of an instruction */
+void breakpointTrap(Hart &h, const Decoded &d)
+{
+	h.stop_signal = 5; //SIGTRAP
+	h.running = false;
+}
+
+/* Breakpoints replace the predecoded entry of their instruction with one that stops the hart, so
+   the interpreter pays nothing for them until one is hit */
+bool Simulator::insertBreakpoint(uint32_t address)
+{
+	Decoded *target = entry(address);
+
+	if (target == nullptr)
+		return false;
+
+	if (breakpoints.count(address) == 0)
+	{
+		breakpoints[address] = *target;
+		target->handler = breakpointTrap;
+	}
+
+	return true;
+}
+
+bool Simulator::removeBreakpoint(uint32_t address)
+{
+	auto it = breakpoints.find(address);
+
+	if (it == breakpoints.end())
+		return false;
+
+	*entry(address) = it->second;
+	breakpoints.erase(it);
+	return true;
+}
+
+void Simulator::insertWatchpoint(uint32_t address, uint32_t length, int type)
+{
+	watchpoints.push_back({address, std::max(length, 1u), type});
+	updateWatchedPages();
+}
+
+bool Simulator::removeWatchpoint(uint32_t address, uint32_t length, int type)
+{
+	auto it = std::find_if(watchpoints.begin(), watchpoints.end(), [&](Watchpoint &watchpoint)
+						   { return watchpoint.address == address && watchpoint.length == std::max(length, 1u) && watchpoint.type == type; });
+
+	if (it == watchpoints.end())
+		return false;
+
+	watchpoints.erase(it);
+	updateWatchedPages();
+	return true;
+}
+
+/* Marks the pages that hold watchpoints. Write watchpoints write-protect their pages, so that only the
+   writes to them fault. Harts leave the pages of read and access watchpoints out of their windows once
+   they drop them, so that only the accesses to those pages are checked */
+void Simulator::updateWatchedPages()
+{
+	for (uint32_t page : protected_pages)
+		protect(page, codeRegion(page) != nullptr ? PROT_READ : PROT_READ | PROT_WRITE);
+
+	watched_pages.clear();
+	protected_pages.clear();
+
+	for (auto &watchpoint : watchpoints)
+	{
+		for (uint64_t page = watchpoint.address / PageGuard::page_size * PageGuard::page_size; page < (uint64_t)watchpoint.address + watchpoint.length; page += PageGuard::page_size)
+			(watchpoint.type == 2 ? protected_pages : watched_pages).insert(page);
+	}
+
+	for (uint32_t page : protected_pages)
+		protect(page, PROT_READ);
+}
+
+/* Ends an instruction that wrote to a write-protected watched page. A store that hits a watchpoint is
+   undone, with the page and the hart as they were before it, so that the hart stops before the store
+   as with the other watchpoints. Returns whether the hart goes on */
+bool Simulator::finishWatchedWrite(Hart &hart)
+{
+	static const uint8_t store_sizes[8] = {1, 2, 4, 4, 0, 0, 4, 0}; //sb, sh, swl, sw, -, -, swr, -
+	uint32_t pc = hart.watch_cpu.pc;
+	CodeRegion *region = codeRegion(pc);
+	uint32_t word = 0;
+	uint32_t size = 0;
+
+	if (region != nullptr)
+		memcpy(&word, region->host + (pc - region->base), 4);
+
+	if (hart.swap)
+		word = byteSwap(word);
+
+	uint32_t opcode = word >> 26;
+	uint32_t address = hart.watch_cpu.regs[(word >> 21) & 31] + (int16_t)word;
+
+	if (opcode >= 0x28 && opcode <= 0x2f)
+		size = store_sizes[opcode - 0x28];
+	else if (opcode == 0x38 || opcode == 0x39)
+		size = 4;
+	else if (opcode == 0x3d)
+		size = 8;
+
+	if (opcode == 0x2a || opcode == 0x2e)
+		address &= ~3u;
+
+	bool hit = size != 0 && watchHit(hart, address, size, true);
+
+	if (hit)
+	{
+		memcpy(hart.watch_page, hart.watch_backup.data(), PageGuard::page_size);
+		hart.cpu = hart.watch_cpu;
+		hart.retired = hart.watch_retired;
+		hart.reserved_address = hart.watch_reserved_address;
+		hart.reserved_value = hart.watch_reserved_value;
+	}
+
+	/* A syscall may have written to several watched pages */
+	for (uint32_t page : protected_pages)
+		protect(page, PROT_READ);
+
+	hart.watch_page = nullptr;
+	return !hit;
+}
+
+/* Stops the hart before an access that a watchpoint covers */
+bool Simulator::watchHit(Hart &hart, uint32_t address, uint32_t size, bool store)
+{
+	for (auto &watchpoint : watchpoints)
+	{
+		bool overlaps = address < (uint64_t)watchpoint.address + watchpoint.length && watchpoint.address < (uint64_t)address + size;
+
+		if (overlaps && (watchpoint.type == 4 || (watchpoint.type == 2) == store))
+		{
+			hart.stop_signal = 5; //SIGTRAP
+			hart.watch_address = std::max(address, watchpoint.address);
+			hart.watch_type = watchpoint.type;
+			hart.running = false;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Decodes again the instruction at an address of the predecoded region after its memory changed.
+   A breakpoint there keeps stopping the hart, and runs the new instruction when stepped over */
+void Simulator::redecode(uint32_t address)
+{
+	address &= ~3u;
+
+	CodeRegion *region = codeRegion(address);
+	uint32_t word;
+
+	if (region == nullptr)
+		return;
+
+	uint32_t index = (address - region->base) / 4;
+	auto patched = breakpoints.find(address);
+
+	memcpy(&word, region->host + index * 4, 4);
+
+	if (memory.big_endian != (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__))
+		word = byteSwap(word);
+
+	(patched != breakpoints.end() ? patched->second : region->code[index]) = toolchain ? decodeDelayed(word, address) : decode(word, address);
+	region->classes[index] = classify(word);
+	region->words[index] = word;
+}
+
+void Simulator::protect(uint32_t page, int protection)
+{
+	MemoryRegion *region = memory.find(page);
+
+	if (region != nullptr)
+		mprotect(region->host + (page - region->address), PageGuard::page_size, protection);
+}
+
+/* Write-protects the pages of the predecoded code and those of the write watchpoints */
+void Simulator::protectPages()
+{
+	for (auto &region : code_regions)
+		mprotect(region.host, region.code.size() * 4, PROT_READ);
+
+	for (uint32_t page : protected_pages)
+		protect(page, PROT_READ);
+}
+
+/* Called by the SIGSEGV handler on a write to a protected page, which it unprotects. A write to code
+   marks its page stale. The hart that wrote stops after the instruction, to decode the page again, and
+   after a write to a watched page, which it saves with its own state, to check the write against the
+   watchpoints. Only programs on one hart may modify their code: the harts of others would run the
+   entries while they are decoded again, so such a write stops the program */
+void Simulator::pageFault(uint32_t address, Hart *hart)
+{
+	uint32_t page = address / PageGuard::page_size * PageGuard::page_size;
+	CodeRegion *region = codeRegion(page);
+	MemoryRegion *mapped = memory.find(page);
+	uint8_t *host = mapped->host + (page - mapped->address);
+	bool ours = hart != nullptr && hart->machine == this;
+
+	if (region != nullptr && hart_count > 1)
+	{
+		shared_code_written = true;
+		stopped = true;
+
+		if (ours)
+			hart->running = false;
+	}
+	else if (region != nullptr)
+	{
+		region->stale[(page - region->base) / PageGuard::page_size] = 1;
+		code_written = true;
+
+		if (ours)
+		{
+			hart->paused = true;
+			hart->running = false;
+		}
+	}
+
+	if (ours && hart->watch_page == nullptr && protected_pages.count(page) != 0)
+	{
+		memcpy(hart->watch_backup.data(), host, PageGuard::page_size);
+		hart->watch_page = host;
+		hart->watch_cpu = hart->cpu;
+		hart->watch_retired = hart->retired;
+		hart->watch_reserved_address = hart->reserved_address;
+		hart->watch_reserved_value = hart->reserved_value;
+		hart->paused = true;
+		hart->running = false;
+	}
+
+	mprotect(host, PageGuard::page_size, PROT_READ | PROT_WRITE);
+}
+
+/* Decodes again the pages of code written since they were decoded, where no hart runs them: before a
+   run, or after the instruction that wrote them */
+void Simulator::refreshCode()
+{
+	if (!code_written.exchange(false))
+		return;
+
+	for (auto &region : code_regions)
+	{
+		for (uint32_t page = 0; page < region.stale.size(); page++)
+		{
+			if (region.stale[page] != 0)
+			{
+				region.stale[page] = 0;
+				refreshPage(region, page);
+			}
+		}
+	}
+}
+
+/* Protects a page of code again and decodes the words that changed since they were decoded. The page
+   is protected before its words are read, so that no write slips between the two */
+void Simulator::refreshPage(CodeRegion &region, uint32_t page)
+{
+	uint32_t first = page * PageGuard::page_size / 4;
+	uint32_t last = std::min<uint32_t>(first + PageGuard::page_size / 4, region.code.size());
+
+	mprotect(region.host + first * 4, PageGuard::page_size, PROT_READ);
+
+	for (uint32_t i = first; i < last; i++)
+	{
+		uint32_t word;
+
+		memcpy(&word, region.host + i * 4, 4);
+
+		if (memory.big_endian != (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__))
+			word = byteSwap(word);
+
+		if (word != region.words[i])
+			redecode(region.base + i * 4);
+	}
+}
+
+/* Writes guest memory from the host, for the debugger and the checkpoints, while the harts are stopped.
+   Protected pages are unprotected for the copy rather than faulting, and code written is decoded again.
+   Returns false if the memory is not mapped */
+bool Simulator::writeMemory(uint32_t address, const uint8_t *data, uint32_t length)
+{
+	while (length != 0)
+	{
+		uint32_t page = address / PageGuard::page_size * PageGuard::page_size;
+		uint32_t chunk = std::min<uint64_t>(length, (uint64_t)page + PageGuard::page_size - address);
+		uint8_t *host = memory.translate(address);
+		CodeRegion *region = codeRegion(page);
+		bool guarded = region != nullptr || protected_pages.count(page) != 0;
+
+		if (host == nullptr)
+			return false;
+
+		if (guarded)
+			protect(page, PROT_READ | PROT_WRITE);
+
+		memcpy(host, data, chunk);
+
+		if (region != nullptr)
+			refreshPage(*region, (page - region->base) / PageGuard::page_size);
+
+		if (guarded)
+			protect(page, PROT_READ);
+
+		address += chunk;
+		data += chunk;
+		length -= chunk;
+	}
+
+	return true;
+}
+
+/* GDB remote serial protocol stub that debugs a program on one hart, over TCP on the loopback
+   interface. It handles registers, memory, steps, software breakpoints, write/read/access
+   watchpoints, interrupts, and the monitor commands "symbols" and "break <label>", which use the
+   labels of the assembled program */
+class GdbStub
+{
+
+public:
+	GdbStub(Simulator &simulator) : simulator(simulator)
+	{
+		simulator.setupHart(hart, 0, 1);
+		hart.debugged = true;
+	}
+
+	GdbStub(const GdbStub &) = delete;
+	GdbStub &operator=(const GdbStub &) = delete;
+
+	~GdbStub()
+	{
+		if (connection >= 0)
+			close(connection);
+	}
+
+	/* Waits for GDB on a port of localhost and serves it until it kills the program, detaches or
+	   disconnects. Returns the exit code of the program */
+	int serve(int port)
+	{
+		int listener = socket(AF_INET, SOCK_STREAM, 0);
+		int enable = 1;
+		sockaddr_in address = {};
+
+		address.sin_family = AF_INET;
+		address.sin_port = htons(port);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+		if (listener < 0 || bind(listener, (sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 1) != 0)
+		{
+			std::cerr << "cannot listen on port " << port << endl;
+
+			if (listener >= 0)
+				close(listener);
+
+			return 1;
+		}
+
+		std::cerr << "Waiting for GDB on localhost:" << port << endl;
+		connection = accept(listener, nullptr, nullptr);
+		close(listener);
+
+		if (connection < 0)
+			return 1;
+
+		setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+		string packet;
+		bool detached = false;
+
+		while (readPacket(packet) && packet != "k")
+		{
+			string reply;
+
+			/* A malformed packet gets an error reply rather than stopping the simulator */
+			try
+			{
+				reply = handle(packet);
+			}
+			catch (const std::exception &)
+			{
+				reply = "E01";
+			}
+
+			sendPacket(reply);
+
+			if (packet == "QStartNoAckMode")
+				acknowledge = false;
+
+			if (packet[0] == 'D')
+			{
+				detached = true;
+				break;
+			}
+		}
+
+		/* A detached program runs on without the debugger */
+		if (detached && !exited)
+		{
+			while (!simulator.breakpoints.empty())
+				simulator.removeBreakpoint(simulator.breakpoints.begin()->first);
+
+			simulator.watchpoints.clear();
+			simulator.updateWatchedPages();
+			hart.window = MemoryRegion();
+			hart.debugged = false;
+			hart.running = true;
+			hart.execute();
+		}
+
+		return simulator.exit_code;
+	}
+
+private:
+	Simulator &simulator;
+	Hart hart;
+	int connection = -1;
+	bool acknowledge = true; //Packets are acknowledged until GDB asks for the no-ack mode
+	bool exited = false;
+	string input; //Bytes received but not read yet
+	size_t input_position = 0;
+
+	int readByte()
+	{
+		if (input_position == input.size())
+		{
+			char buffer[4096];
+			ssize_t received;
+
+			do
+				received = recv(connection, buffer, sizeof(buffer), 0);
+			while (received < 0 && errno == EINTR);
+
+			if (received <= 0)
+				return -1;
+
+			input.assign(buffer, received);
+			input_position = 0;
+		}
+
+		return (uint8_t)input[input_position++];
+	}
+
+	/* Reads the next packet, skipping acknowledgements. Returns false when GDB disconnects */
+	bool readPacket(string &packet)
+	{
+		for (;;)
+		{
+			int c;
+
+			while ((c = readByte()) != '$')
+			{
+				if (c < 0)
+					return false;
+			}
+
+			packet.clear();
+
+			while ((c = readByte()) != '#')
+			{
+				if (c < 0)
+					return false;
+
+				packet += (char)c;
+			}
+
+			int high = readByte();
+			int low = readByte();
+
+			if (low < 0)
+				return false;
+
+			uint8_t checksum = 0;
+
+			for (char elem : packet)
+				checksum += elem;
+
+			/* A checksum that is not two hex digits is refused like a wrong one */
+			bool valid = isxdigit(high) != 0 && isxdigit(low) != 0 && stoul(string{(char)high, (char)low}, nullptr, 16) == checksum;
+
+			if (acknowledge && !writeAll(connection, valid ? "+" : "-", 1))
+				return false;
+
+			if (valid || !acknowledge)
+				return true;
+		}
+	}
+
+	void sendPacket(const string &data)
+	{
+		uint8_t checksum = 0;
+
+		for (char elem : data)
+			checksum += elem;
+
+		string packet = "$" + data + "#" + hexByte(checksum);
+
+		/* Send again until GDB acknowledges the packet */
+		for (;;)
+		{
+			if (!writeAll(connection, packet.data(), packet.size()) || !acknowledge)
+				return;
+
+			int c;
+
+			while ((c = readByte()) != '+' && c != '-')
+			{
+				if (c < 0)
+					return;
+			}
+
+			if (c == '+')
+				return;
+		}
+	}
+
+	static string hexByte(uint8_t byte)
+	{
+		const char *digits = "0123456789abcdef";
+
+		return string{digits[byte >> 4], digits[byte & 15]};
+	}
+
+	/* Registers are sent in guest byte order */
+	string hexWord(uint32_t value)
+	{
+		string text;
+
+		for (int byte = 0; byte < 4; byte++)
+			text += hexByte(value >> (simulator.memory.big_endian ? (3 - byte) * 8 : byte * 8));
+
+		return text;
+	}
+
+	uint32_t parseWord(const string &text)
+	{
+		uint32_t value = 0;
+
+		for (int byte = 0; byte < 4; byte++)
+			value |= stoul(text.substr(byte * 2, 2), nullptr, 16) << (simulator.memory.big_endian ? (3 - byte) * 8 : byte * 8);
+
+		return value;
+	}
+
+	/* Register of the GDB numbering for MIPS: the general purpose registers, then sr, lo, hi, badvaddr,
+	   cause, pc, the floating-point registers, fcsr and fir. The others read as zero */
+	uint32_t *reg(int n)
+	{
+		static uint32_t zero;
+
+		zero = 0;
+
+		if (n < 32)
+			return &hart.cpu.regs[n];
+		else if (n == 32)
+			return &hart.cpu.status;
+		else if (n == 35)
+			return &hart.cpu.badvaddr;
+		else if (n == 36)
+			return &hart.cpu.cause;
+		else if (n == 33)
+			return &hart.cpu.lo;
+		else if (n == 34)
+			return &hart.cpu.hi;
+		else if (n == 37)
+			return &hart.cpu.pc;
+		else if (n >= 38 && n < 70)
+			return &hart.cpu.fpr[n - 38];
+		else if (n == 70)
+			return &hart.cpu.fcsr;
+		else if (n == 71)
+		{
+			zero = FIR;
+			return &zero;
+		}
+
+		return &zero;
+	}
+
+	string stopReply()
+	{
+		if (!hart.running && hart.stop_signal == 0)
+		{
+			exited = true;
+			return "W" + hexByte(simulator.exit_code);
+		}
+
+		if (hart.watch_type != 0)
+		{
+			string kind = (hart.watch_type == 2) ? "watch" : (hart.watch_type == 3) ? "rwatch"
+																					: "awatch";
+			stringstream reply;
+
+			reply << "T05" << kind << ":" << std::hex << hart.watch_address << ";";
+			return reply.str();
+		}
+
+		return "S" + hexByte(hart.stop_signal);
+	}
+
+	/* Executes the instruction at the pc as if no breakpoint or watchpoint stopped the hart there */
+	void stepOver()
+	{
+		vector<Watchpoint> watchpoints;
+		std::set<uint32_t> watched_pages;
+
+		std::swap(watchpoints, simulator.watchpoints);
+		std::swap(watched_pages, simulator.watched_pages);
+		hart.window = MemoryRegion();
+
+		auto patched = simulator.breakpoints.find(hart.cpu.pc);
+
+		hart.step(patched != simulator.breakpoints.end() ? &patched->second : nullptr);
+
+		std::swap(watchpoints, simulator.watchpoints);
+		std::swap(watched_pages, simulator.watched_pages);
+		hart.window = MemoryRegion();
+	}
+
+	/* Steps or continues the hart. A running hart is on another thread, while this one waits for an
+	   interrupt from GDB */
+	string resume(bool single_step)
+	{
+		if (exited)
+			return "E01";
+
+		hart.running = true;
+		hart.stop_signal = 0;
+		hart.watch_type = 0;
+		stepOver();
+
+		if (single_step || !hart.running)
+		{
+			if (hart.running)
+				hart.stop_signal = 5; //SIGTRAP
+
+			return stopReply();
+		}
+
+		std::atomic<bool> finished{false};
+		bool interrupted = false;
+		std::thread runner([&]()
+						   { hart.execute(); finished = true; });
+
+		while (!finished)
+		{
+			pollfd poller = {connection, POLLIN, 0};
+
+			if (input_position < input.size() || poll(&poller, 1, 10) > 0)
+			{
+				int c = readByte();
+
+				if (c < 0 || c == 3)
+				{
+					interrupted = true;
+					simulator.stopped = true;
+				}
+			}
+		}
+
+		runner.join();
+
+		if (interrupted)
+		{
+			simulator.stopped = false;
+
+			if (hart.running)
+				hart.stop_signal = 2; //SIGINT
+		}
+
+		return stopReply();
+	}
+
+	string monitor(const string &command)
+	{
+		stringstream output;
+
+		if (command == "symbols")
+		{
+			for (uint32_t symbol = 0; symbol < simulator.symbols.size(); symbol++)
+				output << "0x" << std::hex << simulator.symbols.address(symbol) << std::dec << " "
+					   << simulator.symbols.name(symbol) << "\n";
+		}
+		else if (command.compare(0, 6, "break ") == 0)
+		{
+			string name = trim(command.substr(6));
+			int32_t symbol = simulator.symbols.find(name);
+
+			if (symbol < 0 || !simulator.insertBreakpoint(simulator.symbols.address(symbol)))
+				output << "No instruction labelled " << name << "\n";
+			else
+				output << "Breakpoint at 0x" << std::hex << simulator.symbols.address(symbol) << "\n";
+		}
+		else
+			output << "Monitor commands: symbols, break <label>\n";
+
+		string hex;
+
+		for (char elem : output.str())
+			hex += hexByte(elem);
+
+		return hex;
+	}
+
+	string handle(const string &packet)
+	{
+		char command = packet.empty() ? 0 : packet[0];
+		string arguments = packet.empty() ? "" : packet.substr(1);
+
+		if (command == '?')
+			return exited ? "W" + hexByte(simulator.exit_code) : "S05";
+		else if (command == 'g')
+		{
+			string registers_text;
+
+			for (int n = 0; n < 72; n++)
+				registers_text += hexWord(*reg(n));
+
+			return registers_text;
+		}
+		else if (command == 'G')
+		{
+			for (int n = 0; n < 72 && (n + 1) * 8 <= (int)arguments.size(); n++)
+				*reg(n) = parseWord(arguments.substr(n * 8, 8));
+
+			return "OK";
+		}
+		else if (command == 'p')
+			return hexWord(*reg(stoul(arguments, nullptr, 16)));
+		else if (command == 'P')
+		{
+			size_t equals = arguments.find('=');
+
+			if (equals == string::npos || arguments.size() - equals - 1 < 8)
+				return "E01";
+
+			*reg(stoul(arguments.substr(0, equals), nullptr, 16)) = parseWord(arguments.substr(equals + 1));
+			return "OK";
+		}
+		else if (command == 'm' || command == 'M')
+		{
+			size_t comma = arguments.find(',');
+			size_t colon = arguments.find(':');
+			uint32_t address = stoul(arguments.substr(0, comma), nullptr, 16);
+			uint32_t length = stoul(arguments.substr(comma + 1, colon - comma - 1), nullptr, 16);
+			string reply;
+
+			/* The reply fits in the packet size given to GDB, and the bytes to write are checked before any is written */
+			if (comma == string::npos || length > 0x2000 || (command == 'M' && (colon == string::npos || arguments.size() - colon - 1 < (size_t)length * 2)))
+				return "E01";
+
+			for (uint32_t i = 0; i < length; i++)
+			{
+				uint8_t *host = simulator.memory.translate(address + i);
+				uint8_t byte;
+
+				if (host == nullptr)
+					return (i == 0 || command == 'M') ? "E01" : reply;
+
+				if (command == 'm')
+					reply += hexByte(*host);
+				else
+				{
+					byte = stoul(arguments.substr(colon + 1 + i * 2, 2), nullptr, 16);
+					simulator.writeMemory(address + i, &byte, 1);
+				}
+			}
+
+			return (command == 'm') ? reply : "OK";
+		}
+		else if (command == 'c' || command == 's')
+		{
+			if (!arguments.empty())
+				hart.cpu.pc = stoul(arguments, nullptr, 16);
+
+			return resume(command == 's');
+		}
+		else if (command == 'Z' || command == 'z')
+		{
+			/* Z type,address,kind: 0 and 1 are breakpoints, 2 to 4 watchpoints of kind bytes */
+			if (arguments.size() < 3 || arguments[1] != ',' || arguments.find(',', 2) == string::npos)
+				return "E01";
+
+			int type = arguments[0] - '0';
+			size_t comma = arguments.find(',', 2);
+			uint32_t address = stoul(arguments.substr(2, comma - 2), nullptr, 16);
+			uint32_t kind = stoul(arguments.substr(comma + 1), nullptr, 16);
+			bool done;
+
+			if (type == 0 || type == 1)
+				done = (command == 'Z') ? simulator.insertBreakpoint(address) : simulator.removeBreakpoint(address);
+			else if (type >= 2 && type <= 4)
+			{
+				if (command == 'Z')
+					simulator.insertWatchpoint(address, kind, type);
+
+				done = command == 'Z' || simulator.removeWatchpoint(address, kind, type);
+				hart.window = MemoryRegion();
+			}
+			else
+				return "";
+
+			return done ? "OK" : "E01";
+		}
+		else if (packet.compare(0, 10, "qSupported") == 0)
+			return "PacketSize=4000;QStartNoAckMode+";
+		else if (packet == "QStartNoAckMode" || command == 'H' || command == 'T' || command == 'D')
+			return "OK";
+		else if (packet == "qAttached")
+			return "1";
+		else if (packet.compare(0, 6, "qRcmd,") == 0)
+		{
+			string command_text;
+
+			for (size_t i = 6; i + 1 < packet.size(); i += 2)
+				command_text += (char)stoul(packet.substr(i, 2), nullptr, 16);
+
+			return monitor(command_text);
+		}
+
+		return "";
+	}
+};
+
+/* Loads a program and debugs it with GDB connected to a port of localhost */
+int debugProgram(string filename, int port)
+{
+	Simulator simulator;
+
+	if (!simulator.load(filename))
+	{
+		std::cerr << filename << ": cannot load the program" << endl;
+		return 1;
+	}
+
+	GdbStub stub(simulator);
+
+	return stub.serve(port);
+}
+
+/* A set-associative cache with LRU replacement, for the timing model */
+class CacheModel
+{
+
+public:
+	uint64_t accesses = 0;
+	uint64_t misses = 0;
+
+	CacheModel(uint32_t size, uint32_t ways, uint32_t line)
+		: ways(ways), line_shift(__builtin_ctz(line)), sets(size / line / ways), tags(size / line, ~0u)
+	{
+	}
+
+	/* Looks up the line of an address, bringing it in on a miss. Returns true on a hit */
+	bool access(uint32_t address)
+	{
+		uint32_t line = address >> line_shift;
+		uint32_t *set = &tags[(line % sets) * ways];
+
+		accesses++;
+
+		for (uint32_t way = 0; way < ways; way++)
+		{
+			if (set[way] == line)
+			{
+				std::rotate(set, set + way, set + way + 1);
+				return true;
+			}
+		}
+
+		/* The least recently used line, at the back, is replaced */
+		misses++;
+		std::rotate(set, set + ways - 1, set + ways);
+		set[0] = line;
+		return false;
+	}
+
+private:
+	uint32_t ways;
+	uint32_t line_shift;
+	uint32_t sets;
+	vector<uint32_t> tags; //Lines of each set, most recently used first
+};
+
+/* Statistics of the timing model over a stretch of execution */
+struct TimingStatistics
+{
+	uint64_t cycles = 0;
+	uint64_t instructions = 0;
+	uint64_t icache_accesses = 0;
+	uint64_t icache_misses = 0;
+	uint64_t dcache_accesses = 0;
+	uint64_t dcache_misses = 0;
+
+	double cpi() const { return instructions ? (double)cycles / instructions : 0; }
+	double icacheMissRate() const { return icache_accesses ? (double)icache_misses / icache_accesses : 0; }
+	double dcacheMissRate() const { return dcache_accesses ? (double)dcache_misses / dcache_accesses : 0; }
+
+	TimingStatistics &operator+=(const TimingStatistics &other)
+	{
+		cycles += other.cycles;
+		instructions += other.instructions;
+		icache_accesses += other.icache_accesses;
+		icache_misses += other.icache_misses;
+		dcache_accesses += other.dcache_accesses;
+		dcache_misses += other.dcache_misses;
+		return *this;
+	}
+};
+
+/* Timing model of the detailed mode: a scalar in-order pipeline without delay slots, with 32 KB 4-way
+   instruction and data caches of 32-byte lines. An instruction takes one cycle, plus the miss penalty
+   on cache misses, one cycle when it uses the result of the load just before it, one cycle after a
+   taken branch or jump, and the latency of the multiply and divide unit or of the FPU */
+class TimingModel
+{
+
+public:
+	static const uint32_t miss_penalty = 20;
+	static const uint32_t multiply_latency = 3;
+	static const uint32_t divide_latency = 34;
+	static const uint32_t float_latency = 3;		   //Additions, multiplications and conversions
+	static const uint32_t float_divide_latency = 16; //Divisions and square roots
+
+	CacheModel icache{32 << 10, 4, 32};
+	CacheModel dcache{32 << 10, 4, 32};
+	uint64_t cycles = 0;
+	uint64_t instructions = 0;
+
+	~TimingModel()
+	{
+		publish();
+	}
+
+	/* Clears the statistics, keeping the contents of the caches */
+	void resetStatistics()
+	{
+		publish();
+		published = TimingStatistics();
+		cycles = instructions = 0;
+		icache.accesses = icache.misses = 0;
+		dcache.accesses = dcache.misses = 0;
+	}
+
+	TimingStatistics statistics() const
+	{
+		TimingStatistics result;
+
+		result.cycles = cycles;
+		result.instructions = instructions;
+		result.icache_accesses = icache.accesses;
+		result.icache_misses = icache.misses;
+		result.dcache_accesses = dcache.accesses;
+		result.dcache_misses = dcache.misses;
+		return result;
+	}
+
+	/* Accounts for an instruction that ran at pc, went on to next_pc and accessed address if it is a
+	   load or a store */
+	void retire(uint32_t word, uint32_t pc, uint32_t next_pc, uint32_t address)
+	{
+		uint32_t opcode = word >> 26;
+		uint32_t funct = word & 63;
+		uint32_t rs = (word >> 21) & 31;
+		uint32_t rt = (word >> 16) & 31;
+		bool load = (opcode >= 0x20 && opcode <= 0x26) || opcode == 0x30;
+		bool store = (opcode >= 0x28 && opcode <= 0x2e) || opcode == 0x38;
+		bool float_access = opcode == 0x31 || opcode == 0x35 || opcode == 0x39 || opcode == 0x3d;
+
+		instructions++;
+		cycles++;
+
+		if (!icache.access(pc))
+			cycles += miss_penalty;
+
+		if (loaded != 0 && opcode != 0x02 && opcode != 0x03 && (rs == loaded || rt == loaded))
+			cycles++;
+
+		loaded = load ? rt : 0;
+
+		if ((load || store || float_access) && !dcache.access(address))
+			cycles += miss_penalty;
+
+		if (next_pc != pc + 4)
+			cycles++;
+
+		if ((opcode == 0x00 && (funct == 0x18 || funct == 0x19)) || (opcode == 0x1c && funct <= 0x05))
+			cycles += multiply_latency;
+		else if (opcode == 0x00 && (funct == 0x1a || funct == 0x1b))
+			cycles += divide_latency;
+		else if (opcode == 0x11 && rs >= 0x10 && (funct == 0x03 || funct == 0x04))
+			cycles += float_divide_latency;
+		else if (opcode == 0x11 && rs >= 0x10 && funct < 0x30 && (funct < 0x05 || funct > 0x07))
+			cycles += float_latency;
+	}
 
-			/* Assembling the instructions */
-			vector<string> tokens;			 //Vector to store the tokens
-			stringstream ss(formatted_line); //Change formatted_line into a stringstream
-			string intermediate;			 //Intermediate string variable to hold the tokens
+private:
+	uint32_t loaded = 0;			//Register loaded by the last instruction, 0 for none
+	TimingStatistics published; //Statistics already added to the counters
 
-			/* Tokenize the line */
-			while (getline(ss, intermediate, ' '))
-			{
+	/* Adds the cache accesses and misses since the last call to the counters */
+	void publish()
+	{
+		TimingStatistics current = statistics();
+		CounterSlot *slot = metrics.slot();
+
+		slot->add(COUNT_ICACHE_ACCESSES, current.icache_accesses - published.icache_accesses);
+		slot->add(COUNT_ICACHE_MISSES, current.icache_misses - published.icache_misses);
+		slot->add(COUNT_DCACHE_ACCESSES, current.dcache_accesses - published.dcache_accesses);
+		slot->add(COUNT_DCACHE_MISSES, current.dcache_misses - published.dcache_misses);
+		published = current;
+	}
+};
 
-				if (!intermediate.empty())
-				{
-					/* Remove the commas at the end and store them in the tokens vector */
-					if (intermediate.back() == ',')
-					{
+/* Random projection of a basic block vector to a few dimensions, as SimPoint does. The coordinates of
+   a block come from a generator seeded with its address, so the projection needs no matrix */
+vector<double> projectBlocks(const std::unordered_map<uint32_t, uint64_t> &counts, uint64_t instructions)
+{
+	vector<double> point(15, 0.0);
 
-						tokens.push_back(intermediate.substr(0, intermediate.size() - 1));
-					}
-					else
-						tokens.push_back(intermediate);
-				}
-			}
+	for (auto &elem : counts)
+	{
+		std::minstd_rand random(elem.first + 1);
+		std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+		double frequency = (double)elem.second / instructions;
 
-			map<string, string>::iterator it;
+		for (auto &coordinate : point)
+			coordinate += frequency * uniform(random);
+	}
 
-			if (tokens[0] == "add")
-			{
+	return point;
+}
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], tokens[2], tokens[3], "0", it->second) << endl;
-			}
-			else if (tokens[0] == "addu")
-			{
+double squaredDistance(const vector<double> &a, const vector<double> &b)
+{
+	double sum = 0;
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], tokens[2], tokens[3], "0", it->second) << endl;
-			}
-			else if (tokens[0] == "addi")
-			{
+	for (size_t i = 0; i < a.size(); i++)
+		sum += (a[i] - b[i]) * (a[i] - b[i]);
 
-				it = I_Instructions.find(tokens[0]);
-				result << makeI_type(tokens[0], it->second, tokens[2], tokens[1], tokens[3]) << endl;
-			}
-			else if (tokens[0] == "addiu")
-			{
+	return sum;
+}
 
-				it = I_Instructions.find(tokens[0]);
-				result << makeI_type(tokens[0], it->second, tokens[2], tokens[1], tokens[3]) << endl;
-			}
-			else if (tokens[0] == "and")
-			{
+/* k-means clustering seeded with k-means++. Returns the cluster of each point */
+vector<int> kmeans(const vector<vector<double>> &points, int k, vector<vector<double>> &centroids)
+{
+	std::mt19937 random(1);
+	vector<int> clusters(points.size(), -1);
+	vector<double> distances(points.size());
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], tokens[2], tokens[3], "0", it->second) << endl;
-			}
-			else if (tokens[0] == "andi")
-			{
+	centroids.assign(1, points[random() % points.size()]);
 
-				it = I_Instructions.find(tokens[0]);
-				result << makeI_type(tokens[0], it->second, tokens[2], tokens[1], tokens[3]) << endl;
-			}
-			else if (tokens[0] == "clo")
-			{
+	while ((int)centroids.size() < k)
+	{
+		for (size_t i = 0; i < points.size(); i++)
+		{
+			distances[i] = std::numeric_limits<double>::max();
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], tokens[2], "", "0", it->second) << endl;
-			}
-			else if (tokens[0] == "clz")
-			{
+			for (auto &centroid : centroids)
+				distances[i] = std::min(distances[i], squaredDistance(points[i], centroid));
+		}
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], tokens[2], "", "0", it->second) << endl;
-			}
-			else if (tokens[0] == "div")
-			{
+		std::discrete_distribution<size_t> pick(distances.begin(), distances.end());
+		centroids.push_back(points[pick(random)]);
+	}
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second) << endl;
-			}
-			else if (tokens[0] == "divu")
-			{
+	for (int iteration = 0; iteration < 100; iteration++)
+	{
+		bool changed = false;
+
+		for (size_t i = 0; i < points.size(); i++)
+		{
+			int nearest = 0;
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second) << endl;
+			for (int c = 1; c < k; c++)
+			{
+				if (squaredDistance(points[i], centroids[c]) < squaredDistance(points[i], centroids[nearest]))
+					nearest = c;
 			}
-			else if (tokens[0] == "mult")
+
+			changed |= clusters[i] != nearest;
+			clusters[i] = nearest;
+		}
+
+		if (!changed)
+			break;
+
+		vector<int> sizes(k, 0);
+
+		for (auto &centroid : centroids)
+			centroid.assign(centroid.size(), 0.0);
+
+		for (size_t i = 0; i < points.size(); i++)
+		{
+			sizes[clusters[i]]++;
+
+			for (size_t d = 0; d < points[i].size(); d++)
+				centroids[clusters[i]][d] += points[i][d];
+		}
+
+		for (int c = 0; c < k; c++)
+		{
+			for (auto &coordinate : centroids[c])
+				coordinate /= std::max(sizes[c], 1);
+		}
+	}
+
+	return clusters;
+}
+
+/* SimPoint-style sampled simulation of a program on one hart. A functional pass collects the basic block
+   vector of each interval of interval_length instructions, the intervals are clustered and two of each
+   cluster are picked: the one nearest to its centroid, which stands for the cluster, and one more to
+   estimate the spread of the cluster. A second pass fast-forwards functionally and runs the picked
+   intervals in detailed mode, each after a detailed warm-up interval. The whole-program CPI and miss
+   rates are the means of the representatives weighted by cluster size, with 95% bounds from the spread
+   of each cluster as in stratified sampling. validate also runs the whole program in detailed mode */
+int simpoint(string filename, uint64_t interval_length, int cluster_count, bool validate)
+{
+	auto now = []()
+	{ return std::chrono::steady_clock::now(); };
+	auto elapsed = [](std::chrono::steady_clock::time_point start)
+	{ return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); };
+
+	/* Functional pass collecting the basic block vectors */
+	auto start = now();
+	Simulator profiled;
+	Hart hart;
+	BlockProfiler profiler;
+	vector<vector<double>> points;
+
+	profiled.console = false;
+
+	if (!profiled.load(filename))
+	{
+		std::cerr << filename << ": cannot load the program" << endl;
+		return 1;
+	}
+
+	profiled.setupHart(hart, 0, 1);
+	profiler.block = hart.cpu.pc;
+
+	while (hart.running && !profiled.stopped)
+	{
+		uint64_t first = hart.retired;
+
+		profiler.clear();
+		hart.execute(first + interval_length, &profiler);
+		profiler.flush(hart.retired);
+
+		if (hart.retired > first)
+			points.push_back(projectBlocks(profiler.counts, hart.retired - first));
+	}
+
+	double profile_seconds = elapsed(start);
+	size_t interval_count = points.size();
+
+	if (interval_count == 0)
+	{
+		std::cerr << filename << ": the program ran no instructions" << endl;
+		return 1;
+	}
+
+	/* Clusters, and the intervals picked in each */
+	int k = std::min<size_t>(std::max(cluster_count, 1), interval_count);
+	vector<vector<double>> centroids;
+	vector<int> clusters = kmeans(points, k, centroids);
+	vector<vector<size_t>> members(k);
+	vector<vector<size_t>> picked(k);
+
+	for (size_t i = 0; i < interval_count; i++)
+		members[clusters[i]].push_back(i);
+
+	for (int c = 0; c < k; c++)
+	{
+		if (members[c].empty())
+			continue;
+
+		auto nearest = std::min_element(members[c].begin(), members[c].end(), [&](size_t a, size_t b)
+										{ return squaredDistance(points[a], centroids[c]) < squaredDistance(points[b], centroids[c]); });
+
+		picked[c].push_back(*nearest);
+
+		if (members[c].size() > 1)
+		{
+			std::mt19937 random(c);
+			size_t other;
+
+			do
+				other = members[c][random() % members[c].size()];
+			while (other == *nearest);
+
+			picked[c].push_back(other);
+		}
+	}
+
+	/* Sampled pass: 0 runs an interval functionally, 1 warms the caches up in detailed mode, 2 measures it */
+	vector<int> roles(interval_count, 0);
+	vector<TimingStatistics> measured(interval_count);
+	size_t detailed_count = 0;
+
+	for (auto &cluster : picked)
+	{
+		for (size_t i : cluster)
+		{
+			roles[i] = 2;
+
+			if (i > 0 && roles[i - 1] == 0)
+				roles[i - 1] = 1;
+		}
+	}
+
+	start = now();
+	Simulator sampled;
+	Hart sampled_hart;
+	TimingModel timing;
+
+	sampled.console = false;
+	sampled.load(filename);
+	sampled.setupHart(sampled_hart, 0, 1);
+
+	for (size_t i = 0; i < interval_count && sampled_hart.running && !sampled.stopped; i++)
+	{
+		uint64_t end = (i + 1) * interval_length;
+
+		if (roles[i] == 0)
+			sampled_hart.execute(end);
+		else
+		{
+			timing.resetStatistics();
+			sampled_hart.observe(end, timing);
+			measured[i] = timing.statistics();
+			detailed_count += roles[i] == 2;
+		}
+	}
+
+	double sampled_seconds = elapsed(start);
+
+	/* Estimates of the representatives weighted by cluster size, with the variance of stratified sampling */
+	auto estimate = [&](std::function<double(const TimingStatistics &)> metric, double &bound)
+	{
+		double value = 0;
+		double variance = 0;
+
+		for (int c = 0; c < k; c++)
+		{
+			if (picked[c].empty())
+				continue;
+
+			double weight = (double)members[c].size() / interval_count;
+			double n = picked[c].size();
+
+			value += weight * metric(measured[picked[c][0]]);
+
+			if (picked[c].size() > 1)
 			{
+				double mean = 0;
+				double spread = 0;
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second) << endl;
+				for (size_t i : picked[c])
+					mean += metric(measured[i]) / n;
+
+				for (size_t i : picked[c])
+					spread += (metric(measured[i]) - mean) * (metric(measured[i]) - mean) / (n - 1);
+
+				variance += weight * weight * (1 - n / members[c].size()) * spread / n;
 			}
-			else if (tokens[0] == "multu")
+		}
+
+		bound = 1.96 * sqrt(variance);
+		return value;
+	};
+
+	/* Miss rates are ratios of the per-instruction misses and accesses, as intervals differ in accesses */
+	auto perInstruction = [](uint64_t TimingStatistics::*field)
+	{
+		return [field](const TimingStatistics &s)
+		{ return s.instructions ? (double)(s.*field) / s.instructions : 0; };
+	};
+
+	double cpi_bound;
+	double icache_bound;
+	double dcache_bound;
+	double unused;
+	double cpi = estimate([](const TimingStatistics &s)
+						  { return s.cpi(); },
+						  cpi_bound);
+	double icache_accesses = estimate(perInstruction(&TimingStatistics::icache_accesses), unused);
+	double dcache_accesses = estimate(perInstruction(&TimingStatistics::dcache_accesses), unused);
+	double icache_rate = estimate(perInstruction(&TimingStatistics::icache_misses), icache_bound) / icache_accesses;
+	double dcache_rate = dcache_accesses ? estimate(perInstruction(&TimingStatistics::dcache_misses), dcache_bound) / dcache_accesses : 0;
+
+	icache_bound /= icache_accesses;
+	dcache_bound = dcache_accesses ? dcache_bound / dcache_accesses : 0;
+
+	cout << interval_count << " intervals of " << interval_length << " instructions in " << k << " clusters, "
+		 << detailed_count << " simulated in detail" << endl;
+	cout << "CPI: " << cpi << " +/- " << cpi_bound << " (95%)" << endl;
+	cout << "I-cache miss rate: " << icache_rate * 100 << "% +/- " << icache_bound * 100 << "%" << endl;
+	cout << "D-cache miss rate: " << dcache_rate * 100 << "% +/- " << dcache_bound * 100 << "%" << endl;
+	cout << "Profiling pass: " << profile_seconds << " s, sampled pass: " << sampled_seconds << " s" << endl;
+
+	if (validate)
+	{
+		start = now();
+		Simulator full;
+		Hart full_hart;
+		TimingModel full_timing;
+
+		full.console = false;
+		full.load(filename);
+		full.setupHart(full_hart, 0, 1);
+		full_hart.observe(UINT64_MAX, full_timing);
+
+		TimingStatistics total = full_timing.statistics();
+
+		cout << "Full detailed run: CPI " << total.cpi() << " (error " << (cpi - total.cpi()) / total.cpi() * 100
+			 << "%), I-cache miss rate " << total.icacheMissRate() * 100 << "%, D-cache miss rate "
+			 << total.dcacheMissRate() * 100 << "%, " << elapsed(start) << " s" << endl;
+	}
+
+	return 0;
+}
+
+/* State of a single-hart program at an interval boundary. Memory is kept as the pages written since
+   the previous checkpoint, so a checkpoint is restored by loading the program and applying the pages
+   of every checkpoint up to it */
+struct Checkpoint
+{
+	Processor cpu;
+	uint64_t retired = 0;
+	bool running = true;
+	uint32_t reserved_address = 1;
+	uint32_t reserved_value = 0;
+	uint32_t heap_break = 0;
+	uint32_t heap_end = 0;
+	vector<uint32_t> pages; //Guest addresses of the pages written
+	vector<uint8_t> data;	//Their contents, one page after another
+};
+
+/* Records which guest pages are written between checkpoints. The guest memory is write-protected and
+   the first write to a page faults into a SIGSEGV handler, which marks the page and lifts the protection,
+   so the stores of the interpreter stay plain host stores. One tracker is active at a time */
+class DirtyTracker
+{
+
+public:
+	DirtyTracker(GuestMemory &memory) : memory(memory)
+	{
+		struct sigaction action = {};
+
+		page_size = sysconf(_SC_PAGESIZE);
+
+		for (auto &elem : memory.mapped())
+		{
+			const MemoryRegion &region = elem.second;
+
+			ranges.push_back({region.address, region.host, region.length, vector<uint8_t>(region.length / page_size, 0)});
+		}
+
+		action.sa_sigaction = handler;
+		action.sa_flags = SA_SIGINFO;
+		sigemptyset(&action.sa_mask);
+		active = this;
+		sigaction(SIGSEGV, &action, &previous);
+
+		for (auto &range : ranges)
+			mprotect(range.host, range.length, PROT_READ);
+	}
+
+	DirtyTracker(const DirtyTracker &) = delete;
+	DirtyTracker &operator=(const DirtyTracker &) = delete;
+
+	~DirtyTracker()
+	{
+		for (auto &range : ranges)
+			mprotect(range.host, range.length, PROT_READ | PROT_WRITE);
+
+		sigaction(SIGSEGV, &previous, nullptr);
+		active = nullptr;
+		PageGuard::restore(memory);
+	}
+
+	/* Copies the pages written since the last call into a checkpoint and protects them again */
+	void collect(Checkpoint &checkpoint)
+	{
+		for (auto &range : ranges)
+		{
+			for (size_t page = 0; page < range.dirty.size(); page++)
 			{
+				if (range.dirty[page] == 0)
+					continue;
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second) << endl;
+				uint8_t *host = range.host + page * page_size;
+
+				checkpoint.pages.push_back(range.address + page * page_size);
+				checkpoint.data.insert(checkpoint.data.end(), host, host + page_size);
+				range.dirty[page] = 0;
+				mprotect(host, page_size, PROT_READ);
 			}
-			else if (tokens[0] == "mul")
+		}
+	}
+
+private:
+	struct Range
+	{
+		uint32_t address; //Guest address of the first byte
+		uint8_t *host;
+		size_t length;
+		vector<uint8_t> dirty; //Whether each page was written
+	};
+
+	GuestMemory &memory;
+	vector<Range> ranges;
+	size_t page_size;
+
+	static DirtyTracker *active;
+	static struct sigaction previous; //Handler to fall back on for faults outside the guest memory
+
+	static void handler(int signal, siginfo_t *info, void *context)
+	{
+		uint8_t *address = (uint8_t *)info->si_addr;
+
+		if (active != nullptr)
+		{
+			for (auto &range : active->ranges)
 			{
+				if ((uintptr_t)address - (uintptr_t)range.host >= range.length)
+					continue;
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], tokens[2], tokens[3], "0", it->second) << endl;
+				size_t page = ((uintptr_t)address - (uintptr_t)range.host) / active->page_size;
+
+				/* The page guard sees the write too, in case it is to code */
+				range.dirty[page] = 1;
+				PageGuard::handle(address);
+				mprotect(range.host + page * active->page_size, active->page_size, PROT_READ | PROT_WRITE);
+				return;
 			}
-			else if (tokens[0] == "madd")
-			{
+		}
+
+		/* A genuine fault: the access is retried under the previous handler, usually the default one */
+		sigaction(SIGSEGV, &previous, nullptr);
+	}
+};
+
+DirtyTracker *DirtyTracker::active = nullptr;
+struct sigaction DirtyTracker::previous;
+
+/* Brings a freshly loaded simulator and its hart to the state of a checkpoint. The pages are written
+   through the simulator, which unprotects the pages of code for the copy and decodes them again */
+void restoreCheckpoint(Simulator &simulator, Hart &hart, const vector<Checkpoint> &checkpoints, size_t index)
+{
+	uint32_t page_size = sysconf(_SC_PAGESIZE);
+	const Checkpoint &target = checkpoints[index];
+
+	for (size_t i = 1; i <= index; i++)
+	{
+		const Checkpoint &checkpoint = checkpoints[i];
+
+		for (size_t page = 0; page < checkpoint.pages.size(); page++)
+		{
+			uint32_t address = checkpoint.pages[page];
+
+			simulator.writeMemory(address, &checkpoint.data[page * page_size], page_size);
+		}
+	}
+
+	simulator.setupHart(hart, 0, 1);
+	hart.cpu = target.cpu;
+	hart.retired = target.retired;
+	hart.running = target.running;
+	hart.reserved_address = target.reserved_address;
+	hart.reserved_value = target.reserved_value;
+	simulator.heap_break = target.heap_break;
+	simulator.heap_end = target.heap_end;
+}
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second) << endl;
+/* Detailed simulation of a program on one hart, spread over host threads. A functional pass drops a
+   checkpoint every interval_length instructions; then each thread takes a run of consecutive intervals,
+   restores the checkpoint before the first one, warms its caches up on that interval and simulates its
+   intervals in detail. The statistics of the intervals are added up in program order. validate also
+   runs the whole program in detail on one thread, to compare */
+int parallelSimulation(string filename, uint64_t interval_length, int thread_count, bool validate)
+{
+	auto now = []()
+	{ return std::chrono::steady_clock::now(); };
+	auto elapsed = [](std::chrono::steady_clock::time_point start)
+	{ return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); };
+
+	/* Functional pass dropping the checkpoints */
+	auto start = now();
+	Simulator functional;
+	Hart hart;
+	vector<Checkpoint> checkpoints;
+	size_t page_count = 0;
+
+	functional.console = false;
+
+	if (!functional.load(filename))
+	{
+		std::cerr << filename << ": cannot load the program" << endl;
+		return 1;
+	}
+
+	functional.setupHart(hart, 0, 1);
+
+	auto capture = [&]()
+	{
+		Checkpoint checkpoint;
+
+		checkpoint.cpu = hart.cpu;
+		checkpoint.retired = hart.retired;
+		checkpoint.running = hart.running;
+		checkpoint.reserved_address = hart.reserved_address;
+		checkpoint.reserved_value = hart.reserved_value;
+		checkpoint.heap_break = functional.heap_break;
+		checkpoint.heap_end = functional.heap_end;
+		return checkpoint;
+	};
+
+	checkpoints.push_back(capture());
+
+	{
+		DirtyTracker tracker(functional.memory);
+
+		while (hart.running && !functional.stopped)
+		{
+			hart.execute(hart.retired + interval_length);
+			checkpoints.push_back(capture());
+			tracker.collect(checkpoints.back());
+			page_count += checkpoints.back().pages.size();
+		}
+	}
+
+	double functional_seconds = elapsed(start);
+	size_t interval_count = checkpoints.size() - 1;
+
+	if (interval_count == 0 || hart.retired == 0)
+	{
+		std::cerr << filename << ": the program ran no instructions" << endl;
+		return 1;
+	}
+
+	/* Detailed pass, one run of intervals per thread */
+	size_t chunk_count = std::min<size_t>(std::max(thread_count, 1), interval_count);
+	vector<TimingStatistics> measured(interval_count);
+	vector<std::thread> threads;
+	std::atomic<int> diverged{0};
+
+	start = now();
+
+	for (size_t chunk = 0; chunk < chunk_count; chunk++)
+	{
+		size_t first = interval_count * chunk / chunk_count;
+		size_t last = interval_count * (chunk + 1) / chunk_count;
+
+		threads.emplace_back([&, first, last]()
+							 {
+			Simulator simulator;
+			Hart worker;
+			TimingModel timing;
+
+			simulator.console = false;
+
+			if (!simulator.load(filename))
+			{
+				diverged++;
+				return;
 			}
-			else if (tokens[0] == "msub")
+
+			restoreCheckpoint(simulator, worker, checkpoints, first > 0 ? first - 1 : 0);
+
+			if (first > 0)
+				worker.observe(checkpoints[first].retired, timing);
+
+			for (size_t i = first; i < last; i++)
 			{
+				timing.resetStatistics();
+				worker.observe(checkpoints[i + 1].retired, timing);
+				measured[i] = timing.statistics();
+			}
+
+			/* The run must end where the functional pass saw it end */
+			if (worker.retired != checkpoints[last].retired || worker.cpu.pc != checkpoints[last].cpu.pc)
+				diverged++; });
+	}
+
+	for (auto &thread : threads)
+		thread.join();
+
+	double detailed_seconds = elapsed(start);
+	TimingStatistics total;
+
+	for (auto &statistics : measured)
+		total += statistics;
+
+	if (diverged != 0)
+		std::cerr << filename << ": " << diverged << " threads did not follow the functional pass" << endl;
+
+	cout << interval_count << " intervals of " << interval_length << " instructions, " << page_count << " pages ("
+		 << page_count * sysconf(_SC_PAGESIZE) / 1024 << " KB) in the checkpoints" << endl;
+	cout << "Cycles: " << total.cycles << ", instructions: " << total.instructions << ", CPI: " << total.cpi() << endl;
+	cout << "I-cache miss rate: " << total.icacheMissRate() * 100 << "%, D-cache miss rate: " << total.dcacheMissRate() * 100
+		 << "%" << endl;
+	cout << "Functional pass: " << functional_seconds << " s, detailed pass on " << chunk_count << " threads: "
+		 << detailed_seconds << " s" << endl;
+
+	if (validate)
+	{
+		start = now();
+		Simulator full;
+		Hart full_hart;
+		TimingModel full_timing;
+
+		full.console = false;
+		full.load(filename);
+		full.setupHart(full_hart, 0, 1);
+		full_hart.observe(UINT64_MAX, full_timing);
+
+		TimingStatistics sequential = full_timing.statistics();
+		double seconds = elapsed(start);
+
+		cout << "Sequential detailed run: " << sequential.cycles << " cycles, CPI " << sequential.cpi() << " (error "
+			 << ((double)total.cycles - sequential.cycles) / sequential.cycles * 100 << "%), " << seconds << " s, "
+			 << "speedup " << seconds / (functional_seconds + detailed_seconds) << "x" << endl;
+	}
+
+	return diverged != 0;
+}
+
+/* Parameters of a synthetic MIPS program for the benchmarks */
+struct WorkloadParameters
+{
+	int instructions = 100000;
+	double label_density = 0.05; //Labels per instruction
+	double branch_ratio = 0.1;	 //Fraction of the instructions that are branches or jumps
+	int data_words = 1024;		 //Size of the .data segment in words
+	unsigned seed = 1;
+};
+
+/* Generates a random but valid program with the given shape */
+string generateWorkload(WorkloadParameters &parameters)
+{
+	std::mt19937 random(parameters.seed);
+	std::uniform_real_distribution<double> chance(0.0, 1.0);
+	vector<string> names;
+	string source = ".data\n";
+
+	for (auto &elem : registers)
+	{
+		if (elem.first != "$zero" && elem.first != "$at" && elem.first != "$k0" && elem.first != "$k1")
+			names.push_back(elem.first);
+	}
+
+	auto reg = [&]()
+	{ return names[random() % names.size()]; };
+
+	/* .data, eight words per declaration and a string every few lines */
+	for (int i = 0; i < parameters.data_words; i += 8)
+	{
+		source += "DATA" + to_string(i) + ": .word";
+
+		for (int j = i; j < std::min(i + 8, parameters.data_words); j++)
+			source += (j == i ? " " : ", ") + to_string(random() % 1000);
+
+		source += "\n";
+
+		if (i % 64 == 0)
+			source += "STR" + to_string(i) + ": .asciiz \"hello, world\\n\"\n";
+	}
+
+	source += ".text\n";
+
+	int label_count = std::max(1, (int)(parameters.instructions * parameters.label_density));
+
+	for (int i = 0; i < parameters.instructions; i++)
+	{
+		/* Labels are spread evenly so that every branch target exists */
+		if ((long long)i * label_count / parameters.instructions != ((long long)i + 1) * label_count / parameters.instructions || i == 0)
+			source += "L" + to_string((long long)i * label_count / parameters.instructions) + ":\n";
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second) << endl;
-			}
-			else if (tokens[0] == "maddu")
-			{
+		string target = "L" + to_string(random() % label_count);
+		string instruction;
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second) << endl;
-			}
-			else if (tokens[0] == "msubu")
+		if (chance(random) < parameters.branch_ratio)
+		{
+			switch (random() % 4)
 			{
-
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second) << endl;
+			case 0:
+				instruction = "beq " + reg() + ", " + reg() + ", " + target;
+				break;
+			case 1:
+				instruction = "bne " + reg() + ", " + reg() + ", " + target;
+				break;
+			case 2:
+				instruction = "bgez " + reg() + ", " + target;
+				break;
+			default:
+				instruction = "j " + target;
 			}
-			else if (tokens[0] == "nor")
+		}
+		else
+		{
+			switch (random() % 6)
 			{
-
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], tokens[2], tokens[3], "0", it->second) << endl;
+			case 0:
+				instruction = "addu " + reg() + ", " + reg() + ", " + reg();
+				break;
+			case 1:
+				instruction = "addi " + reg() + ", " + reg() + ", " + to_string((int)(random() % 200) - 100);
+				break;
+			case 2:
+				instruction = "lw " + reg() + ", " + to_string(random() % 64 * 4) + "(" + reg() + ")";
+				break;
+			case 3:
+				instruction = "sw " + reg() + ", " + to_string(random() % 64 * 4) + "(" + reg() + ")";
+				break;
+			case 4:
+				instruction = "sll " + reg() + ", " + reg() + ", " + to_string(random() % 32);
+				break;
+			default:
+				instruction = "lui " + reg() + ", " + to_string(random() % 65536);
 			}
-			else if (tokens[0] == "or")
-			{
+		}
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], tokens[2], tokens[3], "0", it->second) << endl;
-			}
-			else if (tokens[0] == "ori")
-			{
+		source += "\t" + instruction + ((i % 8 == 0) ? " # comment\n" : "\n");
+	}
 
-				it = I_Instructions.find(tokens[0]);
-				result << makeI_type(tokens[0], it->second, tokens[2], tokens[1], tokens[3]) << endl;
-			}
-			else if (tokens[0] == "sll")
-			{
+	return source;
+}
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], "", tokens[2], tokens[3], it->second) << endl;
-			}
-			else if (tokens[0] == "sllv")
-			{
+/* Times each assembling stage over a generated program and writes the results as JSON */
+int benchmark(WorkloadParameters &parameters, int repeat, string output)
+{
+	string source = generateWorkload(parameters);
+	map<string, double> best;
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], tokens[3], tokens[2], "0", it->second) << endl;
-			}
-			else if (tokens[0] == "sra")
-			{
+	auto measure = [&](string stage, std::function<void()> function)
+	{
+		for (int i = 0; i < repeat; i++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			function();
+			auto end = std::chrono::steady_clock::now();
+			double seconds = std::chrono::duration<double>(end - start).count();
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], "", tokens[2], tokens[3], it->second) << endl;
-			}
-			else if (tokens[0] == "srav")
-			{
+			if (best.count(stage) == 0 || seconds < best[stage])
+				best[stage] = seconds;
+		}
+	};
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], tokens[3], tokens[2], "0", it->second) << endl;
-			}
-			else if (tokens[0] == "srl")
-			{
+	string no_comments;
+	measure("removeComments", [&]()
+			{ removeComments(source, no_comments); });
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], "", tokens[2], tokens[3], it->second) << endl;
-			}
-			else if (tokens[0] == "srlv")
-			{
+	Image image;
+	measure("firstParse", [&]()
+			{ firstParse(no_comments, image); });
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], tokens[3], tokens[2], "0", it->second) << endl;
-			}
-			else if (tokens[0] == "sub")
-			{
+	measure("secondParse", [&]()
+			{ secondParse(no_comments, image); });
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], tokens[2], tokens[3], "0", it->second) << endl;
-			}
-			else if (tokens[0] == "subu")
-			{
+	/* Encoding alone, on instructions that are already tokenized */
+	vector<vector<string>> instructions;
+	const SymbolTable &symbols = image.program.symbols;
+	stringstream is(no_comments);
+	string line;
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], tokens[3], tokens[2], "0", it->second) << endl;
-			}
-			else if (tokens[0] == "xor")
-			{
+	while (getline(is, line) && trim(line) != ".text")
+		;
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], tokens[2], tokens[3], "0", it->second) << endl;
-			}
-			else if (tokens[0] == "xori")
-			{
+	while (getline(is, line))
+	{
+		string formatted_line = trim(line);
 
-				it = I_Instructions.find(tokens[0]);
-				result << makeI_type(tokens[0], it->second, tokens[2], tokens[1], tokens[3]) << endl;
-			}
-			else if (tokens[0] == "lui")
-			{
+		if (!formatted_line.empty() && formatted_line.find(':') == string::npos)
+		{
+			for (auto &tokens : expandPseudoInstruction(tokenize(formatted_line)))
+				instructions.push_back(tokens);
+		}
+	}
 
-				it = I_Instructions.find(tokens[0]);
-				result << makeI_type(tokens[0], it->second, "00000", tokens[1], tokens[2]) << endl;
-			}
-			else if (tokens[0] == "slt")
+	measure("encoding", [&]()
 			{
+				uint32_t code;
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], tokens[2], tokens[3], "0", it->second) << endl;
-			}
-			else if (tokens[0] == "sltu")
-			{
+				for (size_t i = 0; i < instructions.size(); i++)
+					encodeWord(instructions[i], i, symbols, code); });
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], tokens[2], tokens[3], "0", it->second) << endl;
-			}
-			else if (tokens[0] == "slti")
-			{
+	/* Disassembly of the whole image into a preallocated buffer */
+	Assembler assembler;
+	Disassembler disassembler;
+	const ProgramIR &program = assembler.assemble(source).program;
 
-				it = I_Instructions.find(tokens[0]);
-				result << makeI_type(tokens[0], it->second, tokens[2], tokens[1], tokens[3]) << endl;
-			}
-			else if (tokens[0] == "sltiu")
-			{
+	disassembler.setSymbols(program);
 
-				it = I_Instructions.find(tokens[0]);
-				result << makeI_type(tokens[0], it->second, tokens[2], tokens[1], tokens[3]) << endl;
-			}
-			else if (tokens[0] == "beq")
-			{
+	vector<char> buffer(program.instruction_count * disassembler.maxLine());
 
-				it = I_Instructions.find(tokens[0]);
-				int temp = label_address(tokens[3]);
+	measure("formatting", [&]()
+			{ formatBitstrings(program.words, program.instruction_count, buffer.data()); });
 
-				if (temp == -1)
-				{
+	measure("disassembly", [&]()
+			{ disassembler.disassemble(program.words, program.instruction_count, 0x400000, buffer.data()); });
 
-					result << makeI_type(tokens[0], it->second, tokens[1], tokens[2], tokens[3]) << endl;
-				}
-				else
-				{
+	/* Latency of editing a line with the incremental assembler: a replacement that keeps the number of
+	   instructions, one that changes it, an insertion and an erasure, each at a random line of the .text
+	   segment, against loading the whole source again */
+	IncrementalAssembler incremental;
+	vector<size_t> instruction_lines;
+	vector<size_t> inserted;
+	std::mt19937 random(parameters.seed);
+	const int edits = 1000;
 
-					int relative_addr = temp - (0x400000 + ((PC * 4) + 4));
-					result << makeI_type(tokens[0], it->second, tokens[1], tokens[2], to_string(relative_addr / 4)) << endl;
-				}
-			}
-			else if (tokens[0] == "bgez")
-			{
+	{
+		stringstream lines(source);
+		bool text = false;
 
-				it = I_Instructions.find(tokens[0]);
-				int temp = label_address(tokens[2]);
+		for (size_t i = 0; getline(lines, line); i++)
+		{
+			if (text && line.find(':') == string::npos)
+				instruction_lines.push_back(i);
 
-				if (temp == -1)
-				{
+			text = text || line == ".text";
+		}
+	}
 
-					result << makeI_type(tokens[0], it->second, tokens[1], "00001", tokens[2]) << endl;
-				}
-				else
+	measure("load", [&]()
+			{ incremental.load(source); });
+
+	auto editing = [&](string stage, std::function<void()> edit)
+	{
+		measure(stage, [&]()
 				{
+					for (int i = 0; i < edits; i++)
+						edit(); });
 
-					int relative_addr = temp - (0x400000 + ((PC * 4) + 4));
-					result << makeI_type(tokens[0], it->second, tokens[1], "00001", to_string(relative_addr / 4)) << endl;
-				}
-			}
-			else if (tokens[0] == "bgezal")
-			{
+		best[stage] /= edits;
+	};
 
-				it = I_Instructions.find(tokens[0]);
-				int32_t temp = label_address(tokens[2]);
+	/* Only instructions are replaced, and the insertions are erased in reverse, so that no label goes away */
+	editing("replace", [&]()
+			{ incremental.editLine(instruction_lines[random() % instruction_lines.size()], "\taddu $t0, $t1, $t2"); });
 
-				if (temp == -1)
-				{
+	editing("resize", [&]()
+			{
+				size_t line = instruction_lines[random() % instruction_lines.size()];
+				incremental.editLine(line, (line % 2) ? "\tli $t0, 0x12345678" : "\tli $t0, 1"); });
 
-					result << makeI_type(tokens[0], it->second, tokens[1], "10001", tokens[2]) << endl;
-				}
-				else
-				{
+	editing("insert", [&]()
+			{
+				inserted.push_back(instruction_lines[random() % instruction_lines.size()]);
+				incremental.insertLine(inserted.back(), "\tsubu $t3, $t4, $t5"); });
 
-					int relative_addr = temp - (0x400000 + ((PC * 4) + 4));
-					result << makeI_type(tokens[0], it->second, tokens[1], "10001", to_string(relative_addr / 4)) << endl;
-				}
-			}
-			else if (tokens[0] == "bgtz")
+	editing("erase", [&]()
 			{
+				incremental.eraseLine(inserted.back());
+				inserted.pop_back(); });
 
-				it = I_Instructions.find(tokens[0]);
-				int temp = label_address(tokens[2]);
+	/* Reading the code back after a replacement re-encodes nothing else, after a resize it re-encodes the
+	   instructions that refer to a label and moved */
+	string machine_code = incremental.machineCode();
+	const int reads = 20;
 
-				if (temp == -1)
+	measure("machineCode", [&]()
+			{
+				for (int i = 0; i < reads; i++)
 				{
+					incremental.editLine(instruction_lines[random() % instruction_lines.size()], "\taddu $t0, $t1, $t2");
+					machine_code = incremental.machineCode();
+				} });
 
-					result << makeI_type(tokens[0], it->second, tokens[1], "00000", tokens[2]) << endl;
-				}
-				else
-				{
+	best["machineCode"] /= reads;
 
-					int relative_addr = temp - (0x400000 + ((PC * 4) + 4));
-					result << makeI_type(tokens[0], it->second, tokens[1], "00000", to_string(relative_addr / 4)) << endl;
-				}
-			}
-			else if (tokens[0] == "blez")
+	measure("relocation", [&]()
 			{
+				for (int i = 0; i < reads; i++)
+				{
+					size_t line = instruction_lines[random() % instruction_lines.size()];
 
-				it = I_Instructions.find(tokens[0]);
-				int temp = label_address(tokens[2]);
+					incremental.editLine(line, (i % 2) ? "\tli $t0, 0x12345678" : "\tli $t0, 1");
+					machine_code = incremental.machineCode();
+				} });
 
-				if (temp == -1)
-				{
+	best["relocation"] /= reads;
 
-					result << makeI_type(tokens[0], it->second, tokens[1], "00000", tokens[2]) << endl;
-				}
-				else
-				{
+	/* Execution of a loop of overflow-checked arithmetic and traps that never fire, and of the same loop
+	   with unchecked instructions. The checks are folded into the handlers, so both should run alike */
+	auto execution = [&](bool checked)
+	{
+		string kernel = ".data\n.text\nmain:\n\tli $t0, " + to_string(parameters.instructions) + "\n\tli $t2, 0\nloop:\n";
 
-					int relative_addr = temp - (0x400000 + ((PC * 4) + 4));
-					result << makeI_type(tokens[0], it->second, tokens[1], "00000", to_string(relative_addr / 4)) << endl;
-				}
-			}
-			else if (tokens[0] == "bltzal")
-			{
+		if (checked)
+			kernel += "\tadd $t1, $t1, $t2\n\taddi $t3, $t3, 1\n\tsub $t4, $t4, $t2\n\tteq $t3, $zero\n"
+					  "\ttlti $t0, 0\n\ttne $t1, $t2\n\taddi $t0, $t0, -1\n";
+		else
+			kernel += "\taddu $t1, $t1, $t2\n\taddiu $t3, $t3, 1\n\tsubu $t4, $t4, $t2\n\tsltu $t5, $t3, $zero\n"
+					  "\tslti $t6, $t0, 0\n\tsltu $t7, $t1, $t2\n\taddiu $t0, $t0, -1\n";
 
-				it = I_Instructions.find(tokens[0]);
-				int temp = label_address(tokens[2]);
+		kernel += "\tbne $t0, $zero, loop\n\tli $v0, 10\n\tsyscall\n";
 
-				if (temp == -1)
-				{
+		double fastest = 0;
 
-					result << makeI_type(tokens[0], it->second, tokens[1], "10000", tokens[2]) << endl;
-				}
-				else
-				{
+		for (int i = 0; i < repeat; i++)
+		{
+			Simulator simulator;
 
-					int relative_addr = temp - (0x400000 + ((PC * 4) + 4));
-					result << makeI_type(tokens[0], it->second, tokens[1], "10000", to_string(relative_addr / 4)) << endl;
-				}
-			}
-			else if (tokens[0] == "bltz")
-			{
+			if (simulator.loadSource(kernel) && simulator.run(1) == 0)
+				fastest = std::max(fastest, simulator.retired / simulator.seconds);
+		}
 
-				it = I_Instructions.find(tokens[0]);
-				int temp = label_address(tokens[2]);
+		return fastest;
+	};
 
-				if (temp == -1)
-				{
+	double checked = execution(true);
+	double unchecked = execution(false);
 
-					result << makeI_type(tokens[0], it->second, tokens[1], "00000", tokens[2]) << endl;
-				}
-				else
-				{
+	/* Floating-point kernels over an array of 1024 elements: a scaled sum with a compare and branch in
+	   single precision, and a multiply-add with a division in double precision */
+	auto floating_point = [&](bool precision_double)
+	{
+		string values;
 
-					int relative_addr = temp - (0x400000 + ((PC * 4) + 4));
-					result << makeI_type(tokens[0], it->second, tokens[1], "00000", to_string(relative_addr / 4)) << endl;
-				}
-			}
-			else if (tokens[0] == "bne")
-			{
+		for (int i = 0; i < 1024; i++)
+			values += (i ? ", " : "") + to_string(1 + i % 7) + ".5";
 
-				it = I_Instructions.find(tokens[0]);
-				int temp = label_address(tokens[3]);
+		string kernel = string(".data\narray: ") + (precision_double ? ".double " : ".float ") + values +
+						"\n.text\nmain:\n\tli $t0, " + to_string(parameters.instructions) +
+						"\n\tla $s0, array\n\tli $t3, 0\n\tli $t1, 3\n\tmtc1 $t1, $f4\n";
 
-				if (temp == -1)
-				{
+		if (precision_double)
+			kernel += "\tcvt.d.w $f4, $f4\nloop:\n\taddu $t2, $s0, $t3\n\tldc1 $f0, 0($t2)\n\tmul.d $f2, $f0, $f4\n"
+					  "\tadd.d $f6, $f6, $f2\n\tdiv.d $f8, $f6, $f4\n\tsub.d $f2, $f2, $f8\n\tsdc1 $f2, 0($t2)\n"
+					  "\taddiu $t3, $t3, 8\n\tandi $t3, $t3, 8191\n";
+		else
+			kernel += "\tcvt.s.w $f4, $f4\nloop:\n\taddu $t2, $s0, $t3\n\tlwc1 $f0, 0($t2)\n\tmul.s $f2, $f0, $f4\n"
+					  "\tc.lt.s $f6, $f2\n\tbc1t next\n\tadd.s $f6, $f6, $f2\nnext:\n\tsub.s $f2, $f2, $f0\n"
+					  "\tswc1 $f2, 0($t2)\n\taddiu $t3, $t3, 4\n\tandi $t3, $t3, 4095\n";
 
-					result << makeI_type(tokens[0], it->second, tokens[1], tokens[2], tokens[3]) << endl;
-				}
-				else
-				{
+		kernel += "\taddiu $t0, $t0, -1\n\tbne $t0, $zero, loop\n\tli $v0, 10\n\tsyscall\n";
 
-					int relative_addr = temp - (0x400000 + ((PC * 4) + 4));
-					result << makeI_type(tokens[0], it->second, tokens[1], tokens[2], to_string(relative_addr / 4)) << endl;
-				}
-			}
-			else if (tokens[0] == "j")
-			{
+		double fastest = 0;
 
-				it = J_Instructions.find(tokens[0]);
-				int temp = label_address(tokens[1]);
+		for (int i = 0; i < repeat; i++)
+		{
+			Simulator simulator;
 
-				if (temp == -1)
-				{
+			if (simulator.loadSource(kernel) && simulator.run(1) == 0)
+				fastest = std::max(fastest, simulator.retired / simulator.seconds);
+		}
 
-					result << makeJ_type(it->second, tokens[1]) << endl;
-				}
-				else
-				{
+		return fastest;
+	};
 
-					result << makeJ_type(it->second, to_string(temp / 4)) << endl;
-				}
-			}
-			else if (tokens[0] == "jal")
-			{
+	double single_precision = floating_point(false);
+	double double_precision = floating_point(true);
 
-				it = J_Instructions.find(tokens[0]);
-				int temp = label_address(tokens[1]);
+	stringstream json;
+	json << "{\n  \"parameters\": {\"instructions\": " << parameters.instructions
+		 << ", \"label_density\": " << parameters.label_density << ", \"branch_ratio\": " << parameters.branch_ratio
+		 << ", \"data_words\": " << parameters.data_words << ", \"seed\": " << parameters.seed
+		 << ", \"repeat\": " << repeat << ", \"source_bytes\": " << source.size() << "},\n  \"stages\": {";
 
-				if (temp == -1)
-				{
+	bool first = true;
 
-					result << makeJ_type(it->second, tokens[1]) << endl;
-				}
-				else
-				{
+	for (string stage : {"removeComments", "firstParse", "secondParse", "encoding", "formatting", "disassembly"})
+	{
+		json << (first ? "\n" : ",\n") << "    \"" << stage << "\": {\"seconds\": " << best[stage]
+			 << ", \"instructions_per_second\": " << parameters.instructions / best[stage] << "}";
+		first = false;
+	}
 
-					result << makeJ_type(it->second, to_string(temp >> 2)) << endl;
-				}
-			}
-			else if (tokens[0] == "jalr")
-			{
+	json << "\n  },\n  \"execution\": {\"checked_instructions_per_second\": " << checked
+		 << ", \"unchecked_instructions_per_second\": " << unchecked << ", \"ratio\": " << checked / unchecked << "},\n"
+		 << "  \"floating_point\": {\"single_instructions_per_second\": " << single_precision
+		 << ", \"double_instructions_per_second\": " << double_precision << "},\n"
+		 << "  \"editing\": {\"load_seconds\": " << best["load"] << ", \"replace_seconds\": " << best["replace"]
+		 << ", \"resize_seconds\": " << best["resize"] << ", \"insert_seconds\": " << best["insert"]
+		 << ", \"erase_seconds\": " << best["erase"] << ", \"machine_code_seconds\": " << best["machineCode"]
+		 << ", \"relocation_seconds\": " << best["relocation"] << "}\n}\n";
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], tokens[2], "", "0", it->second) << endl;
-			}
-			else if (tokens[0] == "jr")
-			{
+	if (output.empty())
+	{
+		cout << json.str();
+		return 0;
+	}
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], "", tokens[1], "", "0", it->second) << endl;
-			}
-			else if (tokens[0] == "teq")
-			{
+	std::ofstream outfile(output);
+	outfile << json.str();
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second) << endl;
-			}
-			else if (tokens[0] == "teqi")
-			{
+	return outfile.good() ? 0 : 1;
+}
 
-				it = I_Instructions.find(tokens[0]);
-				result << makeI_type(tokens[0], it->second, tokens[1], "01100", tokens[2]) << endl;
-			}
-			else if (tokens[0] == "tne")
-			{
+/* Define MIPS_ASSEMBLER_LIBRARY to use this file as a library without its main function */
+#ifndef MIPS_ASSEMBLER_LIBRARY
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second) << endl;
-			}
-			else if (tokens[0] == "tnei")
-			{
+/* Main function */
+int main(int argc, char *argv[])
+{
+	vector<string> args(argv + 1, argv + argc);
+	std::unique_ptr<MetricsExporter> exporter;
+	string metrics_path;
+	string metrics_format;
+	int metrics_interval = 1000;
+
+	/* --metrics path [--metrics-format json|prometheus] [--metrics-interval ms], with any other command:
+	   writes the counters to path every interval and at the end, in the Prometheus text format by
+	   default when path ends in .prom and in JSON otherwise */
+	for (size_t i = 0; i + 1 < args.size();)
+	{
 
-				it = I_Instructions.find(tokens[0]);
-				result << makeI_type(tokens[0], it->second, tokens[1], "01110", tokens[2]) << endl;
-			}
-			else if (tokens[0] == "tge")
-			{
+		if (args[i] == "--metrics")
+			metrics_path = args[i + 1];
+		else if (args[i] == "--metrics-format")
+			metrics_format = args[i + 1];
+		else if (args[i] == "--metrics-interval")
+			metrics_interval = stoi(args[i + 1]);
+		else
+		{
+			i++;
+			continue;
+		}
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second) << endl;
-			}
-			else if (tokens[0] == "tgeu")
-			{
+		args.erase(args.begin() + i, args.begin() + i + 2);
+	}
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second) << endl;
-			}
-			else if (tokens[0] == "tgei")
-			{
+	if (!metrics_path.empty())
+	{
+		bool prometheus = metrics_format.empty() ? metrics_path.size() > 5 && metrics_path.compare(metrics_path.size() - 5, 5, ".prom") == 0
+												 : metrics_format == "prometheus";
 
-				it = I_Instructions.find(tokens[0]);
-				result << makeI_type(tokens[0], it->second, tokens[1], "01000", tokens[2]) << endl;
-			}
-			else if (tokens[0] == "tgeiu")
-			{
+		metrics.enabled = true;
+		exporter = std::make_unique<MetricsExporter>(metrics_path, prometheus, std::max(10, metrics_interval));
+	}
 
-				it = I_Instructions.find(tokens[0]);
-				result << makeI_type(tokens[0], it->second, tokens[1], "01001", tokens[2]) << endl;
-			}
-			else if (tokens[0] == "tlt")
-			{
+	/* --benchmark [--size N] [--labels D] [--branches R] [--data N] [--seed S] [--repeat K] [--output file.json] */
+	if (!args.empty() && args[0] == "--benchmark")
+	{
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second) << endl;
-			}
-			else if (tokens[0] == "tltu")
-			{
+		WorkloadParameters parameters;
+		int repeat = 5;
+		string output;
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], "", tokens[1], tokens[2], "0", it->second) << endl;
-			}
-			else if (tokens[0] == "tlti")
-			{
+		for (size_t i = 1; i + 1 < args.size(); i += 2)
+		{
 
-				it = I_Instructions.find(tokens[0]);
-				result << makeI_type(tokens[0], it->second, tokens[1], "01010", tokens[2]) << endl;
-			}
-			else if (tokens[0] == "tltiu")
-			{
+			if (args[i] == "--size")
+				parameters.instructions = stoi(args[i + 1]);
+			else if (args[i] == "--labels")
+				parameters.label_density = stod(args[i + 1]);
+			else if (args[i] == "--branches")
+				parameters.branch_ratio = stod(args[i + 1]);
+			else if (args[i] == "--data")
+				parameters.data_words = stoi(args[i + 1]);
+			else if (args[i] == "--seed")
+				parameters.seed = stoul(args[i + 1]);
+			else if (args[i] == "--repeat")
+				repeat = stoi(args[i + 1]);
+			else if (args[i] == "--output")
+				output = args[i + 1];
+		}
 
-				it = I_Instructions.find(tokens[0]);
-				result << makeI_type(tokens[0], it->second, tokens[1], "01011", tokens[2]) << endl;
-			}
-			else if (tokens[0] == "lb")
-			{
+		return benchmark(parameters, std::max(1, repeat), output);
+	}
 
-				it = I_Instructions.find(tokens[0]);
-				size_t open_bracket = tokens[2].find('(');
-				size_t close_bracket = tokens[2].find(')');
-				string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+	/* --footprint file: memory taken by the program in its compact IR */
+	if (args.size() == 2 && args[0] == "--footprint")
+	{
 
-				result << makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]) << endl;
-			}
-			else if (tokens[0] == "lbu")
-			{
+		std::ifstream infile(args[1]);
+		stringstream source;
 
-				it = I_Instructions.find(tokens[0]);
-				size_t open_bracket = tokens[2].find('(');
-				size_t close_bracket = tokens[2].find(')');
-				string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+		if (!infile.is_open())
+			return 1;
 
-				result << makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]) << endl;
-			}
-			else if (tokens[0] == "lh")
-			{
+		source << infile.rdbuf();
 
-				it = I_Instructions.find(tokens[0]);
-				size_t open_bracket = tokens[2].find('(');
-				size_t close_bracket = tokens[2].find(')');
-				string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+		Assembler assembler;
 
-				result << makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]) << endl;
-			}
-			else if (tokens[0] == "lhu")
-			{
+		assembler.assemble(source.str()).program.reportFootprint(cout);
+		return 0;
+	}
 
-				it = I_Instructions.find(tokens[0]);
-				size_t open_bracket = tokens[2].find('(');
-				size_t close_bracket = tokens[2].find(')');
-				string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+	/* --disassemble file: assembles the file and prints its disassembly */
+	if (args.size() == 2 && args[0] == "--disassemble")
+	{
 
-				result << makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]) << endl;
-			}
-			else if (tokens[0] == "lw")
-			{
+		std::ifstream infile(args[1]);
+		stringstream source;
 
-				it = I_Instructions.find(tokens[0]);
-				size_t open_bracket = tokens[2].find('(');
-				size_t close_bracket = tokens[2].find(')');
-				string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+		if (!infile.is_open())
+			return 1;
 
-				result << makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]) << endl;
-			}
-			else if (tokens[0] == "lwl")
-			{
+		source << infile.rdbuf();
 
-				it = I_Instructions.find(tokens[0]);
-				size_t open_bracket = tokens[2].find('(');
-				size_t close_bracket = tokens[2].find(')');
-				string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+		Assembler assembler;
+		Disassembler disassembler;
+		const ProgramIR &program = assembler.assemble(source.str()).program;
 
-				result << makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]) << endl;
-			}
-			else if (tokens[0] == "lwr")
-			{
+		disassembler.setSymbols(program);
 
-				it = I_Instructions.find(tokens[0]);
-				size_t open_bracket = tokens[2].find('(');
-				size_t close_bracket = tokens[2].find(')');
-				string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+		vector<char> buffer(program.instruction_count * disassembler.maxLine());
 
-				result << makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]) << endl;
-			}
-			else if (tokens[0] == "ll")
-			{
+		size_t length = disassembler.disassemble(program.words, program.instruction_count, 0x400000, buffer.data());
 
-				it = I_Instructions.find(tokens[0]);
-				size_t open_bracket = tokens[2].find('(');
-				size_t close_bracket = tokens[2].find(')');
-				string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+		cout.write(buffer.data(), length);
+		return 0;
+	}
 
-				result << makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]) << endl;
-			}
-			else if (tokens[0] == "sb")
-			{
+	/* --load file: maps an ELF executable into a guest memory and prints the time it took */
+	if (args.size() == 2 && args[0] == "--load")
+	{
 
-				it = I_Instructions.find(tokens[0]);
-				size_t open_bracket = tokens[2].find('(');
-				size_t close_bracket = tokens[2].find(')');
-				string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+		return loadProgram(args[1]);
+	}
 
-				result << makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]) << endl;
-			}
-			else if (tokens[0] == "sh")
-			{
+	/* --run file [--harts N]: runs an executable or a source file on N harts */
+	if (args.size() >= 2 && args[0] == "--run")
+	{
 
-				it = I_Instructions.find(tokens[0]);
-				size_t open_bracket = tokens[2].find('(');
-				size_t close_bracket = tokens[2].find(')');
-				string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+		int hart_count = 1;
 
-				result << makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]) << endl;
-			}
-			else if (tokens[0] == "sw")
-			{
+		if (args.size() == 4 && args[2] == "--harts")
+			hart_count = stoi(args[3]);
 
-				it = I_Instructions.find(tokens[0]);
-				size_t open_bracket = tokens[2].find('(');
-				size_t close_bracket = tokens[2].find(')');
-				string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+		return runProgram(args[1], std::max(1, std::min(hart_count, 64)));
+	}
 
-				result << makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]) << endl;
-			}
-			else if (tokens[0] == "swl")
-			{
+	/* --gdb file [--port P]: debugs a program with GDB connected to port P (1234 by default) */
+	if (args.size() >= 2 && args[0] == "--gdb")
+	{
 
-				it = I_Instructions.find(tokens[0]);
-				size_t open_bracket = tokens[2].find('(');
-				size_t close_bracket = tokens[2].find(')');
-				string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+		int port = 1234;
 
-				result << makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]) << endl;
-			}
-			else if (tokens[0] == "swr")
-			{
+		if (args.size() == 4 && args[2] == "--port")
+			port = stoi(args[3]);
 
-				it = I_Instructions.find(tokens[0]);
-				size_t open_bracket = tokens[2].find('(');
-				size_t close_bracket = tokens[2].find(')');
-				string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+		return debugProgram(args[1], port);
+	}
 
-				result << makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]) << endl;
-			}
-			else if (tokens[0] == "sc")
-			{
+	/* --simpoint file [--interval N] [--clusters K] [--validate]: sampled detailed simulation */
+	if (args.size() >= 2 && args[0] == "--simpoint")
+	{
 
-				it = I_Instructions.find(tokens[0]);
-				size_t open_bracket = tokens[2].find('(');
-				size_t close_bracket = tokens[2].find(')');
-				string rs = tokens[2].substr(open_bracket + 1, close_bracket - (open_bracket + 1));
+		uint64_t interval_length = 100000;
+		int cluster_count = 10;
+		bool validate = false;
 
-				result << makeI_type(tokens[0], it->second, rs, tokens[1], tokens[2]) << endl;
-			}
-			else if (tokens[0] == "mfhi")
-			{
+		for (size_t i = 2; i < args.size(); i++)
+		{
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], "", "", "0", it->second) << endl;
-			}
-			else if (tokens[0] == "mflo")
-			{
+			if (args[i] == "--interval" && i + 1 < args.size())
+				interval_length = std::max(1ul, stoul(args[++i]));
+			else if (args[i] == "--clusters" && i + 1 < args.size())
+				cluster_count = stoi(args[++i]);
+			else if (args[i] == "--validate")
+				validate = true;
+		}
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], tokens[1], "", "", "0", it->second) << endl;
-			}
-			else if (tokens[0] == "mthi")
-			{
+		return simpoint(args[1], interval_length, cluster_count, validate);
+	}
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], "", tokens[1], "", "0", it->second) << endl;
-			}
-			else if (tokens[0] == "mtlo")
-			{
+	/* --parallel file [--interval N] [--threads T] [--validate]: detailed simulation from checkpoints */
+	if (args.size() >= 2 && args[0] == "--parallel")
+	{
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], "", tokens[1], "", "0", it->second) << endl;
-			}
-			else if (tokens[0] == "syscall")
-			{
+		uint64_t interval_length = 1000000;
+		int thread_count = std::max(1u, std::thread::hardware_concurrency());
+		bool validate = false;
 
-				it = R_Instructions.find(tokens[0]);
-				result << makeR_type(tokens[0], "", "", "", "0", it->second) << endl;
-			}
+		for (size_t i = 2; i < args.size(); i++)
+		{
 
-			PC++;
-			tokens.clear();
+			if (args[i] == "--interval" && i + 1 < args.size())
+				interval_length = std::max(1ul, stoul(args[++i]));
+			else if (args[i] == "--threads" && i + 1 < args.size())
+				thread_count = stoi(args[++i]);
+			else if (args[i] == "--validate")
+				validate = true;
 		}
+
+		return parallelSimulation(args[1], interval_length, thread_count, validate);
 	}
 
-	return result;
-}
+	/* [file] [--elf out.o [--executable] [--little-endian]] [--optimize]: assembles the given file, or the
+	   input_test.txt file, optionally through the peephole optimizer, and prints the machine code or writes it
+	   as an ELF relocatable object or executable */
+	string filename = "input_test.txt";
+	string elf_filename;
+	bool executable = false;
+	bool big_endian = true;
+	bool optimize = false;
 
-/* Main assembling function */
-int assemble(string filename)
-{
-	ifstream infile;
-	infile.open(filename);
-	if (infile.is_open())
+	for (size_t i = 0; i < args.size(); i++)
 	{
-		stringstream formatted_file = removeComments(infile);
-		string no_comments = formatted_file.str();
-		firstParse(no_comments);
-
-		stringstream result = secondParse(formatted_file);
-
-		string x = result.str();
 
-		cout << x;
+		if (args[i] == "--elf" && i + 1 < args.size())
+			elf_filename = args[++i];
+		else if (args[i] == "--executable")
+			executable = true;
+		else if (args[i] == "--little-endian")
+			big_endian = false;
+		else if (args[i] == "--optimize")
+			optimize = true;
+		else
+			filename = args[i];
 	}
 
-	infile.close();
-	return 0;
-}
+	return assemble(filename, elf_filename, big_endian, executable, optimize);
+};
 
-/* Main function */
-int main()
-{
-	/* use the input_test.txt file */
-	assemble("C:\\Users\\Bubung\\Documents\\input_test.txt");
-	return 0;
-};
\ No newline at end of file
+#endif
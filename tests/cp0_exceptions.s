@@ -0,0 +1,164 @@
+# Raises an overflow, a trap, an address error on a load and an unknown syscall, each returning with
+# eret from a handler that records the exception code of Cause and BadVAddr. EBase is the start of the
+# code, so the handler has to be at 0x400180, after the padding
+.data
+codes: .word 0, 0, 0, 0
+count: .word 0
+address: .word 0
+.text
+main:
+	j start
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+handler:
+	mfc0 $k0, $13
+	srl $k0, $k0, 2
+	andi $k0, $k0, 31
+	la $k1, count
+	lw $k1, 0($k1)
+	sll $k1, $k1, 2
+	la $t9, codes
+	addu $k1, $k1, $t9
+	sw $k0, 0($k1)
+	la $k1, count
+	lw $k0, 0($k1)
+	addiu $k0, $k0, 1
+	sw $k0, 0($k1)
+	mfc0 $k0, $8
+	la $k1, address
+	sw $k0, 0($k1)
+	mfc0 $k0, $14
+	addiu $k0, $k0, 4
+	mtc0 $k0, $14
+	eret
+start:
+	lui $t0, 64
+	mtc0 $t0, $15, 1
+	li $t1, 0x7fffffff
+	addi $t1, $t1, 1
+	teq $zero, $zero
+	li $t2, 3
+	lw $t3, 2($t2)
+	li $v0, 99
+	syscall
+	la $s0, codes
+	li $s1, 4
+print:
+	lw $a0, 0($s0)
+	li $v0, 1
+	syscall
+	li $a0, 32
+	li $v0, 11
+	syscall
+	addiu $s0, $s0, 4
+	addiu $s1, $s1, -1
+	bne $s1, $zero, print
+	la $t0, address
+	lw $a0, 0($t0)
+	li $v0, 1
+	syscall
+	li $a0, 32
+	li $v0, 11
+	syscall
+	mfc0 $a0, $12
+	andi $a0, $a0, 2
+	li $v0, 1
+	syscall
+	li $a0, 10
+	li $v0, 11
+	syscall
+	li $v0, 10
+	syscall
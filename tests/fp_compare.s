@@ -0,0 +1,63 @@
+# Compares singles and doubles with c.eq, c.lt, c.le and c.un and branches on the result with bc1t and
+# bc1f, printing 1 for a taken branch and 0 otherwise, then prints a sum of singles and a quotient of doubles
+.data
+one: .float 1.5
+two: .float 2.5
+third: .double 1.0
+three: .double 3.0
+.text
+main:
+	la $t0, one
+	lwc1 $f0, 0($t0)
+	lwc1 $f1, 4($t0)
+	la $t0, third
+	ldc1 $f2, 0($t0)
+	ldc1 $f4, 8($t0)
+	c.lt.s $f0, $f1
+	jal taken_if_true
+	c.lt.s $f1, $f0
+	jal taken_if_true
+	c.eq.s $f0, $f0
+	jal taken_if_true
+	c.le.d $f4, $f2
+	jal taken_if_true
+	c.le.d $f2, $f4
+	jal taken_if_true
+	c.eq.d $f2, $f4
+	jal taken_if_false
+	sub.s $f6, $f0, $f0
+	div.s $f6, $f6, $f6
+	c.un.s $f6, $f0
+	jal taken_if_true
+	c.eq.s $f6, $f6
+	jal taken_if_false
+	li $a0, 10
+	li $v0, 11
+	syscall
+	add.s $f12, $f0, $f1
+	li $v0, 2
+	syscall
+	li $a0, 10
+	li $v0, 11
+	syscall
+	div.d $f12, $f2, $f4
+	li $v0, 3
+	syscall
+	li $a0, 10
+	li $v0, 11
+	syscall
+	li $v0, 10
+	syscall
+taken_if_true:
+	li $a0, 0
+	bc1f print
+	li $a0, 1
+	j print
+taken_if_false:
+	li $a0, 0
+	bc1t print
+	li $a0, 1
+print:
+	li $v0, 1
+	syscall
+	jr $ra
@@ -0,0 +1,39 @@
+# Each hart adds 1 to a shared counter a million times with ll/sc, then hart 0 waits for all of them
+# and prints the total, a million times the number of harts. The harts are preempted in the middle of their
+# loops, so that plain loads and stores would lose increments
+.data
+counter: .word 0
+finished: .word 0
+.text
+main:
+	move $s0, $a0
+	move $s1, $a1
+	la $t0, counter
+	li $t1, 1000000
+add:
+	ll $t2, 0($t0)
+	addiu $t2, $t2, 1
+	sc $t2, 0($t0)
+	beq $t2, $zero, add
+	addiu $t1, $t1, -1
+	bne $t1, $zero, add
+	la $t0, finished
+done:
+	ll $t2, 0($t0)
+	addiu $t2, $t2, 1
+	sc $t2, 0($t0)
+	beq $t2, $zero, done
+	bne $s0, $zero, exit
+wait:
+	lw $t2, 0($t0)
+	bne $t2, $s1, wait
+	la $t0, counter
+	lw $a0, 0($t0)
+	li $v0, 1
+	syscall
+	li $a0, 10
+	li $v0, 11
+	syscall
+exit:
+	li $v0, 10
+	syscall
@@ -0,0 +1,37 @@
+# Fills 256 KB of heap with a linear congruential sequence, then runs passes that add each word to the
+# next one, so that every interval writes pages the checkpoints have to carry to the detailed threads
+.text
+main:
+	li $v0, 9
+	li $a0, 262144
+	syscall
+	move $s0, $v0
+	li $t0, 0
+	li $t1, 65536
+	li $t2, 12345
+	li $t3, 1103515245
+fill:
+	mul $t2, $t2, $t3
+	addiu $t2, $t2, 12345
+	sll $t4, $t0, 2
+	addu $t4, $t4, $s0
+	sw $t2, 0($t4)
+	addiu $t0, $t0, 1
+	bne $t0, $t1, fill
+	li $s1, 8
+pass:
+	move $t4, $s0
+	li $t0, 1
+	lw $t5, 0($t4)
+add:
+	lw $t6, 4($t4)
+	addu $t6, $t6, $t5
+	sw $t6, 4($t4)
+	move $t5, $t6
+	addiu $t4, $t4, 4
+	addiu $t0, $t0, 1
+	bne $t0, $t1, add
+	addiu $s1, $s1, -1
+	bne $s1, $zero, pass
+	li $v0, 10
+	syscall
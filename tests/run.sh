@@ -0,0 +1,47 @@
+#!/bin/sh
+# Runs the regression programs of this directory and compares their output with the expected one.
+#
+# Usage: tests/run.sh [mips], where mips is the simulator, built from main.cpp when not given.
+#
+# Each test is a program name.s with name.expected, holding what the program prints on stdout
+# followed by the line "exit <status>". name.args holds the command line, with {} for the program,
+# and defaults to "--run {}". Times and speedups vary from run to run, so they are masked.
+
+cd "$(dirname "$0")" || exit 1
+
+if [ -n "$1" ]; then
+	mips=$1
+else
+	mips=./mips
+	g++ -std=c++17 -O2 -pthread -o "$mips" ../main.cpp || exit 1
+fi
+
+failed=0
+
+for program in *.s; do
+	name=${program%.s}
+	args="--run {}"
+
+	if [ -f "$name.args" ]; then
+		args=$(cat "$name.args")
+	fi
+
+	args=$(echo "$args" | sed "s|{}|$program|g")
+
+	# shellcheck disable=SC2086
+	actual=$("$mips" $args 2>/dev/null; echo "exit $?")
+	actual=$(echo "$actual" | sed -E 's/[0-9.e+-]+ s\b/<time> s/g; s/speedup [0-9.e+-]+x/speedup <n>x/g')
+
+	if [ "$actual" = "$(cat "$name.expected")" ]; then
+		echo "PASS $name"
+	else
+		echo "FAIL $name"
+		echo "$actual" | diff "$name.expected" - | sed 's/^/    /'
+		failed=$((failed + 1))
+	fi
+done
+
+if [ "$failed" -ne 0 ]; then
+	echo "$failed failed"
+	exit 1
+fi
@@ -0,0 +1,37 @@
+# Grows and shrinks the heap with sbrk and prints each result as an offset from the first break, or -1 for
+# a failure. A request past the end of the heap or below its start fails and leaves the break where it was
+.text
+main:
+	li $a0, 0
+	li $v0, 9
+	syscall
+	move $s0, $v0
+	li $a0, 10
+	jal sbrk
+	li $a0, 0x7fffffff
+	jal sbrk
+	li $a0, 0
+	jal sbrk
+	li $a0, -8
+	jal sbrk
+	li $a0, 0
+	jal sbrk
+	li $a0, -100
+	jal sbrk
+	li $a0, 0
+	jal sbrk
+	li $v0, 10
+	syscall
+sbrk:
+	li $v0, 9
+	syscall
+	li $a0, -1
+	beq $v0, $a0, print
+	sub $a0, $v0, $s0
+print:
+	li $v0, 1
+	syscall
+	li $a0, 10
+	li $v0, 11
+	syscall
+	jr $ra
@@ -0,0 +1,22 @@
+# Adds 1 to the immediate of the instruction at patched after each time it runs, so that the loop prints
+# 1, 2 and 3: the store to the code has to reach the predecoded instruction before it runs again
+.text
+main:
+	li $t6, 0
+	li $t7, 3
+	la $t0, patched
+again:
+patched:
+	addi $a0, $zero, 1
+	li $v0, 1
+	syscall
+	lw $t1, 0($t0)
+	addi $t1, $t1, 1
+	sw $t1, 0($t0)
+	addi $t6, $t6, 1
+	bne $t6, $t7, again
+	li $a0, 10
+	li $v0, 11
+	syscall
+	li $v0, 10
+	syscall
@@ -0,0 +1,14 @@
+# The same store to the code as in self_modifying.s, on two harts, where modifying the code is not
+# supported: the program stops with an error before printing
+.text
+main:
+	la $t0, patched
+	lw $t1, 0($t0)
+	addi $t1, $t1, 1
+	sw $t1, 0($t0)
+patched:
+	addi $a0, $zero, 1
+	li $v0, 1
+	syscall
+	li $v0, 10
+	syscall
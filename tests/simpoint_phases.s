@@ -0,0 +1,39 @@
+# Alternates a phase streaming through 1 MB of memory with a phase of multiplications and divisions,
+# twelve times, so that the intervals of the sampled simulation fall into a few distinct clusters
+.data
+result: .word 0
+.text
+main:
+	li $s7, 12
+outer:
+	li $v0, 9
+	li $a0, 1048576
+	syscall
+	move $s0, $v0
+	li $t0, 0
+	li $t1, 262144
+stream:
+	sll $t2, $t0, 2
+	addu $t2, $t2, $s0
+	lw $t3, 0($t2)
+	addu $t4, $t4, $t3
+	sw $t4, 0($t2)
+	addiu $t0, $t0, 8
+	bne $t0, $t1, stream
+	li $t0, 0
+	li $t1, 60000
+compute:
+	mult $t0, $t1
+	mflo $t5
+	addu $t4, $t4, $t5
+	div $t5, $t1
+	mfhi $t6
+	xor $t4, $t4, $t6
+	addiu $t0, $t0, 1
+	bne $t0, $t1, compute
+	addiu $s7, $s7, -1
+	bne $s7, $zero, outer
+	la $t2, result
+	sw $t4, 0($t2)
+	li $v0, 10
+	syscall